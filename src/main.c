@@ -9,51 +9,177 @@
 #include <st-universe.h>
 #include <st-object.h>
 #include <st-float.h>
+#include <st-dictionary.h>
+#include <st-memory.h>
 #include <optparse.h>
+#include <ptr_array.h>
 
 #include <stdlib.h>
 #include <stdio.h>
 #include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
 #include <sys/time.h>
 
-#define BUF_SIZE 2000
-
 static const char version[] =
 PACKAGE_STRING"\n"
 "Copyright (C) 2007-2008 Vincent Geddes";
 
-static bool verbose = false;
+static int verbose = false;
+static int lazy = false;
+static int interactive = false;
+static struct opt_str expression = { NULL, 0 };
 
 struct opt_spec options[] = {
     {opt_help, "h", "--help", NULL, "Show help information", NULL},
     {opt_version, "V", "--version", NULL, "Show version information" , (char *) version},
     {opt_store_1, "v", "--verbose", NULL, "Show verbose messages" , &verbose},
+    {opt_store_1, "l", "--lazy", NULL, "Compile kernel methods on first use" , &lazy},
+    {opt_store_str, "e", "--eval", "EXPR", "Evaluate EXPR after the files" , &expression},
+    {opt_store_1, "i", "--interactive", NULL, "Read and evaluate expressions one at a time" , &interactive},
     {NULL}
 };
 
 
-static void
-read_compile_stdin (void)
+/* Compiles `statements' as UndefinedObject>>doIt and runs it, leaving
+ * the printString of its value on top of the stack. Compile errors are
+ * reported at their line in `name', the statements starting at `line'.
+ */
+static bool
+evaluate (const char *name, st_uint line, const char *statements)
 {
     st_compiler_error error;
-    char buffer[BUF_SIZE];
-    char *string;
-    char c;
-    int i = 0;
 
-    while ((c = getchar ()) != EOF && i < (BUF_SIZE - 1))
-	buffer[i++] = c;
-    buffer[i] = '\0';
+    if (!st_compile_statements (ST_UNDEFINED_OBJECT_CLASS, "doIt", statements, &error)) {
+	fprintf (stderr, "%s:%i: %s\n", name, line + error.line - 1, error.message);
+	return false;
+    }
+
+    st_machine_initialize (&__machine);
+    st_machine_main (&__machine);
+
+    return __machine.success;
+}
+
+static bool
+is_blank (const char *string)
+{
+    return string[strspn (string, " \t\r\n")] == '\0';
+}
+
+/* Runs the chunks of a script one after the other, each compiled only
+ * once the one before has run. Chunks are separated by `!', as in the
+ * class files, with `!!' standing for a `!' of their own. A `!' in a
+ * string, a comment or a character literal belongs to it, so a script
+ * without chunks needs no bangs doubled. The value of the last chunk is
+ * printed.
+ */
+static bool
+run_script (const char *name, const char *text, st_uint size)
+{
+    st_oop  value;
+    st_uint i = 0, n, line = 1, start;
+    char   *chunk, quote;
+    bool    evaluated = false;
+
+    chunk = st_malloc (size + 1);
+
+    while (i < size) {
+	start = line;
+	for (n = 0; i < size; i++) {
+	    if (text[i] == '!' && !(i + 1 < size && text[i + 1] == '!')) {
+		i++;
+		break;
+	    }
+	    if (text[i] == '!') {
+		i++;
+	    } else if (text[i] == '\'' || text[i] == '"') {
+		/* copy up to the closing quote, which is copied below */
+		quote = text[i];
+		do {
+		    if (text[i] == '\n')
+			line++;
+		    chunk[n++] = text[i++];
+		} while (i < size && text[i] != quote);
+		if (i == size)
+		    break;
+	    } else if (text[i] == '$' && i + 1 < size) {
+		chunk[n++] = text[i++];
+	    }
+	    if (text[i] == '\n')
+		line++;
+	    chunk[n++] = text[i];
+	}
+	chunk[n] = '\0';
+
+	if (is_blank (chunk))
+	    continue;
+	if (!evaluate (name, start, chunk)) {
+	    st_free (chunk);
+	    return false;
+	}
+	evaluated = true;
+    }
+
+    st_free (chunk);
+
+    if (evaluated) {
+	/* inspect the returned value on top of the stack */
+	value = ST_STACK_PEEK ((&__machine));
+	if (st_object_format (value) != ST_FORMAT_BYTE_ARRAY)
+	    abort ();
+
+	putchar ('\n');
+	printf ("result: %s\n", (char *) st_byte_array_bytes (value));
+    }
+
+    return true;
+}
+
+/* reads all of standard input, in as few reads as it takes */
+static char *
+read_stdin (st_uint *size)
+{
+    char   *text;
+    st_uint capacity = 65536;
+    ssize_t count;
+
+    text = st_malloc (capacity);
+    *size = 0;
+
+    while ((count = read (STDIN_FILENO, text + *size, capacity - *size)) > 0) {
+	*size += count;
+	if (*size == capacity) {
+	    capacity *= 2;
+	    text = st_realloc (text, capacity);
+	}
+    }
+
+    return text;
+}
 
-    string = st_strconcat ("doIt ^ [", buffer, "] value", NULL);
+static bool
+run_file (const char *filename)
+{
+    const char *text;
+    st_uint size;
+    bool    succeeded;
+    char   *input;
 
-    if (!st_compile_string (ST_UNDEFINED_OBJECT_CLASS, string, &error)) {
-	fprintf (stderr, "panda:%i: %s\n",
-		 error.line, error.message);
-	exit (1);
+    if (strcmp (filename, "-") == 0) {
+	input = read_stdin (&size);
+	succeeded = run_script ("panda", input, size);
+	st_free (input);
+	return succeeded;
     }
 
-    st_free (string);
+    if (!st_file_map (filename, &text, &size))
+	return false;
+
+    succeeded = run_script (filename, text, size);
+    st_file_unmap (text, size);
+
+    return succeeded;
 }
 
 static double
@@ -62,34 +188,285 @@ get_elapsed_time (struct timeval before, struct timeval after)
     return after.tv_sec - before.tv_sec + (after.tv_usec - before.tv_usec) / 1.e6;
 }
 
+/*
+ * The interactive session bootstraps once and evaluates a line at a
+ * time. Variables declared with `| a b |' at the start of a line, or
+ * assigned to without being declared, live on from one line to the
+ * next in the Workspace dictionary, which the compiler looks in after
+ * the globals.
+ */
+
+/* what an evaluation cost */
+typedef struct
+{
+    double   seconds;
+    st_ulong allocated;
+    st_uint  collections;
+    double   paused;
+} Statistics;
+
+static Statistics last;
+
+static void
+declare (const char *name)
+{
+    st_oop symbol, workspace;
+
+    symbol = st_symbol_new (name);
+    workspace = st_global_get ("Workspace");
+    if (st_dictionary_association_at (ST_GLOBALS, symbol) == ST_NIL
+	&& st_dictionary_association_at (workspace, symbol) == ST_NIL)
+	st_dictionary_at_put (workspace, symbol, ST_NIL);
+}
+
+static bool
+is_bar (st_token *token)
+{
+    return st_token_get_type (token) == ST_TOKEN_BINARY_SELECTOR && streq (st_token_get_text (token), "|");
+}
+
+/* Adds the arguments and temporaries of the block being entered to
+ * `names', after a NULL where they start, and answers the next token.
+ */
+static st_token *
+declare_block_names (st_lexer *lexer, ptr_array names)
+{
+    st_token *token;
+    bool      arguments = false;
+
+    ptr_array_append (names, NULL);
+
+    token = st_lexer_next_token (lexer);
+    while (st_token_get_type (token) == ST_TOKEN_COLON) {
+	token = st_lexer_next_token (lexer);
+	if (st_token_get_type (token) != ST_TOKEN_IDENTIFIER)
+	    return token;
+	ptr_array_append (names, st_token_get_text (token));
+	arguments = true;
+	token = st_lexer_next_token (lexer);
+    }
+
+    if (arguments && is_bar (token))
+	token = st_lexer_next_token (lexer);
+
+    if (is_bar (token)) {
+	for (token = st_lexer_next_token (lexer);
+	     st_token_get_type (token) == ST_TOKEN_IDENTIFIER;
+	     token = st_lexer_next_token (lexer))
+	    ptr_array_append (names, st_token_get_text (token));
+	if (is_bar (token))
+	    token = st_lexer_next_token (lexer);
+    }
+
+    return token;
+}
+
+static bool
+is_block_name (ptr_array names, const char *name)
+{
+    char *other;
+
+    for (st_uint i = 0; i < ptr_array_length (names); i++) {
+	other = ptr_array_get_index (names, i);
+	if (other != NULL && streq (other, name))
+	    return true;
+    }
+    return false;
+}
+
+/* Declares the workspace variables of `input', blanking out a leading
+ * declaration so that its variables aren't temporaries of the doIt.
+ * Variables assigned to are declared too, unless they are arguments or
+ * temporaries of a block around the assignment.
+ */
+static void
+declare_variables (char *input)
+{
+    st_lexer *lexer;
+    st_token *token, *previous = NULL;
+    ptr_array names;
+    char     *bar;
+    bool      declared = false;
+
+    bar = input + strspn (input, " \t\r\n");
+
+    lexer = st_lexer_new (input);
+    st_lexer_filter_comments (lexer, true);
+    token = st_lexer_next_token (lexer);
+
+    if (*bar == '|' && st_token_get_type (token) == ST_TOKEN_BINARY_SELECTOR) {
+	for (token = st_lexer_next_token (lexer);
+	     st_token_get_type (token) == ST_TOKEN_IDENTIFIER;
+	     token = st_lexer_next_token (lexer))
+	    declare (st_token_get_text (token));
+	declared = (st_token_get_type (token) == ST_TOKEN_BINARY_SELECTOR);
+    }
+
+    /* the names declared by the blocks around the current token */
+    names = ptr_array_new (8);
+
+    while (st_token_get_type (token) != ST_TOKEN_EOF && st_token_get_type (token) != ST_TOKEN_INVALID) {
+	switch (st_token_get_type (token)) {
+	case ST_TOKEN_BLOCK_BEGIN:
+	    token = declare_block_names (lexer, names);
+	    previous = NULL;
+	    continue;
+	case ST_TOKEN_BLOCK_END:
+	    while (ptr_array_length (names) > 0
+		   && ptr_array_remove_index_fast (names, ptr_array_length (names) - 1) != NULL)
+		;
+	    break;
+	case ST_TOKEN_ASSIGN:
+	    if (previous != NULL && st_token_get_type (previous) == ST_TOKEN_IDENTIFIER
+		&& !is_block_name (names, st_token_get_text (previous)))
+		declare (st_token_get_text (previous));
+	    break;
+	default:
+	    break;
+	}
+	previous = token;
+	token = st_lexer_next_token (lexer);
+    }
+
+    ptr_array_free (names);
+    st_lexer_destroy (lexer);
+
+    if (declared)
+	memset (bar, ' ', strchr (bar + 1, '|') - bar + 1);
+}
+
+static double
+pause_seconds (void)
+{
+    return memory->total_pause_time.tv_sec + memory->total_pause_time.tv_nsec / 1.e9;
+}
+
+static void
+evaluate_line (char *input, bool timed)
+{
+    struct timeval before, after;
+    Statistics start;
+    st_oop     value;
+
+    declare_variables (input);
+
+    gettimeofday (&before, NULL);
+    start.allocated = st_memory_total_allocated ();
+    start.collections = memory->collections;
+    start.paused = pause_seconds ();
+
+    if (evaluate ("panda", 1, input)) {
+	value = ST_STACK_PEEK ((&__machine));
+	if (st_object_format (value) != ST_FORMAT_BYTE_ARRAY)
+	    abort ();
+	printf ("%s\n", (char *) st_byte_array_bytes (value));
+    }
+
+    gettimeofday (&after, NULL);
+    last.seconds = get_elapsed_time (before, after);
+    last.allocated = st_memory_total_allocated () - start.allocated;
+    last.collections = memory->collections - start.collections;
+    last.paused = pause_seconds () - start.paused;
+
+    if (timed)
+	printf ("time: %.3fms, allocated: %luK, collections: %u, paused: %.3fms\n",
+		last.seconds * 1000, last.allocated / 1024, last.collections, last.paused * 1000);
+}
+
+static void
+print_statistics (void)
+{
+    printf ("last evaluation: %.3fms, allocated: %luK, collections: %u, paused: %.3fms\n",
+	    last.seconds * 1000, last.allocated / 1024, last.collections, last.paused * 1000);
+    printf ("since startup: allocated: %luK, collections: %u, paused: %.3fms, heap: %luK\n",
+	    st_memory_total_allocated () / 1024, memory->collections, pause_seconds () * 1000,
+	    (st_ulong) ((memory->p - memory->start) * sizeof (st_oop)) / 1024);
+}
+
+/* whether `line' is the command `name', followed by its argument */
+static bool
+is_command (const char *line, const char *name, char **argument)
+{
+    size_t length = strlen (name);
+
+    if (strncmp (line, name, length) != 0 || (line[length] != '\0' && !strchr (" \t\r\n", line[length])))
+	return false;
+
+    *argument = (char *) line + length;
+    return true;
+}
+
+static void
+run_interactive (void)
+{
+    st_oop  symbol;
+    char   *line = NULL, *input, *argument;
+    size_t  capacity = 0;
+
+    symbol = st_symbol_new ("Workspace");
+    st_dictionary_at_put (ST_GLOBALS, symbol, st_dictionary_new ());
+
+    for (;;) {
+	printf ("panda> ");
+	fflush (stdout);
+	if (getline (&line, &capacity, stdin) < 0)
+	    break;
+
+	input = line + strspn (line, " \t");
+	if (is_command (input, ":quit", &argument)) {
+	    break;
+	} else if (is_command (input, ":gcstats", &argument)) {
+	    print_statistics ();
+	} else if (is_command (input, ":time", &argument)) {
+	    if (!is_blank (argument))
+		evaluate_line (argument, true);
+	} else if (is_command (input, ":help", &argument)) {
+	    printf (":time EXPR  evaluate EXPR and show the time, allocation and GC pauses it took\n"
+		    ":gcstats    show what the last evaluation and the session have cost\n"
+		    ":quit       leave\n");
+	} else if (!is_blank (input)) {
+	    evaluate_line (input, false);
+	}
+    }
+
+    putchar ('\n');
+    free (line);
+}
+
 int
 main (int argc, char *argv[])
 {
-    st_oop value;
+    bool ran = false;
 
     opt_basename (argv[0], '/');
-    opt_message ("Read Smalltalk expressions from standard input and evaluate them.");
-    opt_parse ("Usage: %s [options]", options, argv);
+    opt_message ("Evaluate the Smalltalk statements in the files, or in standard input if there are none.");
+    opt_parse ("Usage: %s [options] [file...]", options, argv);
     
     st_set_verbose_mode (verbose);
+    st_set_lazy_mode (lazy);
 
     st_initialize ();
 
-    read_compile_stdin ();
-
-    st_machine_initialize (&__machine);
-    st_machine_main (&__machine);
-    
-    /* inspect the returned value on top of the stack */
-    value = ST_STACK_PEEK ((&__machine));
-    if (st_object_format (value) != ST_FORMAT_BYTE_ARRAY)
-	abort ();
+    /* the arguments taken by options have been blanked out */
+    for (int i = 1; i < argc; i++) {
+	if (argv[i][0] == '\0')
+	    continue;
+	if (!run_file (argv[i]))
+	    return 1;
+	ran = true;
+    }
 
-    if (__machine.success) {
-	putchar ('\n');
-	printf ("result: %s\n", (char *) st_byte_array_bytes (value));
+    if (expression.s != NULL) {
+	expression.s[0] = expression.s0;
+	if (!run_script ("panda", expression.s, strlen (expression.s)))
+	    return 1;
+	ran = true;
     }
 
+    if (interactive || (!ran && isatty (STDIN_FILENO)))
+	run_interactive ();
+    else if (!ran && !run_file ("-"))
+	return 1;
+
     return 0;
 }
-
@@ -168,3 +168,24 @@ st_float_array_allocate (st_oop class, int size)
 
     return object;
 }
+
+st_oop
+st_mapped_bytes_new (st_oop class, st_uchar *bytes, int size)
+{
+    st_oop object;
+
+    object = st_memory_allocate (ST_SIZE_OOPS (struct st_mapped_bytes));
+    if (object == 0) {
+	st_memory_perform_gc ();
+	class = st_memory_remap_reference (class);
+	object = st_memory_allocate (ST_SIZE_OOPS (struct st_mapped_bytes));
+	st_assert (object != 0);
+    }
+
+    st_object_initialize_header (object, class);
+
+    ST_ARRAYED_OBJECT (object)->size = st_smi_new (size);
+    ST_MAPPED_BYTES (object)->bytes = bytes;
+
+    return object;
+}
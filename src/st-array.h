@@ -33,6 +33,7 @@
 #define ST_FLOAT_ARRAY(oop)    ((struct st_float_array *)    st_detag_pointer (oop))
 #define ST_WORD_ARRAY(oop)     ((struct st_word_array *)     st_detag_pointer (oop))
 #define ST_BYTE_ARRAY(oop)     ((struct st_byte_array *)     st_detag_pointer (oop))
+#define ST_MAPPED_BYTES(oop)   ((struct st_mapped_bytes *)   st_detag_pointer (oop))
 
 struct st_arrayed_object
 {
@@ -68,12 +69,22 @@ struct st_byte_array
     st_uchar bytes[];
 };
 
+/* bytes mapped from a file, outside the heap. The mapping is read only
+ * and is unmapped when the object is collected. */
+struct st_mapped_bytes
+{
+    struct st_arrayed_object __parent__;
+
+    st_uchar *bytes;
+};
+
 bool    st_byte_array_equal     (st_oop object, st_oop other);
 st_uint st_byte_array_hash      (st_oop object);
 st_oop  st_array_allocate       (st_oop class, st_uint size);
 st_oop  st_float_array_allocate (st_oop class, int size);
 st_oop  st_word_array_allocate  (st_oop class, int size);
 st_oop  st_byte_array_allocate  (st_oop class, int size);
+st_oop  st_mapped_bytes_new     (st_oop class, st_uchar *bytes, int size);
 
 static inline st_oop
 st_arrayed_object_size (st_oop object)
@@ -136,6 +147,12 @@ st_byte_array_at_put (st_oop object, int i, st_uchar value)
     st_byte_array_bytes (object)[i - 1] = value;
 }
 
+static inline st_uchar *
+st_mapped_bytes (st_oop object)
+{
+    return ST_MAPPED_BYTES (object)->bytes;
+}
+
 static inline double *
 st_float_array_elements (st_oop array)
 {
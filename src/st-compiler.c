@@ -9,7 +9,11 @@
 
 #include "st-lexer.h"
 #include "st-array.h"
+#include "st-method.h"
+#include "st-object.h"
+#include "st-memory.h"
 
+#include <ptr_array.h>
 #include <stdlib.h>
 #include <ctype.h>
 #include <string.h>
@@ -22,19 +26,52 @@ typedef struct {
 
     int line;
 
+    /* index into `sources' when filing in lazily, otherwise -1 */
+    int source;
+
 } FileInParser;
 
 /*
- * st_compile_string:
- * @class: The class for which the compiled method will be bound.
- * @string: Source code for the method
- * @error: return location for errors
- *
- * This function will compile a source string into a new CompiledMethod,
- * and place the method in the methodDictionary of the given class.
+ * Files which were filed in lazily. Their text is kept around for the
+ * lifetime of the VM so that method stubs can be compiled on demand.
  */
-bool
-st_compile_string (st_oop class, const char *string, st_compiler_error *error)
+typedef struct {
+
+    char       *filename;
+    const char *text;
+    st_uint     size;
+
+} SourceFile;
+
+static ST_THREAD_LOCAL ptr_array sources = NULL;
+
+/* makes the last of a method's statements answer its value */
+static void
+return_last_statement (st_lexer *lexer, st_node *method)
+{
+    st_node **link, *retrn;
+
+    link = &method->method.statements;
+    if (*link == NULL)
+	return;
+    while ((*link)->next != NULL)
+	link = &(*link)->next;
+
+    if ((*link)->type == ST_RETURN_NODE)
+	return;
+    else if ((*link)->type == ST_MESSAGE_NODE)
+	(*link)->message.is_statement = false;
+    else if ((*link)->type == ST_CASCADE_NODE)
+	(*link)->cascade.is_statement = false;
+
+    retrn = st_node_new (st_lexer_get_arena (lexer), ST_RETURN_NODE);
+    retrn->line = (*link)->line;
+    retrn->retrn.expression = *link;
+    *link = retrn;
+}
+
+static bool
+compile (st_oop class, const char *string, bool answer_last, st_compiler_error *error)
 {
     st_node  *node;    
     st_oop   method;
@@ -46,27 +83,78 @@ st_compile_string (st_oop class, const char *string, st_compiler_error *error)
     if (!lexer)
 	return false;
     
-    node = st_parser_parse (lexer, error);
-    st_lexer_destroy (lexer);
+    /* the syntax tree and the generator hold oops */
+    st_memory_defer_gc ();
 
-    if (!node)
+    node = st_parser_parse (lexer, error);
+    if (!node) {
+	st_memory_allow_gc ();
+	st_lexer_destroy (lexer);
 	return false;
+    }
+
+    if (answer_last)
+	return_last_statement (lexer, node);
 
     method = st_generate_method (class, node, error);
     if (method == ST_NIL) {
-	st_node_destroy (node);
+	st_memory_allow_gc ();
+	st_lexer_destroy (lexer);
 	return false;
     }
 
     st_dictionary_at_put (ST_BEHAVIOR (class)->method_dictionary,
 			  node->method.selector,
 			  method);
+    st_machine_method_changed (&__machine, class, node->method.selector);
+
+    st_memory_allow_gc ();
 
-    st_node_destroy (node);
+    /* releases the syntax tree too */
+    st_lexer_destroy (lexer);
 
     return true;
 }
 
+/*
+ * st_compile_string:
+ * @class: The class for which the compiled method will be bound.
+ * @string: Source code for the method
+ * @error: return location for errors
+ *
+ * This function will compile a source string into a new CompiledMethod,
+ * and place the method in the methodDictionary of the given class.
+ */
+bool
+st_compile_string (st_oop class, const char *string, st_compiler_error *error)
+{
+    return compile (class, string, false, error);
+}
+
+/*
+ * st_compile_statements:
+ * @class: The class for which the compiled method will be bound.
+ * @selector: The unary selector of the method
+ * @statements: Temporaries and statements making the body of the method
+ * @error: return location for errors
+ *
+ * Like st_compile_string(), except that the method answers the value of
+ * its last statement, as a block would. Errors are reported at the line
+ * in @statements.
+ */
+bool
+st_compile_statements (st_oop class, const char *selector, const char *statements, st_compiler_error *error)
+{
+    char *string;
+    bool  compiled;
+
+    string = st_strconcat (selector, " ", statements, NULL);
+    compiled = compile (class, string, true, error);
+    st_free (string);
+
+    return compiled;
+}
+
 static void
 filein_error (FileInParser *parser, st_token *token, const char *message)
 {
@@ -94,8 +182,7 @@ next_token (FileInParser *parser, st_lexer *lexer)
 static st_lexer *
 next_chunk (FileInParser *parser)
 {
-    st_lexer *lexer;
-    char *chunk;
+    st_input *chunk;
 
     parser->line = st_input_get_line (parser->input);
 
@@ -103,10 +190,25 @@ next_chunk (FileInParser *parser)
     if (!chunk)
 	return NULL;
     
-    lexer = st_lexer_new (chunk);
+    return st_lexer_new_for_input (chunk);
+}
 
-    st_free (chunk);
-    return lexer;
+static st_oop
+method_stub_new (int source, st_uint offset, st_oop selector)
+{
+    st_oop method;
+
+    method = st_object_new (ST_COMPILED_METHOD_CLASS);
+
+    ST_METHOD_HEADER (method)   = st_smi_new (0);
+    ST_METHOD_BYTECODE (method) = st_smi_new (offset);
+    ST_METHOD_LITERALS (method) = ST_NIL;
+    ST_METHOD_SELECTOR (method) = selector;
+
+    st_method_set_flags (method, ST_METHOD_LAZY);
+    st_method_set_source_index (method, source);
+
+    return method;
 }
 
 static void
@@ -117,10 +219,14 @@ parse_method (FileInParser *parser,
 {
     st_token *token = NULL;
     st_oop   class;
+    st_uint  offset;
     st_compiler_error error;
 
     st_lexer_destroy (lexer);
 
+    /* the class, the selector and the syntax tree are held in C */
+    st_memory_defer_gc ();
+
     /* get class or metaclass */
     class = st_global_get (class_name);
     if (class == ST_NIL)
@@ -130,36 +236,50 @@ parse_method (FileInParser *parser,
 	class = st_object_class (class);
 
     /* parse method chunk */
+    offset = st_input_index (parser->input);
     lexer = next_chunk (parser);
     if (!lexer)
 	filein_error (parser, token, "expected method definition");	
     
     st_node *node;
-    st_oop method;
-    
-    node = st_parser_parse (lexer, &error);
-    if (node == NULL)
-	goto error;
-    if (node->type != ST_METHOD_NODE)
-	printf ("%i\n", node->type);
+    st_oop method, selector;
+
+    if (parser->source >= 0) {
+
+	/* only the message pattern is parsed, the rest is compiled on first lookup */
+	selector = st_parser_parse_selector (lexer, &error);
+	if (selector == ST_NIL)
+	    goto error;
+
+	method = method_stub_new (parser->source, offset, selector);
+
+    } else {
+
+	node = st_parser_parse (lexer, &error);
+	if (node == NULL)
+	    goto error;
+	if (node->type != ST_METHOD_NODE)
+	    printf ("%i\n", node->type);
     
-    method = st_generate_method (class, node, &error);
-    if (method == ST_NIL)
-	goto error;
+	method = st_generate_method (class, node, &error);
+	if (method == ST_NIL)
+	    goto error;
+
+	selector = node->method.selector;
+    }
 	
     st_dictionary_at_put (ST_BEHAVIOR (class)->method_dictionary,
-			  node->method.selector,
+			  selector,
 			  method);
 
+    st_memory_allow_gc ();
  
-    st_node_destroy (node);
     st_lexer_destroy (lexer);
     st_free (class_name);
 
     return;
     
 error:
-    st_node_destroy (node);
     fprintf (stderr, "%s:%i: %s\n", parser->filename,
 	     parser->line + error.line - 1 ,
 	     error.message);
@@ -232,32 +352,127 @@ parse_chunks (FileInParser *parser)
 /* isn't declared in glibc string.h */
 char * basename (const char *FILENAME);
 
+static int
+add_source (const char *filename, const char *text, st_uint size)
+{
+    SourceFile *source;
+
+    if (sources == NULL)
+	sources = ptr_array_new (50);
+
+    if (sources->length > _ST_METHOD_SOURCE_MASK)
+	return -1;
+
+    source = st_new0 (SourceFile);
+    source->filename = st_strdup (filename);
+    source->text = text;
+    source->size = size;
+
+    ptr_array_append (sources, source);
+
+    return sources->length - 1;
+}
+
+static int
+line_at (const char *text, st_uint offset)
+{
+    int line = 1;
+
+    for (st_uint i = 0; i < offset; i++)
+	if (text[i] == '\n')
+	    line++;
+
+    return line;
+}
+
+/*
+ * st_compile_method_stub:
+ * @class: The class in whose methodDictionary the stub was found.
+ * @stub: A lazy CompiledMethod installed by st_compile_file_in.
+ *
+ * Compiles the source of a method stub and replaces the stub with
+ * the real CompiledMethod. Returns the new method.
+ */
+st_oop
+st_compile_method_stub (st_oop class, st_oop stub)
+{
+    st_compiler_error error;
+    SourceFile *source;
+    st_lexer   *lexer;
+    st_node    *node;
+    st_oop      method;
+    st_input   *input;
+    st_uint     offset;
+
+    st_assert (st_method_get_flags (stub) == ST_METHOD_LAZY);
+
+    /* stubs are compiled in the middle of a send, where nothing protects
+     * `class', nor the oops in the syntax tree and the generator */
+    st_memory_defer_gc ();
+
+    source = (SourceFile *) ptr_array_get_index (sources, st_method_get_source_index (stub));
+    offset = st_smi_value (ST_METHOD_BYTECODE (stub));
+
+    input = st_input_new_static (source->text + offset, source->size - offset);
+    lexer = st_lexer_new_for_input (st_input_next_chunk (input));
+    st_input_destroy (input);
+
+    node = st_parser_parse (lexer, &error);
+    if (node == NULL)
+	goto error;
+
+    method = st_generate_method (class, node, &error);
+    if (method == ST_NIL)
+	goto error;
+
+    st_dictionary_at_put (ST_BEHAVIOR (class)->method_dictionary,
+			  node->method.selector,
+			  method);
+
+    /* not a redefinition: the method cache never holds stubs,
+       so nothing needs to be flushed */
+    st_memory_allow_gc ();
+    st_lexer_destroy (lexer);
+
+    return method;
+
+error:
+    fprintf (stderr, "%s:%i: %s\n", source->filename,
+	     line_at (source->text, offset) + error.line - 1,
+	     error.message);
+    exit (1);
+}
+
 void
 st_compile_file_in (const char *filename)
 {
-    char *buffer;
+    const char *text;
+    st_uint size;
     FileInParser *parser;
 
     st_assert (filename != NULL);
 
-    if (!st_file_get_contents (filename, &buffer)) {
+    if (!st_file_map (filename, &text, &size)) {
 	return;
     }
     
     parser = st_new0 (FileInParser);
 
-    parser->input = st_input_new (buffer);
-    if (!parser->input) {
-	fprintf (stderr, "could not validate input file '%s'", filename);
-	return;
-    }
+    /* chunks are lexed straight out of the mapped file */
+    parser->input = st_input_new_static (text, size);
 
     parser->filename = basename (filename);
     parser->line     = 1;
+    parser->source   = -1;
+
+    /* the mapping is owned by the source table when filing in lazily */
+    if (st_get_lazy_mode ())
+	parser->source = add_source (parser->filename, text, size);
 
     parse_chunks (parser);
 
-    st_free (buffer);
+    if (parser->source < 0)
+	st_file_unmap (text, size);
     st_input_destroy (parser->input);
     st_free (parser);
 }
@@ -21,11 +21,22 @@ bool    st_compile_string   (st_oop      class,
 			     const char *string,
 			     st_compiler_error  *error);
 
+bool    st_compile_statements (st_oop      class,
+			       const char *selector,
+			       const char *statements,
+			       st_compiler_error  *error);
+
 void    st_compile_file_in  (const char *filename);
 
+st_oop  st_compile_method_stub (st_oop class,
+				st_oop stub);
+
 st_node *st_parser_parse     (st_lexer *lexer,
 			     st_compiler_error *error);
 
+st_oop  st_parser_parse_selector (st_lexer *lexer,
+				  st_compiler_error *error);
+
 st_oop  st_generate_method  (st_oop    class,
 			     st_node   *node,
 			     st_compiler_error *error);
@@ -62,7 +73,7 @@ typedef enum
 
     PUSH_ACTIVE_CONTEXT,
 
-    BLOCK_COPY,
+    BLOCK_COPY,  /* B, B (arg count), B (stack size), B (copied values) */
 
     JUMP_TRUE,
     JUMP_FALSE,
@@ -97,6 +108,25 @@ typedef enum
     SEND_NEW,
     SEND_NEW_ARG,
 
+    /* comparisons fused with the JUMP_TRUE or JUMP_FALSE which follows */
+    BRANCH_LT,
+    BRANCH_GT,
+    BRANCH_LE,
+    BRANCH_GE,
+
+    /* pushes a block created at compile time from the literal frame */
+    PUSH_CLEAN_BLOCK,
+
+    /* temp vectors, holding the variables shared with closures */
+    PUSH_NEW_ARRAY,
+    PUSH_REMOTE_TEMP,      /* B, B (index), B (temp holding the vector) */
+    STORE_REMOTE_TEMP,
+    STORE_POP_REMOTE_TEMP,
+
 } Code;
 
+/* set in the argument count of BLOCK_COPY for a block containing a ^,
+   whose closure must refer to its home context */
+#define ST_BLOCK_NEEDS_HOME 0x80
+
 #endif /* __ST_COMPILER_H__ */
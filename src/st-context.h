@@ -47,19 +47,39 @@ struct st_method_context
     st_oop stack[];
 };
 
+/* the activation of a block closure. Its method and receiver are laid
+ * out as in a method context */
 struct st_block_context
 {
     struct st_context_part __parent__;
+    st_oop method;
+    st_oop receiver;
+    st_oop closure;
+
+    st_oop stack[];
+};
+
+/*
+ * A block closure is followed by the values it copied from the scopes
+ * enclosing it when it was created. Its outer context is the home method
+ * context of a block which contains a ^, and nil otherwise.
+ */
+struct st_block_closure
+{
+    struct st_header __parent__;
+    st_oop outer_context;
+    st_oop method;
+    st_oop receiver;
     st_oop initial_ip;
     st_oop argcount;
-    st_oop home;
 
-    st_oop stack[];
+    st_oop copied[];
 };
 
 #define ST_CONTEXT_PART(oop)       ((struct st_context_part *)   st_detag_pointer (oop))
 #define ST_METHOD_CONTEXT(oop)     ((struct st_method_context *) st_detag_pointer (oop))
 #define ST_BLOCK_CONTEXT(oop)      ((struct st_block_context *)  st_detag_pointer (oop))
+#define ST_BLOCK_CLOSURE(oop)      ((struct st_block_closure *)  st_detag_pointer (oop))
 
 
 #define ST_CONTEXT_PART_SENDER(oop)  (ST_CONTEXT_PART (oop)->sender)
@@ -70,9 +90,78 @@ struct st_block_context
 #define ST_METHOD_CONTEXT_RECEIVER(oop) (ST_METHOD_CONTEXT (oop)->receiver)
 #define ST_METHOD_CONTEXT_STACK(oop)    (ST_METHOD_CONTEXT (oop)->stack)
 
-#define ST_BLOCK_CONTEXT_INITIALIP(oop) (ST_BLOCK_CONTEXT (oop)->initial_ip)
-#define ST_BLOCK_CONTEXT_ARGCOUNT(oop)  (ST_BLOCK_CONTEXT (oop)->argcount)
-#define ST_BLOCK_CONTEXT_HOME(oop)      (ST_BLOCK_CONTEXT (oop)->home)
+#define ST_BLOCK_CONTEXT_METHOD(oop)    (ST_BLOCK_CONTEXT (oop)->method)
+#define ST_BLOCK_CONTEXT_RECEIVER(oop)  (ST_BLOCK_CONTEXT (oop)->receiver)
+#define ST_BLOCK_CONTEXT_CLOSURE(oop)   (ST_BLOCK_CONTEXT (oop)->closure)
 #define ST_BLOCK_CONTEXT_STACK(oop)     (ST_BLOCK_CONTEXT (oop)->stack)
 
+#define ST_BLOCK_CLOSURE_OUTER_CONTEXT(oop) (ST_BLOCK_CLOSURE (oop)->outer_context)
+#define ST_BLOCK_CLOSURE_METHOD(oop)        (ST_BLOCK_CLOSURE (oop)->method)
+#define ST_BLOCK_CLOSURE_RECEIVER(oop)      (ST_BLOCK_CLOSURE (oop)->receiver)
+#define ST_BLOCK_CLOSURE_INITIALIP(oop)     (ST_BLOCK_CLOSURE (oop)->initial_ip)
+#define ST_BLOCK_CLOSURE_ARGCOUNT(oop)      (ST_BLOCK_CLOSURE (oop)->argcount)
+#define ST_BLOCK_CLOSURE_COPIED(oop)        (ST_BLOCK_CLOSURE (oop)->copied)
+
+/* largest number of stack slots a context can have */
+#define ST_CONTEXT_MAX_STACK_SIZE  _ST_OBJECT_STACK_MASK
+
+/* the stack size of a context, or of the activations of a closure */
+static inline st_uint
+st_context_stack_size (st_oop context)
+{
+    return _ST_OBJECT_GET_BITFIELD (ST_OBJECT_MARK (context), STACK);
+}
+
+static inline void
+st_context_set_stack_size (st_oop context, st_uint size)
+{
+    _ST_OBJECT_SET_BITFIELD (ST_OBJECT_MARK (context), STACK, size);
+}
+
+/* A captured context is referred to by a closure or through thisContext.
+ * It is not recycled when it returns, but marked as dead instead. */
+static inline bool
+st_context_is_captured (st_oop context)
+{
+    return _ST_OBJECT_GET_BITFIELD (ST_OBJECT_MARK (context), CAPTURED);
+}
+
+static inline void
+st_context_set_captured (st_oop context)
+{
+    _ST_OBJECT_SET_BITFIELD (ST_OBJECT_MARK (context), CAPTURED, 1);
+}
+
+/* An unwind context runs an unwind block when it is left by a ^ from
+ * a block, see BlockClosure>>ensure:. It is always captured too. */
+static inline bool
+st_context_is_unwind (st_oop context)
+{
+    return _ST_OBJECT_GET_BITFIELD (ST_OBJECT_MARK (context), UNWIND);
+}
+
+static inline void
+st_context_set_unwind (st_oop context, bool unwind)
+{
+    _ST_OBJECT_SET_BITFIELD (ST_OBJECT_MARK (context), UNWIND, unwind);
+}
+
+/* the first unwind context from `context' up to, but excluding, `limit' */
+static inline st_oop
+st_context_find_unwind (st_oop context, st_oop limit)
+{
+    for (; context != limit && context != ST_NIL; context = ST_CONTEXT_PART_SENDER (context)) {
+	if (st_context_is_unwind (context))
+	    return context;
+    }
+    return ST_NIL;
+}
+
+static inline st_uint
+st_block_closure_copied_count (st_oop closure)
+{
+    return st_object_instance_size (closure)
+	- (ST_SIZE_OOPS (struct st_block_closure) - ST_SIZE_OOPS (struct st_header));
+}
+
 #endif /* __ST_CONTEXT_H__ */
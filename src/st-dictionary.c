@@ -222,8 +222,10 @@ set_find (st_oop set, st_oop object)
     }
 }
 
+/* `find' locates the slot for an element, and must agree with the
+ * hash the set was populated with */
 static void
-set_check_grow (st_oop set)
+set_check_grow (st_oop set, st_uint (*find) (st_oop set, st_oop object))
 {
     st_oop  old, object;
     st_uint size, n;
@@ -241,7 +243,7 @@ set_check_grow (st_oop set)
     for (st_uint i = 1; i <= n; i++) {
 	object = st_array_at (old, i);
 	if (object != ST_NIL)
-	    st_array_at_put (ARRAY (set), set_find (set, object), object);
+	    st_array_at_put (ARRAY (set), find (set, object), object);
     }
 }
 
@@ -263,17 +265,53 @@ st_set_intern_cstring (st_oop set, const char *string)
     memcpy (st_byte_array_bytes (intern), string, len);
     st_array_at_put (ARRAY (set), i, intern);
     SIZE (set) = st_smi_increment (SIZE (set));
-    set_check_grow (set);
+    set_check_grow (set, set_find);
 
     return intern;
 }
 
+static st_uint
+set_find_literal (st_oop set, st_oop literal)
+{
+    st_oop el;
+    st_uint mask, i;
+
+    mask = ARRAY_SIZE (ARRAY (set)) - 1;
+    i = (st_object_literal_hash (literal) & mask) + 1;
+
+    while (true) {
+	el = st_array_at (ARRAY (set), i);
+	if (el == ST_NIL || st_object_literal_equal (el, literal))
+	    return i;
+	i = ((i + ST_ADVANCE_SIZE) & mask) + 1;
+    }
+}
+
+/* answers the literal in `set' equal to `literal', adding `literal' if there is none */
+st_oop
+st_set_intern_literal (st_oop set, st_oop literal)
+{
+    st_oop  intern;
+    st_uint i;
+
+    i = set_find_literal (set, literal);
+    intern = st_array_at (ARRAY (set), i);
+    if (intern != ST_NIL)
+	return intern;
+
+    st_array_at_put (ARRAY (set), i, literal);
+    SIZE (set) = st_smi_increment (SIZE (set));
+    set_check_grow (set, set_find_literal);
+
+    return literal;
+}
+
 void
 st_set_add (st_oop set, st_oop object)
 {
     st_array_at_put (ARRAY (set), set_find (set, object), object);
     SIZE (set) = st_smi_increment (SIZE (set));
-    set_check_grow (set);
+    set_check_grow (set, set_find);
 }
 
 bool
@@ -39,6 +39,7 @@ st_oop  st_dictionary_association_at (st_oop dict, st_oop key);
 
 st_oop  st_set_new               (void);
 st_oop  st_set_intern_cstring    (st_oop set, const char *string);
+st_oop  st_set_intern_literal    (st_oop set, st_oop literal);
 st_oop  st_set_new_with_capacity (int capacity);
 bool    st_set_includes          (st_oop set, st_oop object);
 st_oop  st_set_like              (st_oop set, st_oop object);
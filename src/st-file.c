@@ -0,0 +1,274 @@
+/*
+ * st-file.c
+ *
+ * Copyright (c) 2008 Vincent Geddes
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+*/
+
+
+#include "st-file.h"
+#include "st-utils.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+
+st_file *
+st_file_new (int fd)
+{
+    st_file *file;
+
+    file = st_new0 (st_file);
+    file->fd = fd;
+
+    return file;
+}
+
+st_file *
+st_file_open (const char *path, int mode)
+{
+    int flags, fd;
+
+    switch (mode) {
+    case ST_FILE_READ:
+	flags = O_RDONLY;
+	break;
+    case ST_FILE_WRITE:
+	flags = O_WRONLY | O_CREAT | O_TRUNC;
+	break;
+    case ST_FILE_APPEND:
+	flags = O_WRONLY | O_CREAT | O_APPEND;
+	break;
+    default:
+	return NULL;
+    }
+
+    fd = open (path, flags, 0644);
+    if (fd < 0)
+	return NULL;
+
+    /* set afterwards, a FIFO would otherwise fail to open for writing
+     * until it has a reader */
+    fcntl (fd, F_SETFL, fcntl (fd, F_GETFL) | O_NONBLOCK);
+
+    return st_file_new (fd);
+}
+
+/* Reads once into the input buffer, first moving what is left of it
+ * to the front, or doubling it if it's full. Answers the number of
+ * bytes read, 0 at end of file and -1 on error, with errno set to
+ * EAGAIN if nothing could be read without blocking.
+ */
+int
+st_file_fill (st_file *file)
+{
+    ssize_t count;
+
+    if (file->in == NULL) {
+	file->in_size = ST_FILE_BUFFER_SIZE;
+	file->in = st_malloc (file->in_size);
+    } else if (file->start > 0) {
+	memmove (file->in, file->in + file->start, file->end - file->start);
+	file->end -= file->start;
+	file->start = 0;
+    } else if (file->end == file->in_size) {
+	file->in_size *= 2;
+	file->in = st_realloc (file->in, file->in_size);
+    }
+
+    do {
+	count = read (file->fd, file->in + file->end, file->in_size - file->end);
+    } while (count < 0 && errno == EINTR);
+
+    if (count > 0)
+	file->end += count;
+
+    return count;
+}
+
+/* answers the number of bytes written before the descriptor would
+ * block, or -1 on error */
+static ssize_t
+write_some (int fd, const st_uchar *bytes, st_uint count)
+{
+    ssize_t written, total = 0;
+
+    while ((st_uint) total < count) {
+	written = write (fd, bytes + total, count - total);
+	if (written < 0) {
+	    if (errno == EINTR)
+		continue;
+	    if (errno == EAGAIN || errno == EWOULDBLOCK)
+		break;
+	    return -1;
+	}
+	total += written;
+    }
+
+    return total;
+}
+
+/* Writes out as much of the buffer as the descriptor takes without
+ * blocking, keeping the rest. Returns false on error, dropping the
+ * buffer.
+ */
+bool
+st_file_flush (st_file *file)
+{
+    ssize_t written;
+
+    if (file->out_count == 0)
+	return true;
+
+    written = write_some (file->fd, file->out, file->out_count);
+    if (written < 0) {
+	file->out_count = 0;
+	return false;
+    }
+
+    memmove (file->out, file->out + written, file->out_count - written);
+    file->out_count -= written;
+
+    return true;
+}
+
+/* appends to the output buffer, growing it if need be */
+static void
+buffer (st_file *file, const st_uchar *bytes, st_uint count)
+{
+    if (file->out == NULL) {
+	file->out_size = ST_FILE_BUFFER_SIZE;
+	file->out = st_malloc (file->out_size);
+    }
+
+    if (file->out_count + count > file->out_size) {
+	while (file->out_count + count > file->out_size)
+	    file->out_size *= 2;
+	file->out = st_realloc (file->out, file->out_size);
+    }
+
+    memcpy (file->out + file->out_count, bytes, count);
+    file->out_count += count;
+}
+
+/* Writes which wouldn't fit in the output buffer go straight out, what
+ * the descriptor doesn't take is kept in the buffer, which grows to
+ * hold it.
+ */
+bool
+st_file_write (st_file *file, const st_uchar *bytes, st_uint count)
+{
+    ssize_t written;
+
+    if (file->out == NULL) {
+	file->out_size = ST_FILE_BUFFER_SIZE;
+	file->out = st_malloc (file->out_size);
+    }
+
+    if (file->out_count + count > file->out_size) {
+	if (!st_file_flush (file))
+	    return false;
+
+	if (file->out_count == 0 && count > file->out_size) {
+	    written = write_some (file->fd, bytes, count);
+	    if (written < 0)
+		return false;
+	    bytes += written;
+	    count -= written;
+	}
+    }
+
+    buffer (file, bytes, count);
+    return true;
+}
+
+/* Writes the buffer and `count' more pieces with one writev(2), keeping
+ * what the descriptor doesn't take in the buffer.
+ */
+bool
+st_file_writev (st_file *file, const struct iovec *pieces, int count)
+{
+    struct iovec iov[ST_FILE_MAX_PIECES + 1];
+    ssize_t written;
+    int     first = 0, n = 0, i = 0;
+
+    if (count > ST_FILE_MAX_PIECES)
+	return false;
+
+    if (file->out_count > 0) {
+	iov[n].iov_base = file->out;
+	iov[n].iov_len = file->out_count;
+	first = ++n;
+    }
+    memcpy (iov + n, pieces, count * sizeof (struct iovec));
+    n += count;
+
+    while (i < n) {
+	written = writev (file->fd, iov + i, n - i);
+	if (written < 0) {
+	    if (errno == EINTR)
+		continue;
+	    if (errno == EAGAIN || errno == EWOULDBLOCK)
+		break;
+	    file->out_count = 0;
+	    return false;
+	}
+	for (; i < n && (size_t) written >= iov[i].iov_len; i++)
+	    written -= iov[i].iov_len;
+	if (i < n) {
+	    iov[i].iov_base = (st_uchar *) iov[i].iov_base + written;
+	    iov[i].iov_len -= written;
+	}
+    }
+
+    /* what is left of the buffer moves to the front, then the rest of
+     * the pieces are copied after it */
+    if (first > 0) {
+	file->out_count = (i == 0) ? iov[0].iov_len : 0;
+	memmove (file->out, iov[0].iov_base, file->out_count);
+    }
+    for (i = MAX (i, first); i < n; i++)
+	buffer (file, iov[i].iov_base, iov[i].iov_len);
+
+    return true;
+}
+
+bool
+st_file_close (st_file *file)
+{
+    bool flushed;
+    int  closed;
+
+    flushed = st_file_flush (file);
+
+    /* there is no one left to wait for the rest of the buffer */
+    if (flushed && file->out_count > 0) {
+	fcntl (file->fd, F_SETFL, fcntl (file->fd, F_GETFL) & ~O_NONBLOCK);
+	flushed = st_file_flush (file);
+    }
+    closed = close (file->fd);
+
+    st_free (file->in);
+    st_free (file->out);
+    st_free (file);
+
+    return flushed && closed == 0;
+}
@@ -0,0 +1,99 @@
+/*
+ * st-file.h
+ *
+ * Copyright (c) 2008 Vincent Geddes
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+*/
+
+
+#ifndef __ST_FILE_H__
+#define __ST_FILE_H__
+
+#include <st-types.h>
+#include <sys/uio.h>
+
+/*
+ * The buffers of a FileStream. Reads fill the input buffer a block at a
+ * time and the primitives answer bytes, lines and the like from it;
+ * writes are gathered in the output buffer until it is full, flushed
+ * or the file is closed.
+ *
+ * The input buffer holds the bytes from `start' to `end'. It is only
+ * filled when asked to and it grows when a line or a count of bytes
+ * doesn't fit.
+ *
+ * Files are opened non-blocking, so that pipes, FIFOs and devices never
+ * hold up the machine. A fill which would block reads nothing, and a
+ * flush writes what it can and keeps the rest, leaving the caller to
+ * wait for the descriptor with the other processes running meanwhile.
+ */
+
+#define ST_FILE_BUFFER_SIZE 65536
+
+/* the most pieces written at once by st_file_writev, well below the
+ * IOV_MAX of the systems we run on */
+#define ST_FILE_MAX_PIECES  256
+
+enum
+{
+    ST_FILE_READ,
+    ST_FILE_WRITE,
+    ST_FILE_APPEND,
+};
+
+typedef struct st_file
+{
+    int       fd;
+
+    st_uchar *in;
+    st_uint   in_size;
+    st_uint   start;
+    st_uint   end;
+
+    st_uchar *out;
+    st_uint   out_size;
+    st_uint   out_count;
+} st_file;
+
+st_file  *st_file_open      (const char *path, int mode);
+st_file  *st_file_new       (int fd);
+
+int       st_file_fill      (st_file *file);
+
+bool      st_file_write     (st_file *file, const st_uchar *bytes, st_uint count);
+bool      st_file_writev    (st_file *file, const struct iovec *pieces, int count);
+bool      st_file_flush     (st_file *file);
+
+bool      st_file_close     (st_file *file);
+
+static inline st_uint
+st_file_available (st_file *file)
+{
+    return file->end - file->start;
+}
+
+/* the number of written bytes which are still in the buffer */
+static inline st_uint
+st_file_pending (st_file *file)
+{
+    return file->out_count;
+}
+
+#endif /* __ST_FILE_H__ */
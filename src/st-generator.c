@@ -34,9 +34,14 @@
 #include "st-universe.h"
 #include "st-behavior.h"
 #include "st-character.h"
+#include "st-float.h"
+#include "st-context.h"
+#include "st-memory.h"
 #include "st-unicode.h"
 
+#include <ptr_array.h>
 #include <string.h>
+#include <math.h>
 #include <stdlib.h>
 #include <setjmp.h>
 
@@ -44,6 +49,8 @@
 
 #define CSTRING(string) ((char *) st_byte_array_bytes (string))
 
+typedef struct Scope Scope;
+
 typedef struct 
 {
     st_oop   class;
@@ -51,13 +58,29 @@ typedef struct
     jmp_buf  jmploc;
 
     st_compiler_error *error;
+
+    /* scratch memory, released at the end of st_generate_method() */
+    st_arena  *arena;
  
-    /* names of temporaries, in order of appearance */
-    st_list   *temporaries;
     /* names of instvars, in order they were defined */
-    st_list   *instvars;
+    ptr_array  instvars;
     /* literal frame for the compiled code */
-    st_list   *literals;
+    ptr_array  literals;
+
+    /* every scope of the method, the method's own first */
+    ptr_array  scopes;
+    /* the method or block being generated */
+    Scope     *scope;
+
+    /* variables in scope while names are resolved, innermost last */
+    ptr_array  names;
+    /* number of names declared at method level (args included) */
+    st_uint    method_temporaries;
+    /* references to variables of outer scopes, as pairs of the
+       referring scope and the variable */
+    ptr_array  captures;
+    /* orders the reads and writes seen while resolving names */
+    int        position;
     
 } Generator;
 
@@ -69,77 +92,69 @@ typedef struct
     st_uint    max_stack_depth;
 } st_bytecode;
 
-static st_uint sizes[255] = {  0, };
-
-
-// setup global data for compiler
-static void
-check_init (void)
-{
-    static bool initialized = false;
-
-    if (initialized)
-	return;
-    initialized = true;
-
-    /* The size (in bytes) of each bytecode instruction
-     */
-    sizes[PUSH_TEMP]             = 2;
-    sizes[PUSH_INSTVAR]          = 2;
-    sizes[PUSH_LITERAL_CONST]    = 2;
-    sizes[PUSH_LITERAL_VAR]      = 2;
-    sizes[PUSH_SELF]             = 1;
-    sizes[PUSH_NIL]              = 1;
-    sizes[PUSH_TRUE]             = 1;
-    sizes[PUSH_FALSE]            = 1;
-    sizes[PUSH_INTEGER]          = 2;
-    sizes[STORE_LITERAL_VAR]     = 2;
-    sizes[STORE_TEMP]            = 2;
-    sizes[STORE_INSTVAR]         = 2; 
-    sizes[STORE_POP_LITERAL_VAR] = 2;
-    sizes[STORE_POP_TEMP]        = 2;
-    sizes[STORE_POP_INSTVAR]     = 2;
-    sizes[RETURN_STACK_TOP]      = 1;
-    sizes[BLOCK_RETURN]          = 1;
-    sizes[POP_STACK_TOP]         = 1;
-    sizes[DUPLICATE_STACK_TOP]   = 1;
-    sizes[PUSH_ACTIVE_CONTEXT]   = 1;
-    sizes[BLOCK_COPY]       = 2;
-    sizes[JUMP_TRUE]        = 3;
-    sizes[JUMP_FALSE]       = 3;
-    sizes[JUMP]             = 3;
-    sizes[SEND]             = 3;    
-    sizes[SEND_SUPER]       = 3;
-    sizes[SEND_PLUS]        = 1;
-    sizes[SEND_MINUS]       = 1;
-    sizes[SEND_LT]          = 1;
-    sizes[SEND_GT]          = 1;
-    sizes[SEND_LE]          = 1;
-    sizes[SEND_GE]          = 1;
-    sizes[SEND_EQ]          = 1;
-    sizes[SEND_NE]          = 1;
-    sizes[SEND_MUL]         = 1;
-    sizes[SEND_DIV]         = 1;
-    sizes[SEND_MOD]         = 1;
-    sizes[SEND_BITSHIFT]    = 1;
-    sizes[SEND_BITAND]      = 1;
-    sizes[SEND_BITOR]       = 1;
-    sizes[SEND_BITXOR]      = 1;
-    sizes[SEND_AT]          = 1; 
-    sizes[SEND_AT_PUT]      = 1;
-    sizes[SEND_SIZE]        = 1;
-    sizes[SEND_VALUE]       = 1;
-    sizes[SEND_VALUE_ARG]   = 1;
-    sizes[SEND_IDENTITY_EQ] = 1;
-    sizes[SEND_CLASS]       = 1;
-    sizes[SEND_NEW]         = 1;
-    sizes[SEND_NEW_ARG]     = 1;
-}
-
-static int size_message    (Generator *gt, st_node *node);
-static int size_expression (Generator *gt, st_node *node);
-static int size_statements (Generator *gt, st_node *node);
-
+/* The size (in bytes) of each bytecode instruction
+ */
+static const st_uint sizes[255] = {
+    [PUSH_TEMP]             = 2,
+    [PUSH_INSTVAR]          = 2,
+    [PUSH_LITERAL_CONST]    = 2,
+    [PUSH_LITERAL_VAR]      = 2,
+    [PUSH_SELF]             = 1,
+    [PUSH_NIL]              = 1,
+    [PUSH_TRUE]             = 1,
+    [PUSH_FALSE]            = 1,
+    [PUSH_INTEGER]          = 2,
+    [STORE_LITERAL_VAR]     = 2,
+    [STORE_TEMP]            = 2,
+    [STORE_INSTVAR]         = 2,
+    [STORE_POP_LITERAL_VAR] = 2,
+    [STORE_POP_TEMP]        = 2,
+    [STORE_POP_INSTVAR]     = 2,
+    [RETURN_STACK_TOP]      = 1,
+    [BLOCK_RETURN]          = 1,
+    [POP_STACK_TOP]         = 1,
+    [DUPLICATE_STACK_TOP]   = 1,
+    [PUSH_ACTIVE_CONTEXT]   = 1,
+    [BLOCK_COPY]            = 4,
+    [JUMP_TRUE]             = 3,
+    [JUMP_FALSE]            = 3,
+    [JUMP]                  = 3,
+    [SEND]                  = 3,
+    [SEND_SUPER]            = 3,
+    [SEND_PLUS]             = 1,
+    [SEND_MINUS]            = 1,
+    [SEND_LT]               = 1,
+    [SEND_GT]               = 1,
+    [SEND_LE]               = 1,
+    [SEND_GE]               = 1,
+    [SEND_EQ]               = 1,
+    [SEND_NE]               = 1,
+    [SEND_MUL]              = 1,
+    [SEND_DIV]              = 1,
+    [SEND_MOD]              = 1,
+    [SEND_BITSHIFT]         = 1,
+    [SEND_BITAND]           = 1,
+    [SEND_BITOR]            = 1,
+    [SEND_BITXOR]           = 1,
+    [SEND_AT]               = 1,
+    [SEND_AT_PUT]           = 1,
+    [SEND_SIZE]             = 1,
+    [SEND_VALUE]            = 1,
+    [SEND_VALUE_ARG]        = 1,
+    [SEND_IDENTITY_EQ]      = 1,
+    [SEND_CLASS]            = 1,
+    [SEND_NEW]              = 1,
+    [SEND_NEW_ARG]          = 1,
+    [BRANCH_LT]             = 1,
+    [BRANCH_GT]             = 1,
+    [BRANCH_LE]             = 1,
+    [BRANCH_GE]             = 1,
+    [PUSH_CLEAN_BLOCK]      = 2,
+    [PUSH_NEW_ARRAY]        = 2,
+    [PUSH_REMOTE_TEMP]      = 3,
+    [STORE_REMOTE_TEMP]     = 3,
+    [STORE_POP_REMOTE_TEMP] = 3,
+};
 
 static void generate_expression (Generator *gt, st_bytecode *code, st_node *node);
 static void generate_statements (Generator *gt, st_bytecode *code, st_node *statements);
@@ -172,31 +187,34 @@ bytecode_destroy (st_bytecode *code)
 }
 
 
-static st_list *
-get_temporaries (Generator *gt,
-		 st_list  *instvars,
-		 st_node *arguments,
-		 st_node *temporaries)
+static int
+find_name (ptr_array names, st_uint count, const char *name)
 {
-    st_list *temps = NULL; 
-        
-    for (st_node *n = arguments; n; n = n->next) {
-	for (st_list *l = instvars; l; l = l->next) {
-	    if (streq (n->variable.name, (char *) l->data))
-		generation_error (gt, "name is already defined", arguments);
-	}	
-	temps = st_list_prepend (temps, (st_pointer) n->variable.name);
+    for (st_uint i = 0; i < count; i++) {
+	if (streq (name, (char *) ptr_array_get_index (names, i)))
+	    return i;
     }
+    return -1;
+}
 
-    for (st_node *n = temporaries; n; n = n->next) {	
-	for (st_list *l = instvars; l; l = l->next) {
-	    if (streq (n->variable.name, (char *) l->data))
-		generation_error (gt, "name is already defined", temporaries);
-	}
-	temps = st_list_prepend (temps, (st_pointer) n->variable.name);
-    }
+static void
+get_instvars (Generator *gt, st_oop class)
+{
+    st_oop names;
+    st_uint size;
+
+    if (class == ST_NIL)
+	return;
+
+    get_instvars (gt, ST_BEHAVIOR_SUPERCLASS (class));
+
+    names = ST_BEHAVIOR_INSTANCE_VARIABLES (class);
+    if (names == ST_NIL)
+	return;
 
-    return st_list_reverse (temps);
+    size = st_smi_value (st_arrayed_object_size (names));
+    for (st_uint i = 1; i <= size; i++)
+	ptr_array_append (gt->instvars, st_arena_strdup (gt->arena, CSTRING (st_array_at (names, i))));
 }
 
 static Generator *
@@ -207,20 +225,30 @@ generator_new (void)
     gt = st_new0 (Generator);
 
     gt->class       = 0;
-    gt->instvars    = NULL;
-    gt->literals    = NULL;
-    gt->temporaries = NULL;
+    gt->arena       = st_arena_new ();
+    gt->instvars    = ptr_array_new (20);
+    gt->literals    = ptr_array_new (20);
+    gt->scopes      = ptr_array_new (8);
+    gt->names       = ptr_array_new (20);
+    gt->captures    = ptr_array_new (20);
    
     return gt;
 }
 
+static void scope_destroy (Scope *scope);
+
 static void
 generator_destroy (Generator *gt)
 {
-    st_list_foreach (gt->instvars, st_free);
-    st_list_destroy (gt->instvars);
-    st_list_destroy (gt->temporaries);
-    st_list_destroy (gt->literals);
+    for (st_uint i = 0; i < ptr_array_length (gt->scopes); i++)
+	scope_destroy (ptr_array_get_index (gt->scopes, i));
+
+    ptr_array_free (gt->instvars);
+    ptr_array_free (gt->literals);
+    ptr_array_free (gt->scopes);
+    ptr_array_free (gt->names);
+    ptr_array_free (gt->captures);
+    st_arena_destroy (gt->arena);
 
     st_free (gt);
 }
@@ -229,16 +257,12 @@ static st_oop
 create_literals_array (Generator *gt)
 {
     st_oop  literals;
-    st_uint i;
 
-    gt->literals = st_list_append (gt->literals, (st_pointer) gt->class);
-    literals = st_object_new_arrayed (ST_ARRAY_CLASS, st_list_length (gt->literals)); 
+    ptr_array_append (gt->literals, (st_pointer) gt->class);
+    literals = st_object_new_arrayed (ST_ARRAY_CLASS, ptr_array_length (gt->literals)); 
     
-    i = 1;
-    for (st_list *l = gt->literals; l; l = l->next) {
-	st_array_at_put (literals, i, (st_oop) l->data);
-	i++;
-    }
+    for (st_uint i = 0; i < ptr_array_length (gt->literals); i++)
+	st_array_at_put (literals, i + 1, (st_oop) ptr_array_get_index (gt->literals, i));
        
     return literals;
 }
@@ -271,73 +295,122 @@ emit (st_bytecode *code, st_uchar value)
 static int
 find_instvar (Generator *gt, char *name)
 {   
-    int i = 0;
-    for (st_list *l = gt->instvars; l; l = l->next) {
+    return find_name (gt->instvars, ptr_array_length (gt->instvars), name);
+}
 
-	if (streq (name, (char *) l->data))
-	    return i;
-	i++;
+/* Answers the copy of `literal' shared by all methods in the image.
+ * Only Floats are shared, as they are never modified. Arrays and
+ * ByteArrays may be changed in place, so each method keeps its own,
+ * though Floats in an Array are shared. */
+static st_oop
+intern_literal (st_oop literal)
+{
+    st_oop class;
+
+    class = st_object_class (literal);
+
+    if (class == ST_ARRAY_CLASS) {
+	for (int i = 1; i <= st_smi_value (st_arrayed_object_size (literal)); i++)
+	    st_array_at_put (literal, i, intern_literal (st_array_at (literal, i)));
+	return literal;
     }
-    return -1;
+
+    if (class != ST_FLOAT_CLASS)
+	return literal;
+
+    return st_set_intern_literal (ST_LITERALS, literal);
 }
 
-static int
-find_temporary (Generator *gt, char *name)
-{   
-    int i = 0;
-    
-    for (st_list *l = gt->temporaries; l; l = l->next) {
+/* a Symbol is equal to a String with the same characters, but
+ * one can't stand in for the other as a literal */
+static bool
+literal_equal (st_oop literal, st_oop other)
+{
+    if (st_object_class (literal) != st_object_class (other))
+	return false;
 
-	if (streq (name, (char *) l->data))
-	    return i;
-	i++;
-    }
-    return -1;
+    return st_object_equal (literal, other);
 }
 
 static int
 find_literal_const (Generator *gt, st_oop literal)
 {   
-    int i = 0;
-    for (st_list *l = gt->literals; l; l = l->next) {
+    st_uint i;
 
-	if (st_object_equal (literal, (st_oop) l->data))
+    literal = intern_literal (literal);
+
+    for (i = 0; i < ptr_array_length (gt->literals); i++) {
+	if (literal_equal (literal, (st_oop) ptr_array_get_index (gt->literals, i)))
 	    return i;
-	i++;
     }
-    gt->literals = st_list_append (gt->literals, (void *) literal);
+    ptr_array_append (gt->literals, (st_pointer) literal);
     return i;
 }
 
 static int
 find_literal_var (Generator *gt, char *name)
 {
-    st_oop assoc;
-
-    assoc = st_dictionary_association_at (ST_GLOBALS, st_symbol_new (name));
-    if (assoc == ST_NIL)
-	return -1;
+    st_oop assoc, symbol, workspace;
+
+    symbol = st_symbol_new (name);
+    assoc = st_dictionary_association_at (ST_GLOBALS, symbol);
+    if (assoc == ST_NIL) {
+	/* the variables of an interactive session, see main.c */
+	workspace = st_global_get ("Workspace");
+	if (st_object_is_heap (workspace) && st_object_class (workspace) == ST_DICTIONARY_CLASS)
+	    assoc = st_dictionary_association_at (workspace, symbol);
+	if (assoc == ST_NIL)
+	    return -1;
+    }
 
-    int i = 0;
-    for (st_list *l = gt->literals; l; l = l->next) {
-	if (st_object_equal (assoc, (st_oop) l->data))
+    st_uint i;
+    for (i = 0; i < ptr_array_length (gt->literals); i++) {
+	if (st_object_equal (assoc, (st_oop) ptr_array_get_index (gt->literals, i)))
 	    return i;
-	i++;
     }
-    gt->literals = st_list_append (gt->literals, (st_pointer) assoc);
+    ptr_array_append (gt->literals, (st_pointer) assoc);
     return i;
 }
 
+/*
+ * Jumps are emitted in a single pass. A forward jump is emitted with
+ * a zero offset and returns a label, which is patched with
+ * patch_jump() once its target has been generated. Offsets are relative
+ * to the end of the jump instruction.
+ */
+static st_uint
+jump_forward (st_bytecode *code, st_uchar jump)
+{
+    emit (code, jump);
+    emit (code, 0);
+    emit (code, 0);
+
+    return code->size;
+}
+
 static void
-jump_offset (Generator *gt, st_bytecode *code, int offset)
+patch_jump (st_bytecode *code, st_uint label)
 {
+    int offset;
+
+    offset = code->size - label;
     st_assert (offset <= INT16_MAX);
-    
-    emit (code, JUMP);
 
-    /* push low byte */
+    /* low byte, then high byte */
+    code->buffer[label - 2] = offset & 0xFF;
+    code->buffer[label - 1] = (offset >> 8) & 0xFF;
+}
+
+static void
+jump_back (st_bytecode *code, st_uchar jump, st_uint target)
+{
+    int offset;
+
+    offset = (int) target - (int) (code->size + 3);
+    st_assert (offset >= INT16_MIN);
+
+    emit (code, jump);
     emit (code, offset & 0xFF);
-    /* push high byte */
     emit (code, (offset >> 8) & 0xFF);
 }
 
@@ -395,6 +468,171 @@ push_special (Generator *gt, st_bytecode *code, st_uchar value)
     code->max_stack_depth++;
 }
 
+/*
+ * Scopes
+ *
+ * Blocks are closures. Each activation of a block has a frame of its
+ * own, holding the block's arguments, the values it copied from
+ * enclosing scopes when its closure was created, and its temporaries.
+ * Blocks inlined by the optimisers below are not scopes of their own,
+ * their names are held by the enclosing method or block.
+ *
+ * A variable captured by a closure is copied into it, unless it may be
+ * written after the closure was created. Such a variable is remote: it
+ * is kept in a temp vector, an Array created when its scope is entered,
+ * and the closure copies the vector instead.
+ *
+ * Before any code is generated, names are resolved to the variables
+ * they refer to and every variable is given its place. A closure only
+ * refers to its home context when the block contains a ^.
+ */
+
+typedef struct
+{
+    char    *name;
+    /* the method or block which holds the variable */
+    Scope   *scope;
+    /* frame slot, unless the variable is remote (arguments have both) */
+    int      slot;
+    /* index into the temp vector of `scope', for remote variables */
+    int      index;
+    bool     argument;
+    bool     remote;
+    /* declared by the body of an inlined loop, a new variable on
+       each iteration as far as closures can tell */
+    bool     iteration;
+    /* positions of the first capture of the variable, and of the last
+       write to it by its own scope, or -1 */
+    int      captured;
+    int      written;
+} Variable;
+
+struct Scope
+{
+    Scope     *outer;
+    /* variables held by the scope, its arguments first */
+    ptr_array  variables;
+    st_uint    argcount;
+    /* variables of outer scopes copied into the closure, which
+       follow the arguments in the frame */
+    ptr_array  copied;
+    /* holds the temp vector, if any variable is remote */
+    Variable  *vector;
+    st_uint    remote_count;
+    /* frame slots, not counting hidden temporaries */
+    st_uint    frame_size;
+    st_uint    hidden_count;
+    st_uint    hidden_in_use;
+    /* refers to self, super or an instance variable */
+    bool       uses_self;
+    /* contains a ^, itself or in a nested block */
+    bool       uses_home;
+    bool       uses_context;
+};
+
+static Scope *
+scope_new (Generator *gt, Scope *outer)
+{
+    Scope *scope;
+
+    scope = st_arena_new0 (gt->arena, Scope);
+    scope->outer     = outer;
+    scope->variables = ptr_array_new (8);
+    scope->copied    = ptr_array_new (4);
+    ptr_array_append (gt->scopes, scope);
+
+    return scope;
+}
+
+static void
+scope_destroy (Scope *scope)
+{
+    ptr_array_free (scope->variables);
+    ptr_array_free (scope->copied);
+}
+
+/* a clean block needs nothing from the context creating it, so its
+ * closure is created once, at compile time */
+static bool
+is_clean (Scope *scope)
+{
+    return !scope->uses_self && !scope->uses_home && !scope->uses_context
+	&& ptr_array_length (scope->copied) == 0;
+}
+
+/* the slot through which the frame of `scope' holds `var' */
+static int
+frame_slot (Scope *scope, Variable *var)
+{
+    if (var->scope == scope)
+	return var->slot;
+
+    for (st_uint i = 0; i < ptr_array_length (scope->copied); i++) {
+	if (ptr_array_get_index (scope->copied, i) == var)
+	    return scope->argcount + i;
+    }
+
+    st_assert_not_reached ();
+    return -1;
+}
+
+static void
+push_variable (Generator *gt, st_bytecode *code, Variable *var)
+{
+    if (var->remote) {
+	emit (code, PUSH_REMOTE_TEMP);
+	emit (code, var->index);
+	emit (code, frame_slot (gt->scope, var->scope->vector));
+	code->max_stack_depth++;
+    } else {
+	push (gt, code, PUSH_TEMP, frame_slot (gt->scope, var));
+    }
+}
+
+static void
+assign_variable (Generator *gt, st_bytecode *code, Variable *var, bool pop)
+{
+    if (var->remote) {
+	emit (code, pop ? STORE_POP_REMOTE_TEMP : STORE_REMOTE_TEMP);
+	emit (code, var->index);
+	emit (code, frame_slot (gt->scope, var->scope->vector));
+    } else {
+	assign_temp (gt, code, frame_slot (gt->scope, var), pop);
+    }
+}
+
+/* Sets up the frame of `scope' on entry. The temporaries of a block are
+ * pushed, those of a method are cleared when its context is created.
+ * The temp vector is created, and remote arguments are moved into it.
+ */
+static void
+generate_prologue (Generator *gt, st_bytecode *code, Scope *scope, bool block)
+{
+    Variable *var;
+    st_uint   first;
+
+    if (block) {
+	first = scope->argcount + ptr_array_length (scope->copied);
+	for (st_uint i = first; i < scope->frame_size + scope->hidden_count; i++) {
+	    if (scope->vector && i == scope->vector->slot)
+		push (gt, code, PUSH_NEW_ARRAY, scope->remote_count);
+	    else
+		push_special (gt, code, PUSH_NIL);
+	}
+    } else if (scope->vector) {
+	push (gt, code, PUSH_NEW_ARRAY, scope->remote_count);
+	assign_temp (gt, code, scope->vector->slot, true);
+    }
+
+    for (st_uint i = 0; i < scope->argcount; i++) {
+	var = ptr_array_get_index (scope->variables, i);
+	if (var->remote) {
+	    push (gt, code, PUSH_TEMP, var->slot);
+	    assign_variable (gt, code, var, true);
+	}
+    }
+}
+
 static void
 generate_assign (Generator *gt, st_bytecode *code, st_node *node, bool pop)
 {
@@ -402,9 +640,8 @@ generate_assign (Generator *gt, st_bytecode *code, st_node *node, bool pop)
     
     generate_expression (gt, code, node->assign.expression);
     
-    index = find_temporary (gt, node->assign.assignee->variable.name);
-    if (index >= 0) {
-	assign_temp (gt, code, index, pop); 
+    if (node->assign.assignee->variable.binding) {
+	assign_variable (gt, code, node->assign.assignee->variable.binding, pop);
 	return;
     }
 
@@ -424,18 +661,6 @@ generate_assign (Generator *gt, st_bytecode *code, st_node *node, bool pop)
 }
 
 
-static int
-size_assign (Generator *gt, st_node *node)
-{
-    st_bytecode code;
-
-    bytecode_init (&code);
-    generate_assign (gt, &code, node, true);
-    bytecode_destroy (&code);
-
-    return code.size;
-}
-
 static void
 generate_return (Generator *gt, st_bytecode *code, st_node *node)
 {
@@ -444,83 +669,248 @@ generate_return (Generator *gt, st_bytecode *code, st_node *node)
     emit (code, RETURN_STACK_TOP);
 }
 
+/*
+ * Stack depth
+ *
+ * Contexts are allocated with just enough stack for the method or block
+ * they run. The greatest depth is found by following the code from its
+ * entry point; a block body is skipped by the jump which follows its
+ * BLOCK_COPY, and is measured on its own.
+ */
+
+/* the change in depth caused by the instruction at `ip' */
 static int
-size_return (Generator *gt, st_node *node)
+stack_effect (st_uchar *ip)
 {
-    st_bytecode code;
+    switch ((Code) ip[0]) {
+    case PUSH_TEMP:
+    case PUSH_INSTVAR:
+    case PUSH_LITERAL_CONST:
+    case PUSH_LITERAL_VAR:
+    case PUSH_SELF:
+    case PUSH_NIL:
+    case PUSH_TRUE:
+    case PUSH_FALSE:
+    case PUSH_INTEGER:
+    case PUSH_ACTIVE_CONTEXT:
+    case DUPLICATE_STACK_TOP:
+    case PUSH_CLEAN_BLOCK:
+    case PUSH_NEW_ARRAY:
+    case PUSH_REMOTE_TEMP:
+	return 1;
+
+    case BLOCK_COPY:
+	/* the copied values are replaced by the closure */
+	return 1 - (int) ip[3];
+
+    case STORE_POP_LITERAL_VAR:
+    case STORE_POP_TEMP:
+    case STORE_POP_INSTVAR:
+    case STORE_POP_REMOTE_TEMP:
+    case POP_STACK_TOP:
+    case JUMP_TRUE:
+    case JUMP_FALSE:
+	return -1;
 
-    bytecode_init (&code);
-    generate_return (gt, &code, node);
-    bytecode_destroy (&code);
+    case SEND:
+    case SEND_SUPER:
+	return - (int) ip[1];
+
+    case SEND_PLUS:
+    case SEND_MINUS:
+    case SEND_LT:
+    case SEND_GT:
+    case SEND_LE:
+    case SEND_GE:
+    case SEND_EQ:
+    case SEND_NE:
+    case SEND_MUL:
+    case SEND_DIV:
+    case SEND_MOD:
+    case SEND_BITSHIFT:
+    case SEND_BITAND:
+    case SEND_BITOR:
+    case SEND_BITXOR:
+    case SEND_AT:
+    case SEND_VALUE_ARG:
+    case SEND_IDENTITY_EQ:
+    case SEND_NEW_ARG:
+    case BRANCH_LT:
+    case BRANCH_GT:
+    case BRANCH_LE:
+    case BRANCH_GE:
+	return -1;
 
-    return code.size;
+    case SEND_AT_PUT:
+	return -2;
+
+    default:
+	return 0;
+    }
 }
 
-static st_list *
-get_block_temporaries (Generator *gt, st_node *temporaries)
+/* the greatest depth reached by the code from `entry' to `end', which
+ * starts with `initial' slots in use */
+static st_uint
+stack_depth (Generator *gt, st_bytecode *code, st_uint entry, st_uint end, st_uint initial, st_node *node)
 {
-    st_list *temps = NULL;
-    
-    for (st_node *node = temporaries; node; node = node->next) {
-      
-	for (st_list *l = gt->instvars; l; l = l->next) {
-	  if (streq (node->variable.name, (char *) l->data))
-	      generation_error (gt, "name is already defined", node);
+    int      *depths;
+    st_uint  *pending, count = 0;
+    st_uint   offset, next, target;
+    int       depth, max = initial;
+    st_uchar  op;
+
+    /* indexed by offset from `entry' */
+    depths  = st_arena_alloc (gt->arena, (end - entry + 1) * sizeof (int));
+    pending = st_arena_alloc (gt->arena, (end - entry + 1) * sizeof (st_uint));
+    for (st_uint i = 0; i <= end - entry; i++)
+	depths[i] = -1;
+
+    depths[0] = initial;
+    pending[count++] = entry;
+
+    while (count > 0) {
+	offset = pending[--count];
+	depth  = depths[offset - entry];
+
+	while (offset < end) {
+	    op = code->buffer[offset];
+
+	    /* a ^-return from a block whose home is dead pushes
+	       the block and the value to send #cannotReturn: */
+	    if (op == RETURN_STACK_TOP)
+		max = MAX (max, depth + 2);
+	    if (op == RETURN_STACK_TOP || op == BLOCK_RETURN)
+		break;
+
+	    depth += stack_effect (code->buffer + offset);
+	    max = MAX (max, depth);
+	    next = offset + sizes[op];
+
+	    if (op == JUMP || op == JUMP_TRUE || op == JUMP_FALSE) {
+		target = next + (short) (code->buffer[offset + 1] | (code->buffer[offset + 2] << 8));
+		if (depths[target - entry] < 0) {
+		    depths[target - entry] = depth;
+		    pending[count++] = target;
+		}
+		if (op == JUMP)
+		    break;
+	    }
+
+	    if (depths[next - entry] >= 0)
+		break;
+	    depths[next - entry] = depth;
+	    offset = next;
 	}
+    }
 
-	for (st_list *l = gt->temporaries; l; l = l->next) {
-	  if (streq (node->variable.name, (char *) l->data))
-	      generation_error (gt, "name already used in method", node);
-	}
+    if (max > ST_CONTEXT_MAX_STACK_SIZE)
+	generation_error (gt, "expression too deeply nested", node);
 
-	temps = st_list_prepend (temps, (st_pointer) node->variable.name);
-	
-    }
-    
-    return st_list_reverse (temps);
+    return max;
 }
 
-static void
-generate_block (Generator *gt, st_bytecode *code, st_node *node)
+/* sizes the stacks of the blocks in `code', once it is final,
+ * and returns the size of the method's own stack */
+static st_uint
+finish_stack_depths (Generator *gt, st_bytecode *code, st_uint tempcount, st_node *node)
 {
-    int   index, size = 0;
-    st_uint  i, argcount;
-    st_node *l;
+    for (st_uint offset = 0; offset < code->size; offset += sizes[code->buffer[offset]]) {
+	if (code->buffer[offset] != BLOCK_COPY)
+	    continue;
+	/* the block's arguments and copied values are on its stack
+	   when it starts, and its body follows the jump around it */
+	code->buffer[offset + 2] = stack_depth (gt, code, offset + 4 + 3, code->size,
+						(code->buffer[offset + 1] & ~ST_BLOCK_NEEDS_HOME)
+						+ code->buffer[offset + 3], node);
+    }
 
-    argcount = st_node_list_length (node->block.arguments);
+    return stack_depth (gt, code, 0, code->size, tempcount, node);
+}
 
-    emit (code, BLOCK_COPY);
-    emit (code, argcount);
+/*
+ * Blocks
+ *
+ * A clean block (see is_clean()) is created once, at compile time, and
+ * pushed from the literal frame. Any other block is created by
+ * BLOCK_COPY each time it is evaluated, copying the values it captures
+ * from the stack.
+ *
+ * The frame of a block is its stack: its arguments and copied values
+ * are pushed when it is activated, and its prologue pushes its
+ * temporaries.
+ */
 
-    // get size of block code and then jump around that code
-    size = 2 * argcount + size_statements (gt, node->block.statements) + sizes[BLOCK_RETURN];
-    jump_offset (gt, code, size);
+/* completes the clean blocks of `method', once its code is final */
+static void
+finish_clean_blocks (Generator *gt, st_oop method, st_bytecode *code)
+{
+    st_oop   *literals;
+    st_oop    block;
+
+    literals = st_array_elements (ST_METHOD_LITERALS (method));
+
+    for (st_uint offset = 0; offset < code->size; offset += sizes[code->buffer[offset]]) {
+	if (code->buffer[offset] != PUSH_CLEAN_BLOCK)
+	    continue;
+	block = literals[code->buffer[offset + 1]];
+	/* the body follows the jump around it */
+	ST_BLOCK_CLOSURE_INITIALIP (block) = st_smi_new (offset + 2 + 3);
+	ST_BLOCK_CLOSURE_METHOD (block) = method;
+    }
+}
 
-    /* Store all block arguments into the temporary frame.
-       Note that upon a block activation, the stack pointer sits
-       above the last argument to to the block */
-    i = st_node_list_length (node->block.arguments);
-    for (; i > 0; --i) {
-	l = st_node_list_at (node->block.arguments, i - 1);
-	index = find_temporary (gt, l->variable.name);
-	st_assert (index >= 0);
-	assign_temp (gt, code, index, true);
+static void
+generate_block (Generator *gt, st_bytecode *code, st_node *node)
+{
+    Scope      *scope, *outer;
+    Variable   *var;
+    st_uint     label, ncopied, offset;
+    st_oop      block;
+
+    outer = gt->scope;
+    scope = node->block.scope;
+    ncopied = ptr_array_length (scope->copied);
+
+    if (is_clean (scope)) {
+	block = st_memory_allocate_closure (0, 0);
+	ST_BLOCK_CLOSURE_OUTER_CONTEXT (block) = ST_NIL;
+	ST_BLOCK_CLOSURE_METHOD (block)        = ST_NIL;
+	ST_BLOCK_CLOSURE_RECEIVER (block)      = ST_NIL;
+	ST_BLOCK_CLOSURE_INITIALIP (block)     = st_smi_new (0);
+	ST_BLOCK_CLOSURE_ARGCOUNT (block)      = st_smi_new (scope->argcount);
+	ptr_array_append (gt->literals, (st_pointer) block);
+	push (gt, code, PUSH_CLEAN_BLOCK, ptr_array_length (gt->literals) - 1);
+    } else {
+	for (st_uint i = 0; i < ncopied; i++) {
+	    var = ptr_array_get_index (scope->copied, i);
+	    push (gt, code, PUSH_TEMP, frame_slot (outer, var));
+	}
+	emit (code, BLOCK_COPY);
+	emit (code, scope->argcount | (scope->uses_home ? ST_BLOCK_NEEDS_HOME : 0));
+	/* stack size, filled in by finish_stack_depths() */
+	emit (code, 0);
+	emit (code, ncopied);
+	block = ST_NIL;
     }
 
+    /* jump around the block code */
+    label = jump_forward (code, JUMP);
+    offset = code->size;
+
+    gt->scope = scope;
+    generate_prologue (gt, code, scope, true);
     generate_statements (gt, code, node->block.statements);
     emit (code, BLOCK_RETURN);
-} 
+    gt->scope = outer;
 
-static int
-size_block (Generator *gt, st_node *node)
-{
-    st_bytecode code;
-
-    bytecode_init (&code);
-    generate_block (gt, &code, node);
-    bytecode_destroy (&code);
+    /* the closure of a clean block is sized now, its literal
+       can't be found again by finish_stack_depths(). Its body is
+       the last code generated so far. */
+    if (block != ST_NIL)
+	st_context_set_stack_size (block, stack_depth (gt, code, offset, code->size, scope->argcount, node));
 
-    return code.size;
+    patch_jump (code, label);
 }
 
 /* #ifTrue:
@@ -544,25 +934,22 @@ static void
 generate_ifTrue (Generator *gt, st_bytecode *code, st_node *node)
 {
     st_node *block;
-    int      size;
+    st_uint  label, end;
 
     block = node->message.arguments;
 	
     generate_expression (gt, code, node->message.receiver);
-    size = size_statements (gt, block->block.statements);
-    size += node->message.is_statement ? sizes[POP_STACK_TOP] : sizes[JUMP];
-    emit (code, JUMP_FALSE);
-    emit (code, size & 0xFF);
-    emit (code, (size >> 8) & 0xFF);
+    label = jump_forward (code, JUMP_FALSE);
     generate_statements (gt, code, block->block.statements);
 	
     if (node->message.is_statement) {
 	emit (code, POP_STACK_TOP);
+	patch_jump (code, label);
     } else {
-	emit (code, JUMP);
-	emit (code, 1);
-	emit (code, 0);
+	end = jump_forward (code, JUMP);
+	patch_jump (code, label);
 	emit (code, PUSH_NIL);
+	patch_jump (code, end);
     }
 }
 
@@ -587,25 +974,22 @@ static void
 generate_ifFalse (Generator *gt, st_bytecode *code, st_node *node)
 {
     st_node *block;
-    int      size;
+    st_uint  label, end;
 
     block = node->message.arguments;
 	
     generate_expression (gt, code, node->message.receiver);
-    size = size_statements (gt, block->block.statements);
-    size += node->message.is_statement ? sizes[POP_STACK_TOP] : sizes[JUMP];
-    emit (code, JUMP_TRUE);
-    emit (code, size & 0xFF);
-    emit (code, (size >> 8) & 0xFF);
+    label = jump_forward (code, JUMP_TRUE);
     generate_statements (gt, code, block->block.statements);
 	
     if (node->message.is_statement) {
 	emit (code, POP_STACK_TOP);
+	patch_jump (code, label);
     } else {
-	emit (code, JUMP);
-	emit (code, 1);
-	emit (code, 0);
-	emit (code, PUSH_NIL);	
+	end = jump_forward (code, JUMP);
+	patch_jump (code, label);
+	emit (code, PUSH_NIL);
+	patch_jump (code, end);
     }
 }
 
@@ -633,24 +1017,19 @@ match_ifTrueifFalse (Generator *gt, st_node *node)
 static void
 generate_ifTrueifFalse (Generator *gt, st_bytecode *code, st_node *node)
 {
-    int     size;
-
     st_node *true_block, *false_block;
+    st_uint  label, end;
 	
     true_block  = node->message.arguments;
     false_block = node->message.arguments->next;
 
     generate_expression (gt, code, node->message.receiver);
-    size = size_statements (gt, true_block->block.statements) + sizes[JUMP];
-    emit (code, JUMP_FALSE);
-    emit (code, size & 0xFF);
-    emit (code, (size >> 8) & 0xFF);
+    label = jump_forward (code, JUMP_FALSE);
     generate_statements (gt, code, true_block->block.statements);
-    size = size_statements (gt, false_block->block.statements);
-    emit (code, JUMP);
-    emit (code, size & 0xFF);
-    emit (code, (size >> 8) & 0xFF);
+    end = jump_forward (code, JUMP);
+    patch_jump (code, label);
     generate_statements (gt, code, false_block->block.statements);
+    patch_jump (code, end);
 
     if (node->message.is_statement)
 	emit (code, POP_STACK_TOP);
@@ -681,22 +1060,18 @@ static void
 generate_ifFalseifTrue (Generator *gt, st_bytecode *code, st_node *node)
 {
     st_node *true_block, *false_block;
-    int size;
+    st_uint  label, end;
 	
     true_block  = node->message.arguments;
     false_block = node->message.arguments->next;
 
     generate_expression (gt, code, node->message.receiver);
-    size = size_statements (gt, true_block->block.statements) + sizes[JUMP];
-    emit (code, JUMP_TRUE);
-    emit (code, size & 0xFF);
-    emit (code, (size >> 8) & 0xFF);
+    label = jump_forward (code, JUMP_TRUE);
     generate_statements (gt, code, true_block->block.statements);
-    size = size_statements (gt, false_block->block.statements);
-    emit (code, JUMP);
-    emit (code, size & 0xFF);
-    emit (code, (size >> 8) & 0xFF);
+    end = jump_forward (code, JUMP);
+    patch_jump (code, label);
     generate_statements (gt, code, false_block->block.statements);
+    patch_jump (code, end);
 
     if (node->message.is_statement)
 	emit (code, POP_STACK_TOP);
@@ -723,21 +1098,16 @@ static void
 generate_whileTrue (Generator *gt, st_bytecode *code, st_node *node)
 {
     st_node *block;
-    int      size;
+    st_uint  start, label;
 
     block = node->message.receiver;
 
+    start = code->size;
     generate_statements (gt, code, block->block.statements);
 	
-    emit (code, JUMP_FALSE);
-    emit (code, 3);
-    emit (code, 0);
-    size = size_statements (gt, block->block.statements);
-    size += sizes[JUMP_FALSE];
-    size = -(size + 3);
-    emit (code, JUMP);
-    emit (code, size & 0xFF);
-    emit (code, (size >> 8) & 0xFF);	
+    label = jump_forward (code, JUMP_FALSE);
+    jump_back (code, JUMP, start);
+    patch_jump (code, label);
 
     if (!node->message.is_statement)
 	emit (code, PUSH_NIL);
@@ -764,20 +1134,16 @@ static void
 generate_whileFalse (Generator *gt, st_bytecode *code, st_node *node)
 {
     st_node *block;
-    int      size;
+    st_uint  start, label;
 
     block = node->message.receiver;
+
+    start = code->size;
     generate_statements (gt, code, block->block.statements);
 	
-    emit (code, JUMP_TRUE);
-    emit (code, 3);
-    emit (code, 0);
-    size = size_statements (gt, block->block.statements);
-    size += sizes[JUMP_FALSE];
-    size = -(size + 3);
-    emit (code, JUMP);
-    emit (code, size & 0xFF);
-    emit (code, (size >> 8) & 0xFF);	
+    label = jump_forward (code, JUMP_TRUE);
+    jump_back (code, JUMP, start);
+    patch_jump (code, label);
 
     if (!node->message.is_statement)
 	emit (code, PUSH_NIL);
@@ -807,25 +1173,17 @@ match_whileTrueArg (Generator *gt, st_node *node)
 static void
 generate_whileTrueArg (Generator *gt, st_bytecode *code, st_node *node)
 {
-    st_node *block;
-    int size;
+    st_uint start, label;
 	
-    generate_statements (gt, code, node->message.receiver->block.statements);	
-    emit (code, JUMP_FALSE);
-    size = size_statements (gt, node->message.arguments->block.statements);
-    size += sizes[POP_STACK_TOP] + sizes[JUMP];
-
-    emit (code, size & 0xFF);
-    emit (code, (size >> 8) & 0xFF);
+    start = code->size;
+    generate_statements (gt, code, node->message.receiver->block.statements);
+    label = jump_forward (code, JUMP_FALSE);
 
     generate_statements (gt, code, node->message.arguments->block.statements);
-	
-    size += size_statements (gt, node->message.receiver->block.statements);
-    size = -(size + 3);
+
     emit (code, POP_STACK_TOP);
-    emit (code, JUMP);
-    emit (code, size & 0xFF);
-    emit (code, (size >> 8) & 0xFF);
+    jump_back (code, JUMP, start);
+    patch_jump (code, label);
 
     if (!node->message.is_statement)
 	emit (code, PUSH_NIL);
@@ -855,26 +1213,17 @@ match_whileFalseArg (Generator *gt, st_node *node)
 static void
 generate_whileFalseArg (Generator *gt, st_bytecode *code, st_node *node)
 {
-    st_node *block;
-    int size;
+    st_uint start, label;
 	
+    start = code->size;
     generate_statements (gt, code, node->message.receiver->block.statements);
-    emit (code, JUMP_TRUE);
-    size = size_statements (gt, node->message.arguments->block.statements);
-    size += sizes[POP_STACK_TOP] + sizes[JUMP];
-
-    emit (code, size & 0xFF);
-    emit (code, (size >> 8) & 0xFF);
+    label = jump_forward (code, JUMP_TRUE);
 
     generate_statements (gt, code, node->message.arguments->block.statements);
-	
-    size += size_statements (gt, node->message.receiver->block.statements);
-    size = -(size + 3);
 
     emit (code, POP_STACK_TOP);
-    emit (code, JUMP);
-    emit (code, size & 0xFF);
-    emit (code, (size >> 8) & 0xFF);
+    jump_back (code, JUMP, start);
+    patch_jump (code, label);
 
     if (!node->message.is_statement)
 	emit (code, PUSH_NIL);
@@ -901,22 +1250,18 @@ static void
 generate_and (Generator *gt, st_bytecode *code, st_node *node)
 {
     st_node *block;
-    int size;
+    st_uint  label, end;
 
     block = node->message.arguments;
     generate_expression (gt, code, node->message.receiver);
-    size = size_statements (gt, block->block.statements) + sizes[JUMP];
-
-    emit (code, JUMP_FALSE);
-    emit (code, size & 0xFF);
-    emit (code, (size >> 8) & 0xFF);
+    label = jump_forward (code, JUMP_FALSE);
 
     generate_statements (gt, code, block->block.statements);
 
-    emit (code, JUMP);
-    emit (code, 1);
-    emit (code, 0);
+    end = jump_forward (code, JUMP);
+    patch_jump (code, label);
     emit (code, PUSH_FALSE);
+    patch_jump (code, end);
 
     if (node->message.is_statement)
 	emit (code, POP_STACK_TOP);
@@ -943,155 +1288,449 @@ static void
 generate_or (Generator *gt, st_bytecode *code, st_node *node)
 {
     st_node *block;
-    int size;
+    st_uint  label, end;
 
     block = node->message.arguments;
     generate_expression (gt, code, node->message.receiver);
-    size = size_statements (gt, block->block.statements) + sizes[JUMP];
-
-    emit (code, JUMP_TRUE);
-    emit (code, size & 0xFF);
-    emit (code, (size >> 8) & 0xFF);
+    label = jump_forward (code, JUMP_TRUE);
 
     generate_statements (gt, code, block->block.statements);
 
-    emit (code, JUMP);
-    emit (code, 1);
-    emit (code, 0);
+    end = jump_forward (code, JUMP);
+    patch_jump (code, label);
     emit (code, PUSH_TRUE);
+    patch_jump (code, end);
     if (node->message.is_statement)
 	emit (code, POP_STACK_TOP);
 }
 
-typedef void (* CodeGenerationFunc)    (Generator *gt, st_bytecode *code, st_node *node);
-typedef bool (* OptimisationMatchFunc) (Generator *gt, st_node *node);
+/* Hidden temporaries hold loop state for inlined messages. They follow
+ * the other temporaries in the frame of the scope being generated, and
+ * are reused once the loop which claimed them has been generated. How
+ * many a scope needs is counted by count_hidden_temps() beforehand.
+ */
+static int
+hidden_temp_new (Generator *gt)
+{
+    Scope *scope = gt->scope;
 
-static const struct optimisers {
-    
-    CodeGenerationFunc    generation_func;
-    OptimisationMatchFunc match_func;
+    st_assert (scope->hidden_in_use < scope->hidden_count);
 
-} optimisers[] =
-{
-    { generate_ifTrue,             match_ifTrue },
-    { generate_ifFalse,            match_ifFalse },
-    { generate_ifTrueifFalse,      match_ifTrueifFalse  },
-    { generate_ifFalseifTrue,      match_ifFalseifTrue  },
-    { generate_whileTrue,          match_whileTrue  },
-    { generate_whileFalse,         match_whileFalse  },
-    { generate_whileTrueArg,       match_whileTrueArg },
-    { generate_whileFalseArg,      match_whileFalseArg },
-    { generate_and,                match_and },
-    { generate_or,                 match_or  }
-};
+    return scope->frame_size + scope->hidden_in_use++;
+}
 
 static void
-generate_message_send (Generator *gt, st_bytecode *code, st_node *node)
+hidden_temp_free (Generator *gt)
 {
-    st_node *args;
-    st_uint  argcount = 0;
-    int      index;
-
-    /* generate arguments */
-    args = node->message.arguments;
-    for (; args; args = args->next) {
-	generate_expression (gt, code, args);
-	argcount++;
-    }
-
-    /* check if message is a special */
-    for (int i = 0; i < ST_N_ELEMENTS (__machine.selectors); i++) {
-	if (!node->message.super_send && node->message.selector == __machine.selectors[i]) {
-	    emit (code, SEND_PLUS + i);
-	    goto out;
-	}
-    }
-
-    if (node->message.super_send)
-	emit (code, SEND_SUPER);
-    else
-	emit (code, SEND);
-
-    index = find_literal_const (gt, node->message.selector);
-
-    emit (code, (st_uchar) argcount);
-    emit (code, (st_uchar) index);
-
-out:
-    if (node->message.is_statement)
-	emit (code, POP_STACK_TOP);
+    gt->scope->hidden_in_use--;
 }
 
-static int
-size_message_send (Generator *gt, st_node *node)
+static bool
+is_smi_literal (st_node *node)
 {
-    st_bytecode code;
-
-    bytecode_init (&code);
-    generate_message_send (gt, &code, node);
-    bytecode_destroy (&code);
-
-    return code.size;
+    return node->type == ST_LITERAL_NODE && st_object_is_smi (node->literal.value);
 }
 
+/* generates the body of an inlined block, leaving nothing on the stack */
 static void
-generate_cascade (Generator *gt, st_bytecode *code, st_node *node)
+generate_inlined_body (Generator *gt, st_bytecode *code, st_node *block)
 {
-    st_uint i, j;
+    generate_statements (gt, code, block->block.statements);
+    emit (code, POP_STACK_TOP);
+}
 
-    generate_expression (gt, code, node->cascade.receiver);
-    emit (code, DUPLICATE_STACK_TOP);
+/* #to:do:
+ */
+static bool
+match_todo (Generator *gt, st_node *node)
+{
+    st_node *block;
 
-    for (st_list *l = node->cascade.messages; l; l = l->next) {
+    if (strcmp (CSTRING (node->message.selector), "to:do:") != 0)
+	return false;
 
-	generate_message_send (gt, code, (st_node*) l->data); 
+    block = node->message.arguments->next;
+    if (block->type != ST_BLOCK_NODE || st_node_list_length (block->block.arguments) != 1)
+	return false;
 
-	if (l->next || node->cascade.is_statement)
-	    emit (code, POP_STACK_TOP);
+    return true;
+}
 
-	if (l->next && l->next->next)
-	    emit (code, DUPLICATE_STACK_TOP);
+/* #to:by:do:
+ *
+ * Only inlined for a literal step, so that the direction of
+ * the loop is known at compile time.
+ */
+static bool
+match_tobydo (Generator *gt, st_node *node)
+{
+    st_node *step, *block;
+
+    if (strcmp (CSTRING (node->message.selector), "to:by:do:") != 0)
+	return false;
+
+    step = node->message.arguments->next;
+    if (!is_smi_literal (step) || st_smi_value (step->literal.value) == 0)
+	return false;
+
+    block = step->next;
+    if (block->type != ST_BLOCK_NODE || st_node_list_length (block->block.arguments) != 1)
+	return false;
+
+    return true;
+}
+
+/*
+ * Counts a hidden temporary from the receiver to the limit, setting the
+ * block argument from it at the start of each iteration, so that the body
+ * may assign to the argument or capture it without changing the count.
+ * The limit is evaluated once, into a hidden temporary unless it is a
+ * literal. Like Number>>to:by:do:, the value of the expression is the
+ * receiver.
+ */
+static void
+generate_loop (Generator *gt, st_bytecode *code, st_node *node, st_node *step, st_node *block)
+{
+    st_node  *limit;
+    Variable *arg;
+    st_uint   start, label;
+    int       counter, hidden = -1;
+
+    limit = node->message.arguments;
+    arg = block->block.arguments->variable.binding;
+
+    counter = hidden_temp_new (gt);
+
+    generate_expression (gt, code, node->message.receiver);
+    if (!node->message.is_statement)
+	emit (code, DUPLICATE_STACK_TOP);
+    assign_temp (gt, code, counter, true);
+
+    if (limit->type != ST_LITERAL_NODE) {
+	hidden = hidden_temp_new (gt);
+	generate_expression (gt, code, limit);
+	assign_temp (gt, code, hidden, true);
     }
+
+    start = code->size;
+    push (gt, code, PUSH_TEMP, counter);
+    if (hidden >= 0)
+	push (gt, code, PUSH_TEMP, hidden);
+    else
+	generate_expression (gt, code, limit);
+    if (step && st_smi_value (step->literal.value) < 0)
+	emit (code, SEND_GE);
+    else
+	emit (code, SEND_LE);
+    label = jump_forward (code, JUMP_FALSE);
+
+    push (gt, code, PUSH_TEMP, counter);
+    assign_variable (gt, code, arg, true);
+    generate_inlined_body (gt, code, block);
+
+    push (gt, code, PUSH_TEMP, counter);
+    if (step)
+	generate_expression (gt, code, step);
+    else
+	push (gt, code, PUSH_INTEGER, 1);
+    emit (code, SEND_PLUS);
+    assign_temp (gt, code, counter, true);
+    jump_back (code, JUMP, start);
+    patch_jump (code, label);
+
+    if (hidden >= 0)
+	hidden_temp_free (gt);
+    hidden_temp_free (gt);
 }
 
-static int
-size_cascade (Generator *gt, st_node *node)
+static void
+generate_todo (Generator *gt, st_bytecode *code, st_node *node)
 {
-    st_bytecode code;
+    generate_loop (gt, code, node, NULL, node->message.arguments->next);
+}
 
-    bytecode_init (&code);
-    generate_cascade (gt, &code, node);
-    bytecode_destroy (&code);
+static void
+generate_tobydo (Generator *gt, st_bytecode *code, st_node *node)
+{
+    st_node *step = node->message.arguments->next;
 
-    return code.size;
+    generate_loop (gt, code, node, step, step->next);
 }
 
+/* #timesRepeat:
+ */
+static bool
+match_timesRepeat (Generator *gt, st_node *node)
+{
+    st_node *block;
+
+    if (strcmp (CSTRING (node->message.selector), "timesRepeat:") != 0)
+	return false;
+
+    block = node->message.arguments;
+    if (block->type != ST_BLOCK_NODE || block->block.arguments != NULL)
+	return false;
+
+    return true;
+}
+
+/* counts a hidden temporary down from the receiver, which
+ * repeats the block as often as `1 to: self do:' would */
 static void
-generate_message (Generator *gt, st_bytecode *code, st_node *node)
+generate_timesRepeat (Generator *gt, st_bytecode *code, st_node *node)
 {
-    st_uint i, j;
+    st_uint start, label;
+    int     hidden;
 
-    for (i = 0; i < ST_N_ELEMENTS (optimisers); i++) {
-	if (optimisers[i].match_func (gt, node)) {
-	    optimisers[i].generation_func (gt, code, node);
-	    return;
+    hidden = hidden_temp_new (gt);
+
+    generate_expression (gt, code, node->message.receiver);
+    if (!node->message.is_statement)
+	emit (code, DUPLICATE_STACK_TOP);
+    assign_temp (gt, code, hidden, true);
+
+    start = code->size;
+    push (gt, code, PUSH_TEMP, hidden);
+    push (gt, code, PUSH_INTEGER, 1);
+    emit (code, SEND_GE);
+    label = jump_forward (code, JUMP_FALSE);
+
+    generate_inlined_body (gt, code, node->message.arguments);
+
+    push (gt, code, PUSH_TEMP, hidden);
+    push (gt, code, PUSH_INTEGER, 1);
+    emit (code, SEND_MINUS);
+    assign_temp (gt, code, hidden, true);
+    jump_back (code, JUMP, start);
+    patch_jump (code, label);
+
+    hidden_temp_free (gt);
+}
+
+/* blocks taking the receiver of #ifNotNil: may declare it as an argument */
+static bool
+is_nil_block (st_node *node, st_uint max_args)
+{
+    return node->type == ST_BLOCK_NODE
+	&& st_node_list_length (node->block.arguments) <= max_args;
+}
+
+/* pushes whether the receiver is nil, storing it into the argument
+ * of `block' first, if it has one */
+static void
+generate_nil_test (Generator *gt, st_bytecode *code, st_node *node, st_node *block)
+{
+    generate_expression (gt, code, node->message.receiver);
+    if (block && block->block.arguments)
+	assign_variable (gt, code, block->block.arguments->variable.binding, false);
+    push_special (gt, code, PUSH_NIL);
+    emit (code, SEND_IDENTITY_EQ);
+}
+
+/* #ifNil:
+ */
+static bool
+match_ifNil (Generator *gt, st_node *node)
+{
+    if (strcmp (CSTRING (node->message.selector), "ifNil:") != 0)
+	return false;
+
+    return is_nil_block (node->message.arguments, 0);
+}
+
+static void
+generate_ifNil (Generator *gt, st_bytecode *code, st_node *node)
+{
+    st_uint label, end;
+
+    generate_nil_test (gt, code, node, NULL);
+    label = jump_forward (code, JUMP_FALSE);
+    generate_statements (gt, code, node->message.arguments->block.statements);
+    end = jump_forward (code, JUMP);
+    patch_jump (code, label);
+    emit (code, PUSH_NIL);
+    patch_jump (code, end);
+
+    if (node->message.is_statement)
+	emit (code, POP_STACK_TOP);
+}
+
+/* #ifNotNil:
+ */
+static bool
+match_ifNotNil (Generator *gt, st_node *node)
+{
+    if (strcmp (CSTRING (node->message.selector), "ifNotNil:") != 0)
+	return false;
+
+    return is_nil_block (node->message.arguments, 1);
+}
+
+static void
+generate_ifNotNil (Generator *gt, st_bytecode *code, st_node *node)
+{
+    st_uint label, end;
+
+    generate_nil_test (gt, code, node, node->message.arguments);
+    label = jump_forward (code, JUMP_TRUE);
+    generate_statements (gt, code, node->message.arguments->block.statements);
+    end = jump_forward (code, JUMP);
+    patch_jump (code, label);
+    emit (code, PUSH_NIL);
+    patch_jump (code, end);
+
+    if (node->message.is_statement)
+	emit (code, POP_STACK_TOP);
+}
+
+/* #ifNil:ifNotNil:
+ */
+static bool
+match_ifNilifNotNil (Generator *gt, st_node *node)
+{
+    if (strcmp (CSTRING (node->message.selector), "ifNil:ifNotNil:") != 0)
+	return false;
+
+    return is_nil_block (node->message.arguments, 0)
+	&& is_nil_block (node->message.arguments->next, 1);
+}
+
+static void
+generate_ifNilifNotNil (Generator *gt, st_bytecode *code, st_node *node)
+{
+    st_node *nil_block, *not_nil_block;
+    st_uint  label, end;
+
+    nil_block     = node->message.arguments;
+    not_nil_block = node->message.arguments->next;
+
+    generate_nil_test (gt, code, node, not_nil_block);
+    label = jump_forward (code, JUMP_FALSE);
+    generate_statements (gt, code, nil_block->block.statements);
+    end = jump_forward (code, JUMP);
+    patch_jump (code, label);
+    generate_statements (gt, code, not_nil_block->block.statements);
+    patch_jump (code, end);
+
+    if (node->message.is_statement)
+	emit (code, POP_STACK_TOP);
+}
+
+typedef void (* CodeGenerationFunc)    (Generator *gt, st_bytecode *code, st_node *node);
+typedef bool (* OptimisationMatchFunc) (Generator *gt, st_node *node);
+
+static const struct optimisers {
+    
+    CodeGenerationFunc    generation_func;
+    OptimisationMatchFunc match_func;
+
+    /* operands which are inlined blocks, bit 0 for the receiver
+       and bit i for the i-th argument */
+    st_uint               inlined;
+    /* whether the inlined blocks may be run repeatedly */
+    bool                  loop;
+
+} optimisers[] =
+{
+    { generate_ifTrue,             match_ifTrue,          0x2, false },
+    { generate_ifFalse,            match_ifFalse,         0x2, false },
+    { generate_ifTrueifFalse,      match_ifTrueifFalse,   0x6, false },
+    { generate_ifFalseifTrue,      match_ifFalseifTrue,   0x6, false },
+    { generate_whileTrue,          match_whileTrue,       0x1, true  },
+    { generate_whileFalse,         match_whileFalse,      0x1, true  },
+    { generate_whileTrueArg,       match_whileTrueArg,    0x3, true  },
+    { generate_whileFalseArg,      match_whileFalseArg,   0x3, true  },
+    { generate_and,                match_and,             0x2, false },
+    { generate_or,                 match_or,              0x2, false },
+    { generate_todo,               match_todo,            0x4, true  },
+    { generate_tobydo,             match_tobydo,          0x8, true  },
+    { generate_timesRepeat,        match_timesRepeat,     0x2, true  },
+    { generate_ifNil,              match_ifNil,           0x2, false },
+    { generate_ifNotNil,           match_ifNotNil,        0x2, false },
+    { generate_ifNilifNotNil,      match_ifNilifNotNil,   0x6, false }
+};
+
+/* the optimiser inlining `node', or NULL if it is sent */
+static const struct optimisers *
+find_optimiser (Generator *gt, st_node *node)
+{
+    for (st_uint i = 0; i < ST_N_ELEMENTS (optimisers); i++) {
+	if (optimisers[i].match_func (gt, node))
+	    return &optimisers[i];
+    }
+    return NULL;
+}
+
+static void
+generate_message_send (Generator *gt, st_bytecode *code, st_node *node)
+{
+    st_node *args;
+    st_uint  argcount = 0;
+    int      index;
+
+    /* generate arguments */
+    args = node->message.arguments;
+    for (; args; args = args->next) {
+	generate_expression (gt, code, args);
+	argcount++;
+    }
+
+    /* check if message is a special */
+    for (int i = 0; i < ST_N_ELEMENTS (__machine.selectors); i++) {
+	if (!node->message.super_send && node->message.selector == __machine.selectors[i]) {
+	    emit (code, SEND_PLUS + i);
+	    goto out;
 	}
     }
 
-    generate_expression (gt, code, node->message.receiver);
-    generate_message_send (gt, code, node);
+    if (node->message.super_send)
+	emit (code, SEND_SUPER);
+    else
+	emit (code, SEND);
+
+    index = find_literal_const (gt, node->message.selector);
+
+    emit (code, (st_uchar) argcount);
+    emit (code, (st_uchar) index);
+
+out:
+    if (node->message.is_statement)
+	emit (code, POP_STACK_TOP);
 }
 
-static int
-size_message (Generator *gt, st_node *node)
+static void
+generate_cascade (Generator *gt, st_bytecode *code, st_node *node)
 {
-    st_bytecode code;
+    st_uint i, j;
 
-    bytecode_init (&code);
-    generate_message (gt, &code, node);
-    bytecode_destroy (&code);
+    generate_expression (gt, code, node->cascade.receiver);
+    emit (code, DUPLICATE_STACK_TOP);
+
+    for (st_node *l = node->cascade.messages; l; l = l->next) {
+
+	generate_message_send (gt, code, l); 
+
+	if (l->next || node->cascade.is_statement)
+	    emit (code, POP_STACK_TOP);
+
+	if (l->next && l->next->next)
+	    emit (code, DUPLICATE_STACK_TOP);
+    }
+}
+
+static void
+generate_message (Generator *gt, st_bytecode *code, st_node *node)
+{
+    const struct optimisers *optimiser;
+
+    optimiser = find_optimiser (gt, node);
+    if (optimiser) {
+	optimiser->generation_func (gt, code, node);
+	return;
+    }
 
-    return code.size;
+    generate_expression (gt, code, node->message.receiver);
+    generate_message_send (gt, code, node);
 }
 
 static void
@@ -1124,9 +1763,8 @@ generate_expression (Generator *gt, st_bytecode *code, st_node *node)
 	    break;
 	}
 
-	index = find_temporary (gt, node->variable.name);
-	if (index >= 0) {
-	    push (gt, code, PUSH_TEMP, index);
+	if (node->variable.binding) {
+	    push_variable (gt, code, node->variable.binding);
 	    break;
 	}
 	index = find_instvar (gt, node->variable.name);
@@ -1144,6 +1782,15 @@ generate_expression (Generator *gt, st_bytecode *code, st_node *node)
     }
     case ST_LITERAL_NODE:
 
+	/* folded comparisons */
+	if (node->literal.value == ST_TRUE) {
+	    push_special (gt, code, PUSH_TRUE);
+	    break;
+	} else if (node->literal.value == ST_FALSE) {
+	    push_special (gt, code, PUSH_FALSE);
+	    break;
+	}
+
 	/* use optimized PUSH_INTEGER for smis in the range of -127..127 */
 	if (st_object_is_smi (node->literal.value) &&
 	    ((st_smi_value (node->literal.value) >= -127) && 
@@ -1156,182 +1803,692 @@ generate_expression (Generator *gt, st_bytecode *code, st_node *node)
 	}
 	break;
 
-    case ST_ASSIGN_NODE:
-	generate_assign (gt, code, node, false);
-	break;
+    case ST_ASSIGN_NODE:
+	generate_assign (gt, code, node, false);
+	break;
+
+    case ST_BLOCK_NODE:	
+	generate_block (gt, code, node);
+	break;
+
+    case ST_MESSAGE_NODE:
+	generate_message (gt, code, node);
+	break;
+
+    case ST_CASCADE_NODE:
+	generate_cascade (gt, code, node);
+	break;
+
+    default:
+	st_assert_not_reached ();
+    }
+}
+
+static void
+generate_statements (Generator *gt, st_bytecode *code, st_node *statements)
+{
+    if (statements == NULL) {
+	emit (code, PUSH_NIL);
+    }
+
+    for (st_node *node = statements; node; node = node->next) {
+
+	switch (node->type) {
+
+	case ST_VARIABLE_NODE:
+	case ST_LITERAL_NODE:
+	case ST_BLOCK_NODE:
+	    /*
+	     * don't generate anything in this case since we would end up with a constant
+	     * expression with no side-effects.
+             * 
+             * However, in a block with no explicit return, the value of the last statement is the implicit
+             * value of the block.   
+	     */
+	    if (node->next == NULL)
+		generate_expression (gt, code, node);
+	    break;
+
+	case ST_ASSIGN_NODE:
+
+	    /* don't use STORE_POP if this is the last statement */
+	    if (node->next == NULL)
+		generate_assign (gt, code, node, false);
+	    else
+		generate_assign (gt, code, node, true);		
+	    break;
+	    
+	case ST_RETURN_NODE:
+	    
+	    st_assert (node->next == NULL);
+	    generate_return (gt, code, node);
+	    return;
+	    
+	case ST_MESSAGE_NODE:
+
+	    generate_message (gt, code, node);
+	    break;
+	    
+	case ST_CASCADE_NODE:
+
+	    generate_cascade (gt, code, node);
+	    break;
+
+	default:
+	    st_assert_not_reached ();
+	}
+    }
+}
+
+static void
+generate_method_statements (Generator *gt, st_bytecode *code, st_node *statements)
+{
+   for (st_node *node = statements; node; node = node->next) {
+
+       switch (node->type) {
+	   
+       case ST_VARIABLE_NODE:
+       case ST_LITERAL_NODE:
+       case ST_BLOCK_NODE:
+	    break;
+	    
+       case ST_ASSIGN_NODE:
+	   
+	   generate_assign (gt, code, node, true);		
+	   break;
+	   
+       case ST_RETURN_NODE:
+
+	   st_assert (node->next == NULL);	    
+	   generate_return (gt, code, node);
+	   return;
+	    
+       case ST_MESSAGE_NODE:
+	   
+	   generate_message (gt, code, node);
+	   break;
+	   
+       case ST_CASCADE_NODE:
+	   
+	   generate_cascade (gt, code, node);
+	   break;
+	   
+       default:
+	   st_assert_not_reached ();
+       }
+    }
+   
+   emit (code, PUSH_SELF);
+   emit (code, RETURN_STACK_TOP);
+}
+
+/*
+ * Name resolution
+ *
+ * Binds each variable to the names referring to it, and finds out what
+ * every block refers to outside of itself. Positions order the reads
+ * and writes, so that a variable which may be written after a closure
+ * captured it is made remote. Within an inlined loop, a variable both
+ * captured and written may be written after the capture, by a later
+ * iteration. The variables of the loop's own body are the exception:
+ * closures see them as new on each iteration, as they would be if the
+ * body was not inlined.
+ */
+
+static void resolve_names (Generator *gt, st_node *statements);
+static void resolve_expression (Generator *gt, st_node *node);
+
+static Variable *
+lookup (Generator *gt, st_uint count, const char *name)
+{
+    Variable *var;
+
+    for (st_uint i = count; i > 0; i--) {
+	var = ptr_array_get_index (gt->names, i - 1);
+	if (streq (name, var->name))
+	    return var;
+    }
+    return NULL;
+}
+
+static Variable *
+declare (Generator *gt, st_node *node, bool argument)
+{
+    Variable *var;
+    bool      shadowed;
+
+    if (find_name (gt->instvars, ptr_array_length (gt->instvars), node->variable.name) >= 0)
+	generation_error (gt, "name is already defined", node);
+
+    if (lookup (gt, gt->method_temporaries, node->variable.name))
+	generation_error (gt, "name already used in method", node);
+
+    /* a name declared twice in a scope refers to the first one */
+    var = lookup (gt, ptr_array_length (gt->names), node->variable.name);
+    shadowed = var && var->scope == gt->scope;
+
+    var = st_arena_new0 (gt->arena, Variable);
+    var->name     = node->variable.name;
+    var->scope    = gt->scope;
+    var->slot     = -1;
+    var->index    = -1;
+    var->argument = argument;
+    var->captured = -1;
+    var->written  = -1;
+
+    if (argument)
+	gt->scope->argcount++;
+    ptr_array_append (gt->scope->variables, var);
+    if (!shadowed)
+	ptr_array_append (gt->names, var);
+    node->variable.binding = var;
+
+    return var;
+}
+
+static void
+record_write (Generator *gt, Variable *var)
+{
+    if (var->captured >= 0)
+	var->remote = true;
+    var->written = gt->position++;
+}
+
+static void
+resolve_variable (Generator *gt, st_node *node, bool write)
+{
+    const char *name = node->variable.name;
+    Variable   *var;
+
+    if (streq (name, "thisContext")) {
+	gt->scope->uses_context = true;
+	return;
+    }
+
+    var = lookup (gt, ptr_array_length (gt->names), name);
+    if (var == NULL) {
+	if (streq (name, "self") || streq (name, "super") || find_instvar (gt, (char *) name) >= 0) {
+	    for (Scope *scope = gt->scope; scope; scope = scope->outer)
+		scope->uses_self = true;
+	}
+	return;
+    }
+
+    node->variable.binding = var;
+
+    if (var->scope == gt->scope) {
+	if (write)
+	    record_write (gt, var);
+	return;
+    }
+
+    /* captured by the closure of this scope */
+    if (var->captured < 0)
+	var->captured = gt->position++;
+    if (write)
+	var->remote = true;
+    ptr_array_append (gt->captures, gt->scope);
+    ptr_array_append (gt->captures, var);
+}
+
+static void
+resolve_block (Generator *gt, st_node *node, bool inlined, bool loop)
+{
+    Scope   *outer = gt->scope;
+    st_uint  names = ptr_array_length (gt->names);
+    st_node *arg;
+
+    if (!inlined) {
+	gt->scope = scope_new (gt, outer);
+	node->block.scope = gt->scope;
+    }
+
+    for (arg = node->block.arguments; arg; arg = arg->next)
+	declare (gt, arg, !inlined)->iteration = loop;
+    for (st_node *temp = node->block.temporaries; temp; temp = temp->next)
+	declare (gt, temp, false)->iteration = loop;
+
+    /* the arguments of an inlined block are set by the code around it */
+    if (inlined) {
+	for (arg = node->block.arguments; arg; arg = arg->next)
+	    record_write (gt, arg->variable.binding);
+    }
+
+    resolve_names (gt, node->block.statements);
+
+    while (ptr_array_length (gt->names) > names)
+	ptr_array_remove_index_fast (gt->names, ptr_array_length (gt->names) - 1);
+    gt->scope = outer;
+}
+
+static void
+resolve_operand (Generator *gt, st_node *node, const struct optimisers *optimiser, st_uint i)
+{
+    if (optimiser && (optimiser->inlined & (1 << i)))
+	resolve_block (gt, node, true, optimiser->loop);
+    else
+	resolve_expression (gt, node);
+}
+
+static void
+resolve_message (Generator *gt, st_node *node)
+{
+    const struct optimisers *optimiser;
+    Variable *var;
+    st_uint   i = 1;
+    int       start;
+
+    optimiser = find_optimiser (gt, node);
+    start = gt->position;
+
+    resolve_operand (gt, node->message.receiver, optimiser, 0);
+    for (st_node *arg = node->message.arguments; arg; arg = arg->next)
+	resolve_operand (gt, arg, optimiser, i++);
+
+    if (optimiser && optimiser->loop) {
+	for (i = 0; i < ptr_array_length (gt->scope->variables); i++) {
+	    var = ptr_array_get_index (gt->scope->variables, i);
+	    if (var->captured >= start && var->written >= start && !var->iteration)
+		var->remote = true;
+	}
+    }
+}
+
+static void
+resolve_expression (Generator *gt, st_node *node)
+{
+    switch (node->type) {
+    case ST_VARIABLE_NODE:
+	resolve_variable (gt, node, false);
+	break;
+    case ST_BLOCK_NODE:
+	resolve_block (gt, node, false, false);
+	break;
+    case ST_ASSIGN_NODE:
+	resolve_expression (gt, node->assign.expression);
+	resolve_variable (gt, node->assign.assignee, true);
+	break;
+    case ST_RETURN_NODE:
+	resolve_expression (gt, node->retrn.expression);
+	/* the closures around a ^ need their home context */
+	for (Scope *scope = gt->scope; scope->outer; scope = scope->outer)
+	    scope->uses_home = true;
+	break;
+    case ST_MESSAGE_NODE:
+	resolve_message (gt, node);
+	break;
+    case ST_CASCADE_NODE:
+	resolve_expression (gt, node->cascade.receiver);
+	for (st_node *message = node->cascade.messages; message; message = message->next) {
+	    for (st_node *arg = message->message.arguments; arg; arg = arg->next)
+		resolve_expression (gt, arg);
+	}
+	break;
+    case ST_LITERAL_NODE:
+	break;
+    default:
+	st_assert_not_reached ();
+    }
+}
+
+static void
+resolve_names (Generator *gt, st_node *statements)
+{
+    for (st_node *node = statements; node; node = node->next)
+	resolve_expression (gt, node);
+}
+
+/* gives every variable its place, once names are resolved */
+static void
+place_variables (Generator *gt)
+{
+    Scope    *scope;
+    Variable *var;
+    st_uint   slot;
+
+    for (st_uint i = 0; i < ptr_array_length (gt->scopes); i++) {
+	scope = ptr_array_get_index (gt->scopes, i);
+	for (st_uint j = 0; j < ptr_array_length (scope->variables); j++) {
+	    var = ptr_array_get_index (scope->variables, j);
+	    if (var->remote)
+		var->index = scope->remote_count++;
+	}
+	if (scope->remote_count > 0) {
+	    scope->vector = st_arena_new0 (gt->arena, Variable);
+	    scope->vector->scope = scope;
+	}
+    }
+
+    /* closures copy what they capture through every scope in between */
+    for (st_uint i = 0; i < ptr_array_length (gt->captures); i += 2) {
+	scope = ptr_array_get_index (gt->captures, i);
+	var   = ptr_array_get_index (gt->captures, i + 1);
+	if (var->remote)
+	    var = var->scope->vector;
+	for (; scope != var->scope; scope = scope->outer) {
+	    if (!ptr_array_contains (scope->copied, var))
+		ptr_array_append (scope->copied, var);
+	}
+    }
+
+    /* arguments, copied values, temporaries, then the temp vector */
+    for (st_uint i = 0; i < ptr_array_length (gt->scopes); i++) {
+	scope = ptr_array_get_index (gt->scopes, i);
+	slot = scope->argcount + ptr_array_length (scope->copied);
+	for (st_uint j = 0; j < ptr_array_length (scope->variables); j++) {
+	    var = ptr_array_get_index (scope->variables, j);
+	    if (var->argument)
+		var->slot = j;
+	    else if (!var->remote)
+		var->slot = slot++;
+	}
+	if (scope->vector)
+	    scope->vector->slot = slot++;
+	scope->frame_size = slot;
+    }
+}
+
+/*
+ * Counts the hidden temporaries of every scope before any code is
+ * generated, so that the prologue of a block can precede its body.
+ * The counts follow the claims made by generate_loop() and
+ * generate_timesRepeat(): the most temporaries in use at once.
+ */
+
+static st_uint hidden_temps (Generator *gt, st_node *node);
+
+static st_uint
+hidden_temps_of_statements (Generator *gt, st_node *statements)
+{
+    st_uint peak = 0, count;
+
+    for (st_node *node = statements; node; node = node->next) {
+	count = hidden_temps (gt, node);
+	peak = MAX (peak, count);
+    }
+    return peak;
+}
+
+/* an inlined block counts in the scope around it */
+static st_uint
+hidden_temps_of_operand (Generator *gt, st_node *node, const struct optimisers *optimiser, st_uint i)
+{
+    if (optimiser && (optimiser->inlined & (1 << i)))
+	return hidden_temps_of_statements (gt, node->block.statements);
+    return hidden_temps (gt, node);
+}
+
+static st_uint
+hidden_temps_of_loop (Generator *gt, st_node *node, st_node *block)
+{
+    st_node  *limit = node->message.arguments;
+    st_uint   bound, receiver, rest, body;
 
-    case ST_BLOCK_NODE:	
-	generate_block (gt, code, node);
-	break;
+    bound = limit->type != ST_LITERAL_NODE;
 
-    case ST_MESSAGE_NODE:
-	generate_message (gt, code, node);
-	break;
+    /* the counter is claimed before the receiver is evaluated,
+       the limit before the limit expression */
+    receiver = hidden_temps (gt, node->message.receiver);
+    rest = hidden_temps (gt, limit);
+    body = hidden_temps_of_statements (gt, block->block.statements);
+    rest = bound + MAX (rest, body);
+
+    return 1 + MAX (receiver, rest);
+}
+
+static st_uint
+hidden_temps (Generator *gt, st_node *node)
+{
+    const struct optimisers *optimiser;
+    Scope  *scope;
+    st_uint peak, count, i = 1;
 
+    switch (node->type) {
+    case ST_BLOCK_NODE:
+	scope = node->block.scope;
+	scope->hidden_count = hidden_temps_of_statements (gt, node->block.statements);
+	return 0;
+    case ST_ASSIGN_NODE:
+	return hidden_temps (gt, node->assign.expression);
+    case ST_RETURN_NODE:
+	return hidden_temps (gt, node->retrn.expression);
     case ST_CASCADE_NODE:
-	generate_cascade (gt, code, node);
+	peak = hidden_temps (gt, node->cascade.receiver);
+	for (st_node *message = node->cascade.messages; message; message = message->next) {
+	    for (st_node *arg = message->message.arguments; arg; arg = arg->next) {
+		count = hidden_temps (gt, arg);
+		peak = MAX (peak, count);
+	    }
+	}
+	return peak;
+    case ST_MESSAGE_NODE:
 	break;
-
     default:
-	st_assert_not_reached ();
+	return 0;
     }
-}
 
-static int
-size_expression (Generator *gt, st_node *node)
-{
-    st_bytecode code;
+    optimiser = find_optimiser (gt, node);
 
-    bytecode_init (&code);
-    generate_expression (gt, &code, node);
-    bytecode_destroy (&code);
+    if (optimiser && optimiser->generation_func == generate_todo)
+	return hidden_temps_of_loop (gt, node, node->message.arguments->next);
+    if (optimiser && optimiser->generation_func == generate_tobydo)
+	return hidden_temps_of_loop (gt, node, node->message.arguments->next->next);
+
+    peak = hidden_temps_of_operand (gt, node->message.receiver, optimiser, 0);
+    for (st_node *arg = node->message.arguments; arg; arg = arg->next) {
+	count = hidden_temps_of_operand (gt, arg, optimiser, i++);
+	peak = MAX (peak, count);
+    }
 
-    return code.size;
+    if (optimiser && optimiser->generation_func == generate_timesRepeat)
+	peak++;
+    return peak;
 }
 
 static void
-generate_statements (Generator *gt, st_bytecode *code, st_node *statements)
+count_hidden_temps (Generator *gt, st_node *statements)
 {
-    if (statements == NULL) {
-	emit (code, PUSH_NIL);
-    }
-
-    for (st_node *node = statements; node; node = node->next) {
+    gt->scope->hidden_count = hidden_temps_of_statements (gt, statements);
+}
 
-	switch (node->type) {
+/*
+ * Constant folding
+ *
+ * Sends of arithmetic and comparison selectors to SmallInteger, Float
+ * and Character literals are evaluated at compile time, mirroring the
+ * primitives which would otherwise answer them. Anything the primitive
+ * would fail on (overflow, division by zero, inexact division) is left
+ * for the running system to deal with.
+ */
 
-	case ST_VARIABLE_NODE:
-	case ST_LITERAL_NODE:
-	case ST_BLOCK_NODE:
-	    /*
-	     * don't generate anything in this case since we would end up with a constant
-	     * expression with no side-effects.
-             * 
-             * However, in a block with no explicit return, the value of the last statement is the implicit
-             * value of the block.   
-	     */
-	    if (node->next == NULL)
-		generate_expression (gt, code, node);
-	    break;
+static st_oop
+boolean (bool value)
+{
+    return value ? ST_TRUE : ST_FALSE;
+}
 
-	case ST_ASSIGN_NODE:
+static st_oop
+fold_smi (const char *selector, int64_t a, int64_t b)
+{
+    int64_t result;
+
+    if (streq (selector, "<"))
+	return boolean (a < b);
+    if (streq (selector, ">"))
+	return boolean (a > b);
+    if (streq (selector, "<="))
+	return boolean (a <= b);
+    if (streq (selector, ">="))
+	return boolean (a >= b);
+    if (streq (selector, "="))
+	return boolean (a == b);
+    if (streq (selector, "~="))
+	return boolean (a != b);
+
+    if (streq (selector, "+"))
+	result = a + b;
+    else if (streq (selector, "-"))
+	result = a - b;
+    else if (streq (selector, "*"))
+	result = a * b;
+    else if (streq (selector, "/") && b != 0 && a % b == 0)
+	result = a / b;
+    /* // truncates and \\ is a remainder, which only agree with
+       the Number methods for non-negative operands */
+    else if (streq (selector, "//") && a >= 0 && b > 0)
+	result = a / b;
+    else if (streq (selector, "\\\\") && a >= 0 && b > 0)
+	result = a % b;
+    else if (streq (selector, "bitAnd:"))
+	result = a & b;
+    else if (streq (selector, "bitOr:"))
+	result = a | b;
+    else if (streq (selector, "bitXor:"))
+	result = a ^ b;
+    else if (streq (selector, "bitShift:") && b >= 0 && b < 32)
+	result = a * ((int64_t) 1 << b);
+    else if (streq (selector, "bitShift:") && b < 0 && b > -32)
+	result = a >> -b;
+    else
+	return 0;
 
-	    /* don't use STORE_POP if this is the last statement */
-	    if (node->next == NULL)
-		generate_assign (gt, code, node, false);
-	    else
-		generate_assign (gt, code, node, true);		
-	    break;
-	    
-	case ST_RETURN_NODE:
-	    
-	    st_assert (node->next == NULL);
-	    generate_return (gt, code, node);
-	    return;
-	    
-	case ST_MESSAGE_NODE:
+    if (result < ST_SMALL_INTEGER_MIN || result > ST_SMALL_INTEGER_MAX)
+	return 0;
 
-	    generate_message (gt, code, node);
-	    break;
-	    
-	case ST_CASCADE_NODE:
+    return st_smi_new (result);
+}
 
-	    generate_cascade (gt, code, node);
-	    break;
+static st_oop
+fold_float (const char *selector, double a, double b)
+{
+    if (streq (selector, "<"))
+	return boolean (isless (a, b));
+    if (streq (selector, ">"))
+	return boolean (isgreater (a, b));
+    if (streq (selector, "<="))
+	return boolean (islessequal (a, b));
+    if (streq (selector, ">="))
+	return boolean (isgreaterequal (a, b));
+    if (streq (selector, "="))
+	return boolean (a == b);
+    if (streq (selector, "~="))
+	return boolean (a != b);
+
+    if (streq (selector, "+"))
+	return st_float_new (a + b);
+    if (streq (selector, "-"))
+	return st_float_new (a - b);
+    if (streq (selector, "*"))
+	return st_float_new (a * b);
+    if (streq (selector, "/") && b != 0)
+	return st_float_new (a / b);
+
+    return 0;
+}
 
-	default:
-	    st_assert_not_reached ();
-	}
-    }
+static st_oop
+fold_character (const char *selector, st_unichar a, st_unichar b)
+{
+    if (streq (selector, "<"))
+	return boolean (a < b);
+    if (streq (selector, ">"))
+	return boolean (a > b);
+    if (streq (selector, "<="))
+	return boolean (a <= b);
+    if (streq (selector, ">="))
+	return boolean (a >= b);
+    if (streq (selector, "="))
+	return boolean (a == b);
+    if (streq (selector, "~="))
+	return boolean (a != b);
+
+    return 0;
 }
 
-static int
-size_statements (Generator *gt, st_node *statements)
+static st_oop
+fold_unary (const char *selector, st_oop value)
 {
-    st_bytecode code;
+    st_oop class = st_object_class (value);
 
-    bytecode_init (&code);
-    generate_statements (gt, &code, statements);
-    bytecode_destroy (&code);
+    if (class == ST_CHARACTER_CLASS && streq (selector, "value"))
+	return st_smi_new (st_character_value (value));
+
+    if (class == ST_SMI_CLASS && streq (selector, "asFloat"))
+	return st_float_new (st_smi_value (value));
+
+    if ((class == ST_ARRAY_CLASS || class == ST_STRING_CLASS || class == ST_SYMBOL_CLASS)
+	&& streq (selector, "size"))
+	return st_arrayed_object_size (value);
 
-    return code.size;
+    return 0;
 }
 
-static void
-generate_method_statements (Generator *gt, st_bytecode *code, st_node *statements)
+/* answers the value of a message node with literal operands, or 0 */
+static st_oop
+fold_message (st_node *node)
 {
-   for (st_node *node = statements; node; node = node->next) {
+    const char *selector;
+    st_oop      a, b;
 
-       switch (node->type) {
-	   
-       case ST_VARIABLE_NODE:
-       case ST_LITERAL_NODE:
-       case ST_BLOCK_NODE:
-	    break;
-	    
-       case ST_ASSIGN_NODE:
-	   
-	   generate_assign (gt, code, node, true);		
-	   break;
-	   
-       case ST_RETURN_NODE:
+    if (node->message.super_send || node->message.receiver->type != ST_LITERAL_NODE)
+	return 0;
 
-	   st_assert (node->next == NULL);	    
-	   generate_return (gt, code, node);
-	   return;
-	    
-       case ST_MESSAGE_NODE:
-	   
-	   generate_message (gt, code, node);
-	   break;
-	   
-       case ST_CASCADE_NODE:
-	   
-	   generate_cascade (gt, code, node);
-	   break;
-	   
-       default:
-	   st_assert_not_reached ();
-       }
-    }
-   
-   emit (code, PUSH_SELF);
-   emit (code, RETURN_STACK_TOP);
+    selector = CSTRING (node->message.selector);
+    a = node->message.receiver->literal.value;
+
+    if (node->message.arguments == NULL)
+	return fold_unary (selector, a);
+
+    if (node->message.arguments->next != NULL
+	|| node->message.arguments->type != ST_LITERAL_NODE)
+	return 0;
+
+    b = node->message.arguments->literal.value;
+
+    if (st_object_is_smi (a) && st_object_is_smi (b))
+	return fold_smi (selector, st_smi_value (a), st_smi_value (b));
+
+    if (st_object_class (a) == ST_FLOAT_CLASS && st_object_class (b) == ST_FLOAT_CLASS)
+	return fold_float (selector, st_float_value (a), st_float_value (b));
+
+    if (st_object_is_character (a) && st_object_is_character (b))
+	return fold_character (selector, st_character_value (a), st_character_value (b));
+
+    return 0;
 }
 
-static st_list *
-collect_temporaries (Generator *gt, st_node *node)
+static void
+fold_constants (Generator *gt, st_node *node)
 {
-    st_list *temps = NULL;
+    st_oop value;
 
     if (node == NULL)
-	return NULL;
-
-    if (node->type == ST_BLOCK_NODE) {
-	temps = st_list_concat (get_block_temporaries (gt, node->block.arguments),
-				get_block_temporaries (gt, node->block.temporaries));
-    }    
+	return;
 
     switch (node->type) {
     case ST_BLOCK_NODE:
-	temps = st_list_concat (temps, collect_temporaries (gt, node->block.statements));
+	fold_constants (gt, node->block.statements);
 	break;
     case ST_ASSIGN_NODE:
-	temps = st_list_concat (temps, collect_temporaries (gt, node->assign.expression));
+	fold_constants (gt, node->assign.expression);
 	break;
     case ST_RETURN_NODE:
-	temps = st_list_concat (temps, collect_temporaries (gt, node->retrn.expression));
+	fold_constants (gt, node->retrn.expression);
 	break;
     case ST_MESSAGE_NODE:
-	temps = st_list_concat (temps, collect_temporaries (gt, node->message.receiver));
-	temps = st_list_concat (temps, collect_temporaries (gt, node->message.arguments));
-	break;
+	fold_constants (gt, node->message.receiver);
+	fold_constants (gt, node->message.arguments);
+	value = fold_message (node);
+	if (value != 0) {
+	    node->type = ST_LITERAL_NODE;
+	    node->literal.value = value;
+	}
 	break;
     case ST_CASCADE_NODE:
-	temps = st_list_concat (temps, collect_temporaries (gt, node->cascade.receiver));
-	for (st_list *l = node->cascade.messages; l; l = l->next)
-	    temps = st_list_concat (temps, collect_temporaries (gt, (st_node *) l->data));
-
+	/* the messages of a cascade share its receiver, only fold their arguments */
+	fold_constants (gt, node->cascade.receiver);
+	for (st_node *message = node->cascade.messages; message; message = message->next)
+	    fold_constants (gt, message->message.arguments);
 	break;
 
     case ST_METHOD_NODE:
@@ -1340,9 +2497,243 @@ collect_temporaries (Generator *gt, st_node *node)
 	break;
     }
 
-    temps = st_list_concat (temps, collect_temporaries (gt, node->next));
+    fold_constants (gt, node->next);
+}
+
+/*
+ * Peephole optimisation
+ *
+ * The generated code is decoded into a list of instructions, which
+ * are rewritten in place until nothing changes. Jumps refer to their
+ * target by instruction index, so deleting instructions only requires
+ * offsets to be recomputed when the code is encoded again.
+ */
+
+typedef struct
+{
+    st_uchar code[4];
+    st_uint  size;
+    st_uint  offset;
+    /* index of the jump target, for jumps */
+    st_uint  target;
+    /* entry point of a block, its jump must be kept */
+    bool     entry;
+    bool     label;
+    bool     dead;
+} Instruction;
+
+static bool
+is_jump (st_uchar code)
+{
+    return code == JUMP || code == JUMP_TRUE || code == JUMP_FALSE;
+}
+
+static bool
+is_return (st_uchar code)
+{
+    return code == RETURN_STACK_TOP || code == BLOCK_RETURN;
+}
+
+/* instructions which push a value without any side-effects */
+static bool
+is_pure_push (st_uchar code)
+{
+    switch (code) {
+    case PUSH_TEMP:
+    case PUSH_REMOTE_TEMP:
+    case PUSH_INSTVAR:
+    case PUSH_LITERAL_CONST:
+    case PUSH_LITERAL_VAR:
+    case PUSH_SELF:
+    case PUSH_NIL:
+    case PUSH_TRUE:
+    case PUSH_FALSE:
+    case PUSH_INTEGER:
+    case PUSH_ACTIVE_CONTEXT:
+    case DUPLICATE_STACK_TOP:
+	return true;
+    default:
+	return false;
+    }
+}
+
+/* skips over deleted instructions, the sentinel at `count' is never deleted */
+static st_uint
+live (Instruction *insts, st_uint i)
+{
+    while (insts[i].dead)
+	i++;
+    return i;
+}
+
+static st_uint
+next_live (Instruction *insts, st_uint i)
+{
+    return live (insts, i + 1);
+}
+
+static void
+mark_labels (Instruction *insts, st_uint count)
+{
+    for (st_uint i = 0; i <= count; i++)
+	insts[i].label = false;
+
+    for (st_uint i = 0; i < count; i++) {
+	if (insts[i].dead)
+	    continue;
+	if (is_jump (insts[i].code[0])) {
+	    insts[i].target = live (insts, insts[i].target);
+	    insts[insts[i].target].label = true;
+	}
+	if (insts[i].entry)
+	    insts[next_live (insts, i)].label = true;
+    }
+}
+
+static bool
+optimise_pass (Instruction *insts, st_uint count)
+{
+    st_uint i, j, t, hops;
+    bool changed = false;
+
+    mark_labels (insts, count);
+
+    for (i = live (insts, 0); i < count; i = next_live (insts, i)) {
+
+	st_uchar code = insts[i].code[0];
+
+	j = next_live (insts, i);
+
+	/* jump threading */
+	if (is_jump (code)) {
+	    insts[i].target = live (insts, insts[i].target);
+	    t = insts[i].target;
+	    for (hops = 0; hops < count && t < count && insts[t].code[0] == JUMP; hops++)
+		t = live (insts, insts[t].target);
+	    /* conditional jumps are only ever forward */
+	    if (t != insts[i].target && (code == JUMP || t > i)) {
+		insts[i].target = t;
+		changed = true;
+	    }
+	}
+
+	/* jump to a return */
+	if (code == JUMP && !insts[i].entry
+	    && insts[i].target < count && is_return (insts[insts[i].target].code[0])) {
+	    insts[i].code[0] = insts[insts[i].target].code[0];
+	    insts[i].size = 1;
+	    changed = true;
+	    continue;
+	}
+
+	/* jump to the next instruction */
+	if (code == JUMP && !insts[i].entry && insts[i].target == j) {
+	    insts[i].dead = true;
+	    changed = true;
+	    continue;
+	}
+
+	/* unreachable code */
+	if ((code == JUMP || is_return (code)) && j < count && !insts[j].label) {
+	    for (; j < count && !insts[j].label; j = next_live (insts, j))
+		insts[j].dead = true;
+	    changed = true;
+	    continue;
+	}
+
+	if (j == count || insts[j].label || insts[j].code[0] != POP_STACK_TOP)
+	    continue;
+
+	/* store/pop fusion */
+	if (code == STORE_TEMP || code == STORE_INSTVAR || code == STORE_LITERAL_VAR) {
+	    insts[i].code[0] = code - STORE_LITERAL_VAR + STORE_POP_LITERAL_VAR;
+	    insts[j].dead = true;
+	    changed = true;
+	    continue;
+	}
+	if (code == STORE_REMOTE_TEMP) {
+	    insts[i].code[0] = STORE_POP_REMOTE_TEMP;
+	    insts[j].dead = true;
+	    changed = true;
+	    continue;
+	}
+
+	/* dead push */
+	if (is_pure_push (code)) {
+	    insts[i].dead = true;
+	    insts[j].dead = true;
+	    changed = true;
+	    continue;
+	}
+    }
+
+    return changed;
+}
+
+static void
+optimise (Generator *gt, st_bytecode *code)
+{
+    Instruction *insts;
+    st_uint     *index, count, i, offset;
+    int          jump;
+
+    if (code->size == 0)
+	return;
+
+    insts = st_arena_alloc (gt->arena, (code->size + 1) * sizeof (Instruction));
+    index = st_arena_alloc (gt->arena, (code->size + 1) * sizeof (st_uint));
+
+    /* decode */
+    count = 0;
+    for (offset = 0; offset < code->size; offset += sizes[code->buffer[offset]]) {
+	index[offset] = count;
+	insts[count].offset = offset;
+	insts[count].size = sizes[code->buffer[offset]];
+	memcpy (insts[count].code, code->buffer + offset, insts[count].size);
+	count++;
+    }
+    index[code->size] = count;
+    insts[count].offset = code->size;
+
+    for (i = 0; i < count; i++) {
+	if (is_jump (insts[i].code[0])) {
+	    jump = (short) (insts[i].code[1] | (insts[i].code[2] << 8));
+	    insts[i].target = index[insts[i].offset + 3 + jump];
+	}
+	if (insts[i].code[0] == BLOCK_COPY || insts[i].code[0] == PUSH_CLEAN_BLOCK)
+	    insts[i + 1].entry = true;
+    }
+
+    while (optimise_pass (insts, count))
+	;
 
-    return temps;
+    /* fuse comparisons with the conditional jump which follows */
+    for (i = live (insts, 0); i < count; i = next_live (insts, i)) {
+	st_uint j = next_live (insts, i);
+	if (insts[i].code[0] >= SEND_LT && insts[i].code[0] <= SEND_GE
+	    && j < count
+	    && (insts[j].code[0] == JUMP_TRUE || insts[j].code[0] == JUMP_FALSE))
+	    insts[i].code[0] += BRANCH_LT - SEND_LT;
+    }
+
+    /* encode */
+    offset = 0;
+    for (i = 0; i <= count; i++) {
+	insts[i].offset = offset;
+	if (!insts[i].dead && i < count)
+	    offset += insts[i].size;
+    }
+
+    code->size = 0;
+    for (i = live (insts, 0); i < count; i = next_live (insts, i)) {
+	if (is_jump (insts[i].code[0])) {
+	    jump = insts[live (insts, insts[i].target)].offset - (insts[i].offset + 3);
+	    insts[i].code[1] = jump & 0xFF;
+	    insts[i].code[2] = (jump >> 8) & 0xFF;
+	}
+	memcpy (code->buffer + code->size, insts[i].code, insts[i].size);
+	code->size += insts[i].size;
+    }
 }
 
 st_oop
@@ -1352,12 +2743,11 @@ st_generate_method (st_oop class, st_node *node, st_compiler_error *error)
     st_oop      method;
     st_uint     argcount;
     st_uint     tempcount;
+    st_uint     stack_size;
     st_bytecode code;
 
     st_assert (class != ST_NIL);
     st_assert (node != NULL && node->type == ST_METHOD_NODE);
-    
-    check_init ();
 
     gt = generator_new ();
     gt->error = error;
@@ -1368,22 +2758,34 @@ st_generate_method (st_oop class, st_node *node, st_compiler_error *error)
     }
 
     gt->class = class;
-    gt->instvars = st_behavior_all_instance_variables (class);
-    gt->temporaries = get_temporaries (gt, gt->instvars, node->method.arguments, node->method.temporaries);
-
-    /* collect all block-level temporaries */
-    gt->temporaries = st_list_concat (gt->temporaries, collect_temporaries (gt, node->method.statements));
+    get_instvars (gt, class);
+    fold_constants (gt, node->method.statements);
+
+    gt->scope = scope_new (gt, NULL);
+    for (st_node *arg = node->method.arguments; arg; arg = arg->next)
+	declare (gt, arg, true);
+    for (st_node *temp = node->method.temporaries; temp; temp = temp->next)
+	declare (gt, temp, false);
+    gt->method_temporaries = ptr_array_length (gt->names);
+    resolve_names (gt, node->method.statements);
+    place_variables (gt);
+    count_hidden_temps (gt, node->method.statements);
 
     bytecode_init (&code);
+    generate_prologue (gt, &code, gt->scope, false);
     generate_method_statements (gt, &code, node->method.statements);
+    optimise (gt, &code);
     method = st_object_new (ST_COMPILED_METHOD_CLASS);
 
-    argcount  = st_node_list_length (node->method.arguments);
-    tempcount = st_list_length (gt->temporaries) - st_node_list_length (node->method.arguments);
+    argcount  = gt->scope->argcount;
+    tempcount = gt->scope->frame_size + gt->scope->hidden_count - argcount;
+    /* the stack of a method context starts with its arguments and temporaries */
+    stack_size = finish_stack_depths (gt, &code, argcount + tempcount, node);
 
     ST_METHOD_HEADER (method) = st_smi_new (0);
     st_method_set_arg_count    (method, argcount);
     st_method_set_temp_count   (method, tempcount);
+    st_method_set_stack_size   (method, stack_size);
     st_method_set_primitive_index (method, node->method.primitive);
 
     if (node->method.primitive >= 0) {
@@ -1394,6 +2796,7 @@ st_generate_method (st_oop class, st_node *node, st_compiler_error *error)
 
     ST_METHOD_LITERALS (method) = create_literals_array (gt);
     ST_METHOD_BYTECODE (method) = create_bytecode_array (&code); 
+    finish_clean_blocks (gt, method, &code);
     ST_METHOD_SELECTOR (method) = node->method.selector;
 
     generator_destroy (gt);
@@ -1417,6 +2820,7 @@ print_bytecodes (st_oop literals, st_uchar *codes, int len)
 	"<%02x>       ",
 	"<%02x %02x>    ",
 	"<%02x %02x %02x> ",
+	"<%02x %02x %02x %02x>",
     };
 
     ip = codes;
@@ -1523,8 +2927,39 @@ print_bytecodes (st_oop literals, st_uchar *codes, int len)
 	    NEXT (ip);
 
 	case BLOCK_COPY:
+	    printf (FORMAT (ip), ip[0], ip[1], ip[2], ip[3]);
+	    printf ("blockCopy: %i stackSize: %i copied: %i%s", ip[1] & ~ST_BLOCK_NEEDS_HOME, ip[2], ip[3],
+		    (ip[1] & ST_BLOCK_NEEDS_HOME) ? " home" : "");
+
+	    NEXT (ip);
+
+	case PUSH_NEW_ARRAY:
+	    printf (FORMAT (ip), ip[0], ip[1]);
+	    printf ("pushNewArray: %i", ip[1]);
+
+	    NEXT (ip);
+
+	case PUSH_REMOTE_TEMP:
+	    printf (FORMAT (ip), ip[0], ip[1], ip[2]);
+	    printf ("pushRemoteTemp: %i inVector: %i", ip[1], ip[2]);
+
+	    NEXT (ip);
+
+	case STORE_REMOTE_TEMP:
+	    printf (FORMAT (ip), ip[0], ip[1], ip[2]);
+	    printf ("storeRemoteTemp: %i inVector: %i", ip[1], ip[2]);
+
+	    NEXT (ip);
+
+	case STORE_POP_REMOTE_TEMP:
+	    printf (FORMAT (ip), ip[0], ip[1], ip[2]);
+	    printf ("popIntoRemoteTemp: %i inVector: %i", ip[1], ip[2]);
+
+	    NEXT (ip);
+
+	case PUSH_CLEAN_BLOCK:
 	    printf (FORMAT (ip), ip[0], ip[1]);
-	    printf ("blockCopy: %i", ip[1]);
+	    printf ("pushCleanBlock: %i", ip[1]);
 
 	    NEXT (ip);
 
@@ -1630,6 +3065,16 @@ print_bytecodes (st_oop literals, st_uchar *codes, int len)
 
 	    NEXT (ip);
 
+	case BRANCH_LT:
+	case BRANCH_GT:
+	case BRANCH_LE:
+	case BRANCH_GE:
+
+	    printf (FORMAT (ip), ip[0]);
+	    printf ("branch: #%s", st_byte_array_bytes (__machine.selectors[ip[0] - BRANCH_LT + SEND_LT - SEND_PLUS]));
+
+	    NEXT (ip);
+
 	}
 	printf ("\n");
     }
@@ -1690,6 +3135,7 @@ st_print_method (st_oop method)
     printf ("flags: %i; ", st_method_get_flags (method));
     printf ("arg-count: %i; ", st_method_get_arg_count (method));
     printf ("temp-count: %i; ", st_method_get_temp_count (method));
+    printf ("stack-size: %i; ", st_method_get_stack_size (method));
     printf ("primitive: %i;\n", st_method_get_primitive_index (method));
     
     printf ("\n");
@@ -41,7 +41,7 @@ typedef struct marker
 
 struct st_input
 {
-    char *text;
+    const char *text;
 
     st_uint p;	    /* current index into text */
 
@@ -50,82 +50,70 @@ struct st_input
     st_uint column;   /* current column number, starting from 1 */
 
     marker marker;
-};
-
-static char *
-filter_double_bangs (const char *chunk)
-{
-    st_uint size, i = 0, count = 0;
-    const char *p = chunk;
-    char *buf;
-
-    size = strlen (chunk);
 
-    if (size < 2)
-	return st_strdup (chunk);
-
-    /* count number of redundant bangs */
-    while (p[0] && p[1]) {
-	if (ST_UNLIKELY (p[0] == '!' && p[1] == '!'))
-	    count++;
-	p++;
-    }
-    
-    buf = st_malloc (size - count + 1);
-
-    /* copy over text skipping over redundant bangs */
-    p = chunk;
-    while (*p) {
-	if (*p == '!')
-	    p++;
-	buf[i++] = *p;
-	p++;
-    }
-    buf[i] = 0;
+    bool owns_text;  /* text is freed along with the input */
+    bool escaped;    /* text is a chunk containing doubled bangs */
+};
 
-    return buf;
-}
+static st_input *input_new (const char *text, st_uint length, bool owns_text);
 
-char *
+/*
+ * Returns a view onto the next chunk of input, which is terminated by
+ * a single bang. The chunk shares the text of its parent, so the parent
+ * must outlive it. Doubled bangs are left in place and are skipped over
+ * when the chunk is consumed.
+ */
+st_input *
 st_input_next_chunk (st_input *input)
 {
-    char *chunk_filtered, *chunk = NULL;
+    st_input *chunk;
     st_uint start;
+    bool escaped = false;
+
+    st_assert (input != NULL);
 
-    start = st_input_index (input);
+    start = input->p;
 
-    while (st_input_look_ahead (input, 1) != ST_INPUT_EOF) {
+    while (input->p < input->n) {
 
-	if (st_input_look_ahead (input, 1) != '!') {
+	if (input->text[input->p] != '!') {
 	    st_input_consume (input);
 	    continue;
 	}
-	
+
 	/* skip past doubled bangs */
-	if (st_input_look_ahead (input, 1) == '!'
-	    && st_input_look_ahead (input, 2) == '!') {
-	    st_input_consume (input);
-	    st_input_consume (input);
+	if (input->p + 1 < input->n && input->text[input->p + 1] == '!') {
+	    escaped = true;
+	    input->p += 2;
+	    input->column += 2;
 	    continue;
 	}
 
-	chunk = st_input_range (input, start, st_input_index (input));	
-	chunk_filtered = filter_double_bangs (chunk);
+	chunk = input_new (input->text + start, input->p - start, false);
+	chunk->escaped = escaped;
 	st_input_consume (input);
-	st_free (chunk);	
 
-	return chunk_filtered;
+	return chunk;
     }
 
     return NULL;
 }
 
+bool
+st_input_is_escaped (st_input *input)
+{
+    st_assert (input != NULL);
+
+    return input->escaped;
+}
+
 void
 st_input_destroy (st_input *input)
 {
     st_assert (input != NULL);
 
-    st_free (input->text);
+    if (input->owns_text)
+	st_free ((char *) input->text);
     st_free (input);
 }
 
@@ -160,6 +148,17 @@ st_input_look_ahead (st_input *input, int i)
 	    return ST_INPUT_EOF;
     }
 
+    if (ST_UNLIKELY (input->escaped && i > 1)) {
+	st_uint p = input->p;
+	
+	/* a doubled bang reads as a single char */
+	while (--i > 0 && p < input->n)
+	    p += (input->text[p] == '!') ? 2 : 1;
+	if (p >= input->n)
+	    return ST_INPUT_EOF;
+	return input->text[p];
+    }
+
     if ((input->p + i - 1) >= input->n) {
 	return ST_INPUT_EOF;
     }
@@ -216,6 +215,9 @@ st_input_consume (st_input *input)
 	    input->column = 1;
 	}
 
+	if (ST_UNLIKELY (input->escaped && input->text[input->p] == '!'))
+	    input->p++;
+
 	input->p++;
     }
 }
@@ -244,6 +246,14 @@ st_input_range (st_input *input, st_uint start, st_uint end)
     return buf;
 }
 
+const char *
+st_input_text (st_input *input)
+{
+    st_assert (input != NULL);
+
+    return input->text;
+}
+
 st_uint
 st_input_index (st_input *input)
 {
@@ -253,10 +263,10 @@ st_input_index (st_input *input)
 }
 
 static void
-initialize_state (st_input *input, const char *string)
+initialize_state (st_input *input, const char *text, st_uint length)
 {
-    input->text    = (char *) string;
-    input->n       = strlen (string);
+    input->text    = text;
+    input->n       = length;
     input->line    = 1;
     input->column  = 1;
 
@@ -265,17 +275,35 @@ initialize_state (st_input *input, const char *string)
     input->marker.column = 0;
 }
 
-st_input *
-st_input_new (const char *string)
+static st_input *
+input_new (const char *text, st_uint length, bool owns_text)
 {
     st_input *input;
 
-    st_assert (string != NULL);
-
     input = st_new0 (st_input);
 
-    initialize_state (input, strdup (string));    
+    initialize_state (input, text, length);
+    input->owns_text = owns_text;
 
     return input;
 }
 
+st_input *
+st_input_new (const char *string)
+{
+    st_assert (string != NULL);
+
+    return input_new (st_strdup (string), strlen (string), true);
+}
+
+/*
+ * Creates an input over `length' chars of `text' without copying it.
+ * The text need not be NUL-terminated, but must outlive the input.
+ */
+st_input *
+st_input_new_static (const char *text, st_uint length)
+{
+    st_assert (text != NULL);
+
+    return input_new (text, length, false);
+}
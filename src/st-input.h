@@ -37,6 +37,8 @@ enum
 
 st_input   *st_input_new          (const char *string);
 
+st_input   *st_input_new_static   (const char *text, st_uint length);
+
 char       st_input_look_ahead   (st_input *input, int i);
 
 st_uint    st_input_get_line     (st_input *input);
@@ -57,7 +59,11 @@ st_uint    st_input_index        (st_input *input);
 
 char      *st_input_range        (st_input *input, st_uint start, st_uint end);
 
-char      *st_input_next_chunk   (st_input *input);
+const char *st_input_text        (st_input *input);
+
+st_input  *st_input_next_chunk   (st_input *input);
+
+bool       st_input_is_escaped   (st_input *input);
 
 void       st_input_destroy      (st_input *input);
 
@@ -24,13 +24,12 @@
 
 /* Notes:
  *
- * we expand utf8-encoded text to ucs4 format and then lex it. Yes it's a bit
- * inefficient, but more straightforward than munging around with
- * multi-byte characters.
+ * utf8-encoded text is lexed byte by byte, without any decoding.
  *
  * Character input is supplied by the st_input object. It keeps track of
  * line/column numbers and has the ability to mark() and rewind() on the
- * input stream.
+ * input stream. File-in chunks are lexed in place; doubled bangs are
+ * skipped by the input and collapsed when token text is copied out.
  *
  */
 
@@ -91,8 +90,8 @@ struct st_lexer
     st_uint   error_column;
     char      error_char;
 
-    /* delayed deallocation */
-    st_list *allocated_tokens;
+    /* tokens and their text, released in one go by st_lexer_destroy() */
+    st_arena *arena;
 };
 
 struct st_token
@@ -115,6 +114,30 @@ struct st_token
     };
 };
 
+static char *
+range (st_lexer *lexer, st_uint start, st_uint end)
+{
+    const char *text;
+    char *buf;
+    st_uint i, j;
+
+    text = st_input_text (lexer->input);
+
+    if (ST_LIKELY (!st_input_is_escaped (lexer->input)))
+	return st_arena_strndup (lexer->arena, text + start, end - start);
+
+    /* collapse doubled bangs while copying out of a file-in chunk */
+    buf = st_arena_alloc (lexer->arena, end - start + 1);
+    for (i = start, j = 0; i < end; i++) {
+	buf[j++] = text[i];
+	if (text[i] == '!' && (i + 1) < end && text[i + 1] == '!')
+	    i++;
+    }
+    buf[j] = 0;
+
+    return buf;
+}
+
 static void
 make_token (st_lexer      *lexer,
 	    st_token_type  type,
@@ -122,19 +145,16 @@ make_token (st_lexer      *lexer,
 {
     st_token *token;
  
-    token = st_new0 (st_token);
+    token = st_arena_new0 (lexer->arena, st_token);
 
     token->type   = type;
-    token->text   = text ? text : st_strdup ("");
+    token->text   = text ? text : (char *) "";
     token->type   = type;
     token->line   = lexer->line;
     token->column = lexer->column;
 
     lexer->token = token;
     lexer->token_matched = true;
-
-
-    lexer->allocated_tokens = st_list_prepend (lexer->allocated_tokens, token);
 }
 
 static void
@@ -142,7 +162,7 @@ make_number_token (st_lexer *lexer, int radix, int exponent, char *number, bool
 {
     st_token *token;
 
-    token = st_new0 (st_token);
+    token = st_arena_new0 (lexer->arena, st_token);
 
     token->type   = ST_TOKEN_NUMBER_CONST;
     token->line   = lexer->line;
@@ -155,8 +175,6 @@ make_number_token (st_lexer *lexer, int radix, int exponent, char *number, bool
 
     lexer->token = token;
     lexer->token_matched = true;
-
-    lexer->allocated_tokens = st_list_prepend (lexer->allocated_tokens, token);
 }
 
 static void
@@ -268,11 +286,8 @@ match_number (st_lexer *lexer)
 	    
     } else {
     
-	string = st_input_range (lexer->input, k,
-				 st_input_index (lexer->input));
-				       			
+	string = range (lexer, k, st_input_index (lexer->input));
 	radix = strtol (string, NULL, 10);
-	st_free (string);
 	if (radix < 2 || radix > 36) {
 	    raise_error (lexer, ERROR_INVALID_RADIX, lookahead (lexer, 1));
 	}
@@ -316,16 +331,14 @@ out1:
 	if (l == st_input_index (lexer->input))
 	    goto out2;
 	
-	string = st_input_range (lexer->input, l,
-				 st_input_index (lexer->input));				    
+	string = range (lexer, l, st_input_index (lexer->input));
 	exponent = strtol (string, NULL, 10);
-	st_free (string);
     }
     
 out2:
     
     make_number_token (lexer, radix, exponent,
-		       st_input_range (lexer->input, k, j),
+		       range (lexer, k, j),
 		       negative);
 }
 
@@ -352,8 +365,7 @@ match_identifier (st_lexer *lexer, bool create_token)
 
     if (create_token) {
 	make_token (lexer, ST_TOKEN_IDENTIFIER,
-		    st_input_range (lexer->input, lexer->start,
-				    st_input_index (lexer->input)));
+		    range (lexer, lexer->start, st_input_index (lexer->input)));
     }
 }
 
@@ -391,11 +403,9 @@ match_keyword_or_identifier (st_lexer *lexer, bool create_token)
 	char *text;
 
 	if (token_type == ST_TOKEN_KEYWORD_SELECTOR)
-	    text = st_input_range (lexer->input, lexer->start,
-				   st_input_index (lexer->input));
+	    text = range (lexer, lexer->start, st_input_index (lexer->input));
 	else
-	    text = st_input_range (lexer->input, lexer->start,
-				   st_input_index (lexer->input));
+	    text = range (lexer, lexer->start, st_input_index (lexer->input));
 
 	make_token (lexer, token_type, text);
     }
@@ -422,9 +432,7 @@ match_string_constant (st_lexer *lexer)
 
     char *string;
 
-    string = st_input_range (lexer->input,
-			     lexer->start + 1,
-			     st_input_index (lexer->input) - 1);
+    string = range (lexer, lexer->start + 1, st_input_index (lexer->input) - 1);
 
     make_token (lexer, ST_TOKEN_STRING_CONST, string);
 }
@@ -451,9 +459,7 @@ match_comment (st_lexer *lexer)
 	
 	char *comment;
 
-	comment = st_input_range (lexer->input,
-				  lexer->start + 1,
-				  st_input_index (lexer->input) - 1);
+	comment = range (lexer, lexer->start + 1, st_input_index (lexer->input) - 1);
     
 	make_token (lexer, ST_TOKEN_COMMENT, comment);
     }
@@ -466,7 +472,7 @@ match_tuple_begin (st_lexer *lexer)
     match (lexer, '#');
     match (lexer, '(');
 
-    make_token (lexer, ST_TOKEN_TUPLE_BEGIN, st_strdup ("#("));
+    make_token (lexer, ST_TOKEN_TUPLE_BEGIN, st_arena_strdup (lexer->arena, "#("));
 }
 
 static void
@@ -490,9 +496,7 @@ match_binary_selector (st_lexer *lexer, bool create_token)
 
     if (create_token) {
 	make_token (lexer, ST_TOKEN_BINARY_SELECTOR,
-		    st_input_range (lexer->input,
-				    lexer->start,
-				    st_input_index (lexer->input)));
+		    range (lexer, lexer->start, st_input_index (lexer->input)));
     }
 }
 
@@ -514,9 +518,7 @@ match_symbol_constant (st_lexer *lexer)
     }
 
     // discard #
-    char *symbol_text = st_input_range (lexer->input,
-					lexer->start + 1,
-					st_input_index (lexer->input));
+    char *symbol_text = range (lexer, lexer->start + 1, st_input_index (lexer->input));
 
     make_token (lexer, ST_TOKEN_SYMBOL_CONST, symbol_text);
 }
@@ -585,9 +587,8 @@ match_char_constant (st_lexer *lexer)
 		consume (lexer);
 	    } while (isxdigit (lookahead (lexer, 1)));
 	
-	    char *string = st_input_range (lexer->input, start, st_input_index (lexer->input));
+	    char *string = range (lexer, start, st_input_index (lexer->input));
 	    ch = strtol (string, NULL, 16);
-	    st_free (string);
 	   
 	} else {
 	    // just match the '\' char then
@@ -602,9 +603,9 @@ match_char_constant (st_lexer *lexer)
 	raise_error (lexer, ERROR_INVALID_CHAR_CONST, lookahead (lexer, 1));
     }
 
-    char outbuf[6];
+    char outbuf[6] = { 0 };
     st_unichar_to_utf8 (ch, outbuf);
-    make_token (lexer, ST_TOKEN_CHARACTER_CONST, st_strdup (outbuf));
+    make_token (lexer, ST_TOKEN_CHARACTER_CONST, st_arena_strdup (lexer->arena, outbuf));
 }
 
 static void
@@ -807,7 +808,7 @@ lexer_initialize (st_lexer *lexer, st_input *input)
     lexer->failed = false;
     lexer->filter_comments = true;
 
-    lexer->allocated_tokens = NULL;
+    lexer->arena = st_arena_new ();
 }
 
 st_lexer *
@@ -828,15 +829,22 @@ st_lexer_new (const char *string)
     return lexer;
 }
 
-void
-destroy_token (st_token *token)
+/*
+ * Creates a lexer which reads from `input' directly. The lexer takes
+ * ownership of the input.
+ */
+st_lexer *
+st_lexer_new_for_input (st_input *input)
 {
-    if (token->type != ST_TOKEN_NUMBER_CONST)
-	st_free (token->text);
-    else
-	st_free (token->number);	
+    st_lexer *lexer;
+
+    st_assert (input != NULL);
+
+    lexer = st_new0 (st_lexer);
+
+    lexer_initialize (lexer, input);
 
-    st_free (token);
+    return lexer;
 }
 
 void
@@ -846,12 +854,23 @@ st_lexer_destroy (st_lexer *lexer)
 
     st_input_destroy (lexer->input);
 
-    st_list_foreach (lexer->allocated_tokens, (st_list_foreach_func) destroy_token);
-    st_list_destroy (lexer->allocated_tokens);
+    st_arena_destroy (lexer->arena);
 
     st_free (lexer);
 }
 
+/*
+ * The arena holds all tokens of the lexer. The parser allocates its
+ * syntax tree from it too, so the tree lives as long as the lexer.
+ */
+st_arena *
+st_lexer_get_arena (st_lexer *lexer)
+{
+    st_assert (lexer != NULL);
+
+    return lexer->arena;
+}
+
 st_token_type
 st_token_get_type (st_token *token)
 {
@@ -27,6 +27,8 @@
 
 #include <stdbool.h>
 #include <st-types.h>
+#include <st-utils.h>
+#include <st-input.h>
 
 typedef struct st_lexer  st_lexer;
 typedef struct st_token  st_token;
@@ -59,6 +61,7 @@ typedef enum
 
  
 st_lexer     *st_lexer_new           (const char *string);
+st_lexer     *st_lexer_new_for_input (st_input *input);
 st_token    *st_lexer_next_token    (st_lexer *lexer);
 st_token    *st_lexer_current_token (st_lexer *lexer);
 void         st_lexer_destroy       (st_lexer *lexer);
@@ -67,6 +70,7 @@ st_uint      st_lexer_error_line    (st_lexer *lexer);
 st_uint      st_lexer_error_column  (st_lexer *lexer);
 char        *st_lexer_error_message (st_lexer *lexer);
 void         st_lexer_filter_comments (st_lexer *lexer, bool filter);
+st_arena    *st_lexer_get_arena     (st_lexer *lexer);
 
 
 st_token_type    st_token_get_type   (st_token *token);
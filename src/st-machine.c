@@ -34,7 +34,10 @@
 #include "st-method.h"
 #include "st-array.h"
 #include "st-association.h"
+#include "st-character.h"
+#include "st-float.h"
 #include "st-memory.h"
+#include "st-process.h"
 
 #include <stdlib.h>
 #include <setjmp.h>
@@ -43,17 +46,25 @@
 #define HAVE_COMPUTED_GOTO
 #endif
 
+ST_THREAD_LOCAL st_machine __machine;
+
 static inline st_oop
 method_context_new (st_machine *machine)
 {
     st_oop  context;
     st_uint temp_count;
+    st_uint stack_size;
     st_oop *stack;
-    bool    large;
 
     temp_count = st_method_get_arg_count (machine->new_method) + st_method_get_temp_count (machine->new_method);
+    stack_size = st_method_get_stack_size (machine->new_method);
 
-    context = st_memory_allocate_context ();
+    /* the free list is checked here first, saving a call on most sends */
+    context = memory->free_contexts[stack_size];
+    if (ST_LIKELY (context))
+	memory->free_contexts[stack_size] = ST_CONTEXT_PART_SENDER (context);
+    else
+	context = st_memory_allocate_context (ST_METHOD_CONTEXT_CLASS, stack_size);
 
     ST_CONTEXT_PART_SENDER (context)     = machine->context;
     ST_CONTEXT_PART_IP (context)         = st_smi_new (0);
@@ -69,40 +80,38 @@ method_context_new (st_machine *machine)
     return context;
 }
 
+/* creates a closure for the block whose code starts at `initial_ip',
+ * taking the values it copies from the stack */
 static st_oop
-block_context_new (st_machine *machine, st_uint initial_ip, st_uint argcount)
+block_closure_new (st_machine *machine, st_uint initial_ip, st_uint flags,
+		   st_uint stack_size, st_uint copied_count)
 {
+    st_oop  closure;
     st_oop  home;
-    st_oop  context;
-    st_oop  method;
-    st_oop *stack;
-    st_uint stack_size;
 
-    stack_size = 32;
-    
-    context = st_memory_allocate (ST_SIZE_OOPS (struct st_block_context) + stack_size);
-    if (context == 0) {
-	st_memory_perform_gc ();
-	context = st_memory_allocate (ST_SIZE_OOPS (struct st_block_context) + stack_size);
-	st_assert (context != 0);
+    closure = st_memory_allocate_closure (copied_count, stack_size);
+
+    home = ST_NIL;
+    if (flags & ST_BLOCK_NEEDS_HOME) {
+	if (ST_OBJECT_CLASS (machine->context) == ST_BLOCK_CONTEXT_CLASS)
+	    home = ST_BLOCK_CLOSURE_OUTER_CONTEXT (ST_BLOCK_CONTEXT_CLOSURE (machine->context));
+	else
+	    home = machine->context;
+	st_context_set_captured (home);
     }
 
-    st_object_initialize_header (context, ST_BLOCK_CONTEXT_CLASS);
-    
-    if (ST_OBJECT_CLASS (machine->context) == ST_BLOCK_CONTEXT_CLASS)
-	home = ST_BLOCK_CONTEXT_HOME (machine->context);
-    else
-	home = machine->context;
+    ST_BLOCK_CLOSURE_OUTER_CONTEXT (closure) = home;
+    ST_BLOCK_CLOSURE_METHOD (closure)        = machine->method;
+    ST_BLOCK_CLOSURE_RECEIVER (closure)      = machine->receiver;
+    ST_BLOCK_CLOSURE_INITIALIP (closure)     = st_smi_new (initial_ip);
+    ST_BLOCK_CLOSURE_ARGCOUNT (closure)      = st_smi_new (flags & ~ST_BLOCK_NEEDS_HOME);
 
-    ST_CONTEXT_PART_SENDER (context) = ST_NIL;
-    ST_CONTEXT_PART_IP (context)     = st_smi_new (0);
-    ST_CONTEXT_PART_SP (context)     = st_smi_new (0);
+    /* rarely more than a few, not worth a call to memcpy() */
+    machine->sp -= copied_count;
+    for (st_uint i = 0; i < copied_count; i++)
+	ST_BLOCK_CLOSURE_COPIED (closure)[i] = machine->stack[machine->sp + i];
 
-    ST_BLOCK_CONTEXT_INITIALIP (context) = st_smi_new (initial_ip);
-    ST_BLOCK_CONTEXT_ARGCOUNT (context)  = st_smi_new (argcount);
-    ST_BLOCK_CONTEXT_HOME (context)      = home;
-    
-    return context;
+    return closure;
 }
 
 static void
@@ -157,8 +166,12 @@ lookup_method (st_machine *machine, st_oop class)
 	    el = st_array_at (ST_OBJECT_FIELDS (dict)[2], i);
 	    if (el == ST_NIL || el == (uintptr_t) ST_OBJECT_FIELDS (dict)[2])
 		break;
-	    if (machine->message_selector == ST_ASSOCIATION_KEY (el))
-		return ST_ASSOCIATION_VALUE (el);
+	    if (machine->message_selector == ST_ASSOCIATION_KEY (el)) {
+		method = ST_ASSOCIATION_VALUE (el);
+		if (ST_UNLIKELY (st_method_get_flags (method) == ST_METHOD_LAZY))
+		    method = st_compile_method_stub (parent, method);
+		return method;
+	    }
 	    i = ((i + ST_ADVANCE_SIZE) & mask) + 1;
 	}
 
@@ -227,26 +240,21 @@ st_machine_execute_method (st_machine *machine)
 void
 st_machine_set_active_context (st_machine *machine, st_oop context)
 {	 
-    st_oop home;
-
     /* save executation state of active context */
     if (ST_UNLIKELY (machine->context != ST_NIL)) {
 	ST_CONTEXT_PART_IP (machine->context) = st_smi_new (machine->ip);
 	ST_CONTEXT_PART_SP (machine->context) = st_smi_new (machine->sp);
     }
-    
-    if (ST_OBJECT_CLASS (context) == ST_BLOCK_CONTEXT_CLASS) {
-	home = ST_BLOCK_CONTEXT_HOME (context);
-	machine->method   = ST_METHOD_CONTEXT_METHOD (home);
-	machine->receiver = ST_METHOD_CONTEXT_RECEIVER (home);
-	machine->temps    = ST_METHOD_CONTEXT_STACK (home);
-	machine->stack    = ST_BLOCK_CONTEXT_STACK (context);
-    } else {
-	machine->method   = ST_METHOD_CONTEXT_METHOD (context);
-	machine->receiver = ST_METHOD_CONTEXT_RECEIVER (context);
-	machine->temps    = ST_METHOD_CONTEXT_STACK (context);
-	machine->stack    = ST_METHOD_CONTEXT_STACK (context);
-    }
+
+    /* a block context has its method and receiver in the same
+       place as a method context, but a larger header */
+    machine->method   = ST_METHOD_CONTEXT_METHOD (context);
+    machine->receiver = ST_METHOD_CONTEXT_RECEIVER (context);
+    if (ST_OBJECT_CLASS (context) == ST_BLOCK_CONTEXT_CLASS)
+	machine->temps = ST_BLOCK_CONTEXT_STACK (context);
+    else
+	machine->temps = ST_METHOD_CONTEXT_STACK (context);
+    machine->stack    = machine->temps;
 
     machine->context  = context;
     machine->sp       = st_smi_value (ST_CONTEXT_PART_SP (context));
@@ -254,10 +262,88 @@ st_machine_set_active_context (st_machine *machine, st_oop context)
     machine->bytecode = st_method_bytecode_bytes (machine->method);
 }
 
+/* ends a context which is being returned from. A captured context is
+ * marked as dead, any other is recycled */
+static inline void
+end_context (st_machine *machine, st_oop context)
+{
+    if (ST_UNLIKELY (st_context_is_captured (context))) {
+	ST_CONTEXT_PART_SENDER (context) = ST_NIL;
+	if (ST_UNLIKELY (st_context_is_unwind (context))) {
+	    st_context_set_unwind (context, false);
+	    machine->unwind_count--;
+	}
+    } else {
+	st_memory_recycle_context (context);
+    }
+}
+
+/* ends the contexts from the active context up to, but excluding, `context' */
+static void
+end_contexts_above (st_machine *machine, st_oop context)
+{
+    st_oop current;
+    st_oop next;
+
+    current = machine->context;
+    while (current != context && current != ST_NIL) {
+	next = ST_CONTEXT_PART_SENDER (current);
+	end_context (machine, current);
+	current = next;
+    }
+}
+
+/* Returns `value' from `home' to its sender, ending every context
+ * between the active context and `home' on the way.
+ */
+void
+st_machine_return_from (st_machine *machine, st_oop home, st_oop value)
+{
+    st_oop sender;
+
+    sender = ST_CONTEXT_PART_SENDER (home);
+
+    end_contexts_above (machine, home);
+    end_context (machine, home);
+
+    st_machine_set_active_context (machine, sender);
+    ST_STACK_PUSH (machine, value);
+}
+
+/* Restarts the method context `context' from its first instruction,
+ * ending every context above it.
+ */
+void
+st_machine_restart (st_machine *machine, st_oop context)
+{
+    st_oop  method;
+    st_uint arg_count;
+    st_uint temp_count;
+    st_oop *stack;
+
+    end_contexts_above (machine, context);
+
+    method = ST_METHOD_CONTEXT_METHOD (context);
+    arg_count = st_method_get_arg_count (method);
+    temp_count = arg_count + st_method_get_temp_count (method);
+
+    stack = ST_METHOD_CONTEXT_STACK (context);
+    for (st_uint i = arg_count; i < temp_count; i++)
+	stack[i] = ST_NIL;
+
+    ST_CONTEXT_PART_IP (context) = st_smi_new (0);
+    ST_CONTEXT_PART_SP (context) = st_smi_new (temp_count);
+
+    /* the registers are not saved, `context' may be the active context */
+    machine->context = ST_NIL;
+    st_machine_set_active_context (machine, context);
+}
+
 #define SEND_SELECTOR(selector, argcount)				\
     machine->message_argcount = argcount;				\
     machine->message_receiver = sp[- argcount - 1];			\
     machine->message_selector = selector;				\
+    machine->lookup_class = st_object_class (machine->message_receiver); \
     goto send_common;
               
 #define SEND_TEMPLATE()							\
@@ -319,7 +405,15 @@ static const st_pointer labels[] =					\
     && SEND_CLASS,							\
     && SEND_NEW,							\
     && SEND_NEW_ARG,							\
-    && INVALID, && INVALID, && INVALID, && INVALID, && INVALID,         \
+    && BRANCH_LT,							\
+    && BRANCH_GT,							\
+    && BRANCH_LE,							\
+    && BRANCH_GE,							\
+    && PUSH_CLEAN_BLOCK,						\
+    && PUSH_NEW_ARRAY,							\
+    && PUSH_REMOTE_TEMP,						\
+    && STORE_REMOTE_TEMP,						\
+    && STORE_POP_REMOTE_TEMP,						\
     && INVALID, && INVALID, && INVALID, && INVALID, && INVALID,         \
     && INVALID, && INVALID, && INVALID, && INVALID, && INVALID,         \
     && INVALID, && INVALID, && INVALID, && INVALID, && INVALID,         \
@@ -359,8 +453,7 @@ static const st_pointer labels[] =					\
     && INVALID, && INVALID, && INVALID, && INVALID, && INVALID,         \
     && INVALID, && INVALID, && INVALID, && INVALID, && INVALID,         \
     && INVALID, && INVALID, && INVALID, && INVALID, && INVALID,         \
-    && INVALID, && INVALID, && INVALID, && INVALID, && INVALID,		\
-    && INVALID,								\
+    && INVALID, && INVALID,						\
 };									\
 goto *labels[*ip];
 #else
@@ -408,10 +501,149 @@ lookup_method_in_cache (st_machine  *machine)
     return false;
 }
 
+/*
+ * Inline versions of the #at:, #at:put: and #size primitives for the
+ * indexable kernel classes. Only exact instances of those classes are
+ * handled, as subclasses may override the accessors, and none are once
+ * the accessors are redefined for those classes. These return false
+ * whenever the full send is needed, for example for an index which is
+ * out of bounds or not a SmallInteger.
+ */
+static inline bool
+index_in_bounds (st_oop object, st_oop index)
+{
+    return st_object_is_smi (index)
+	&& st_smi_value (index) >= 1
+	&& st_smi_value (index) <= st_smi_value (st_arrayed_object_size (object));
+}
+
+static inline bool
+inline_at (st_oop receiver, st_oop index, st_oop *result)
+{
+    st_oop class;
+    int    i;
+
+    if (!st_object_is_heap (receiver) || !index_in_bounds (receiver, index))
+	return false;
+
+    class = ST_OBJECT_CLASS (receiver);
+    i = st_smi_value (index);
+
+    switch (st_object_format (receiver)) {
+
+    case ST_FORMAT_ARRAY:
+	if (class != ST_ARRAY_CLASS)
+	    return false;
+	*result = st_array_at (receiver, i);
+	return true;
+
+    case ST_FORMAT_BYTE_ARRAY:
+	if (class == ST_BYTE_ARRAY_CLASS)
+	    *result = st_smi_new (st_byte_array_at (receiver, i));
+	else if (class == ST_STRING_CLASS || class == ST_SYMBOL_CLASS)
+	    *result = st_character_new (st_byte_array_at (receiver, i));
+	else
+	    return false;
+	return true;
+
+    case ST_FORMAT_WORD_ARRAY:
+	if (class != ST_WORD_ARRAY_CLASS)
+	    return false;
+	*result = st_smi_new (st_word_array_at (receiver, i));
+	return true;
+
+    case ST_FORMAT_MAPPED_BYTES:
+	if (class != ST_MAPPED_FILE_CLASS)
+	    return false;
+	*result = st_smi_new (st_mapped_bytes (receiver)[i - 1]);
+	return true;
+
+    default:
+	return false;
+    }
+}
+
+static inline bool
+inline_at_put (st_oop receiver, st_oop index, st_oop value)
+{
+    st_oop class;
+    int    i;
+
+    if (!st_object_is_heap (receiver) || !index_in_bounds (receiver, index))
+	return false;
+
+    class = ST_OBJECT_CLASS (receiver);
+    i = st_smi_value (index);
+
+    switch (st_object_format (receiver)) {
+
+    case ST_FORMAT_ARRAY:
+	if (class != ST_ARRAY_CLASS)
+	    return false;
+	st_array_at_put (receiver, i, value);
+	return true;
+
+    case ST_FORMAT_BYTE_ARRAY:
+	if (class == ST_BYTE_ARRAY_CLASS && st_object_is_smi (value)
+	    && st_smi_value (value) >= 0 && st_smi_value (value) <= 255)
+	    st_byte_array_at_put (receiver, i, st_smi_value (value));
+	else if (class == ST_STRING_CLASS && st_object_is_character (value)
+		 && st_character_value (value) <= 255)
+	    st_byte_array_at_put (receiver, i, st_character_value (value));
+	else
+	    return false;
+	return true;
+
+    case ST_FORMAT_WORD_ARRAY:
+	if (class != ST_WORD_ARRAY_CLASS || !st_object_is_smi (value))
+	    return false;
+	st_word_array_at_put (receiver, i, st_smi_value (value));
+	return true;
+
+    case ST_FORMAT_FLOAT_ARRAY:
+	if (class != ST_FLOAT_ARRAY_CLASS || !st_object_is_heap (value)
+	    || st_object_format (value) != ST_FORMAT_FLOAT)
+	    return false;
+	st_float_array_at_put (receiver, i, st_float_value (value));
+	return true;
+
+    default:
+	return false;
+    }
+}
+
+static inline bool
+inline_size (st_oop receiver, st_oop *result)
+{
+    st_oop class;
+
+    if (!st_object_is_heap (receiver))
+	return false;
+
+    class = ST_OBJECT_CLASS (receiver);
+
+    if (class == ST_ARRAY_CLASS || class == ST_BYTE_ARRAY_CLASS
+	|| class == ST_STRING_CLASS || class == ST_SYMBOL_CLASS
+	|| class == ST_WORD_ARRAY_CLASS || class == ST_FLOAT_ARRAY_CLASS
+	|| class == ST_MAPPED_FILE_CLASS) {
+	*result = st_arrayed_object_size (receiver);
+	return true;
+    }
+
+    return false;
+}
+
 #define STACK_POP(oop)     (*--sp)
 #define STACK_PUSH(oop)    (*sp++ = (oop))
 #define STACK_PEEK(oop)    (*(sp-1))
 #define STACK_UNPOP(count) (sp += count)
+/* takes or skips the conditional jump following a BRANCH_* code */
+#define BRANCH(condition)						\
+    if ((ip[1] == JUMP_TRUE) == (condition))				\
+	ip += *((unsigned short *) (ip + 2)) + 4;			\
+    else								\
+	ip += 4;							\
+    NEXT ();
 #define STORE_REGISTERS()						\
     machine->ip = ip - machine->bytecode;				\
     machine->sp = sp - machine->stack;					\
@@ -542,6 +774,8 @@ st_machine_main (st_machine *machine)
 	
 	CASE (PUSH_ACTIVE_CONTEXT) {
     
+	    /* may outlive its activation now */
+	    st_context_set_captured (machine->context);
 	    STACK_PUSH (machine->context);
 	    
 	    ip += 1;
@@ -603,7 +837,17 @@ st_machine_main (st_machine *machine)
     
 	CASE (JUMP) {
 	    
-	    ip += *((short *) (ip + 1)) + 3;
+	    short offset = *((short *) (ip + 1));
+
+	    ip += offset + 3;
+
+	    /* a back-edge is a safe point to switch processes */
+	    if (ST_UNLIKELY (offset < 0 && ST_PROCESS_INTERRUPTED (machine))) {
+		STORE_REGISTERS ();
+		st_process_handle_interrupt (machine);
+		LOAD_REGISTERS ();
+	    }
+
 	    NEXT ();    
 	}
 	
@@ -891,6 +1135,82 @@ st_machine_main (st_machine *machine)
 
 	}
 	
+	CASE (BRANCH_LT) {
+
+	    st_oop a, b;
+
+	    if (ST_LIKELY (st_object_is_smi (sp[-1]) &&
+			   st_object_is_smi (sp[-2]))) {
+		b = STACK_POP ();
+		a = STACK_POP ();
+		BRANCH (st_smi_value (a) < st_smi_value (b));
+	    }
+
+	    machine->message_argcount = 1;
+	    machine->message_selector = ST_SELECTOR_LT;
+	    machine->message_receiver = sp[- machine->message_argcount - 1];
+	    machine->lookup_class = st_object_class (machine->message_receiver);
+	    ip += 1;
+	    goto send_common;
+	}
+
+	CASE (BRANCH_GT) {
+
+	    st_oop a, b;
+
+	    if (ST_LIKELY (st_object_is_smi (sp[-1]) &&
+			   st_object_is_smi (sp[-2]))) {
+		b = STACK_POP ();
+		a = STACK_POP ();
+		BRANCH (st_smi_value (a) > st_smi_value (b));
+	    }
+
+	    machine->message_argcount = 1;
+	    machine->message_selector = ST_SELECTOR_GT;
+	    machine->message_receiver = sp[- machine->message_argcount - 1];
+	    machine->lookup_class = st_object_class (machine->message_receiver);
+	    ip += 1;
+	    goto send_common;
+	}
+
+	CASE (BRANCH_LE) {
+
+	    st_oop a, b;
+
+	    if (ST_LIKELY (st_object_is_smi (sp[-1]) &&
+			   st_object_is_smi (sp[-2]))) {
+		b = STACK_POP ();
+		a = STACK_POP ();
+		BRANCH (st_smi_value (a) <= st_smi_value (b));
+	    }
+
+	    machine->message_argcount = 1;
+	    machine->message_selector = ST_SELECTOR_LE;
+	    machine->message_receiver = sp[- machine->message_argcount - 1];
+	    machine->lookup_class = st_object_class (machine->message_receiver);
+	    ip += 1;
+	    goto send_common;
+	}
+
+	CASE (BRANCH_GE) {
+
+	    st_oop a, b;
+
+	    if (ST_LIKELY (st_object_is_smi (sp[-1]) &&
+			   st_object_is_smi (sp[-2]))) {
+		b = STACK_POP ();
+		a = STACK_POP ();
+		BRANCH (st_smi_value (a) >= st_smi_value (b));
+	    }
+
+	    machine->message_argcount = 1;
+	    machine->message_selector = ST_SELECTOR_GE;
+	    machine->message_receiver = sp[- machine->message_argcount - 1];
+	    machine->lookup_class = st_object_class (machine->message_receiver);
+	    ip += 1;
+	    goto send_common;
+	}
+
 	CASE (SEND_CLASS) {
 
 	    machine->message_argcount = 0;
@@ -902,6 +1222,14 @@ st_machine_main (st_machine *machine)
 	}
 	
 	CASE (SEND_SIZE) {
+
+	    st_oop result;
+
+	    if (!machine->accessors_redefined && inline_size (sp[-1], &result)) {
+		sp[-1] = result;
+		ip += 1;
+		NEXT ();
+	    }
 	    
 	    machine->message_argcount = 0;
 	    machine->message_selector = ST_SELECTOR_SIZE;
@@ -913,6 +1241,28 @@ st_machine_main (st_machine *machine)
     
 	CASE (SEND_AT) {
 
+	    st_oop result;
+
+	    if (!machine->accessors_redefined && inline_at (sp[-2], sp[-1], &result)) {
+		sp -= 2;
+		STACK_PUSH (result);
+		ip += 1;
+		NEXT ();
+	    }
+
+	    /* a FloatArray element must be boxed */
+	    if (!machine->accessors_redefined && st_object_is_heap (sp[-2])
+		&& ST_OBJECT_CLASS (sp[-2]) == ST_FLOAT_ARRAY_CLASS
+		&& index_in_bounds (sp[-2], sp[-1])) {
+		STORE_REGISTERS ();
+		result = st_float_new (st_float_array_at (sp[-2], st_smi_value (sp[-1])));
+		LOAD_REGISTERS ();
+		sp -= 2;
+		STACK_PUSH (result);
+		ip += 1;
+		NEXT ();
+	    }
+
 	    machine->message_argcount = 1;
 	    machine->message_selector = ST_SELECTOR_AT;
 	    machine->message_receiver = sp[- machine->message_argcount - 1];
@@ -922,6 +1272,16 @@ st_machine_main (st_machine *machine)
 	}
     
 	CASE (SEND_AT_PUT) {
+
+	    st_oop value;
+
+	    value = sp[-1];
+	    if (!machine->accessors_redefined && inline_at_put (sp[-3], sp[-2], value)) {
+		sp -= 3;
+		STACK_PUSH (value);
+		ip += 1;
+		NEXT ();
+	    }
 	    
 	    machine->message_argcount = 2;
 	    machine->message_selector = ST_SELECTOR_ATPUT;
@@ -1009,6 +1369,7 @@ st_machine_main (st_machine *machine)
 	    st_method_flags flags;
 	    st_oop  context;
 	    st_oop *arguments;
+	    st_uint collections;
 
 	    machine->message_argcount = ip[1];
 	    machine->message_selector = st_array_elements (ST_METHOD_LITERALS (machine->method))[ip[2]];
@@ -1019,10 +1380,13 @@ st_machine_main (st_machine *machine)
 	send_common:
 
 	    if (!lookup_method_in_cache (machine)) {
+		collections = memory->collections;
 		STORE_REGISTERS ();
 		machine->new_method = lookup_method (machine, machine->lookup_class);
 		LOAD_REGISTERS ();
-		install_method_in_cache (machine);
+		/* a collection during the lookup leaves lookup_class stale */
+		if (collections == memory->collections)
+		    install_method_in_cache (machine);
 	    }
 	    
 	    flags = st_method_get_flags (machine->new_method);
@@ -1059,6 +1423,13 @@ st_machine_main (st_machine *machine)
 	    machine->message_receiver = ST_NIL;
 	    machine->message_selector = ST_NIL;
 
+	    /* and so is the start of a method */
+	    if (ST_UNLIKELY (ST_PROCESS_INTERRUPTED (machine))) {
+		STORE_REGISTERS ();
+		st_process_handle_interrupt (machine);
+		LOAD_REGISTERS ();
+	    }
+
 	    NEXT ();
 	}
 
@@ -1087,8 +1458,10 @@ st_machine_main (st_machine *machine)
 	}
 
 	CASE (DUPLICATE_STACK_TOP) {
-	    
-	    STACK_PUSH (STACK_PEEK ());
+
+	    /* STACK_PUSH (STACK_PEEK ()) would read and bump sp unsequenced */
+	    st_oop top = STACK_PEEK ();
+	    STACK_PUSH (top);
 	    
 	    ip += 1;
 	    NEXT ();
@@ -1097,16 +1470,17 @@ st_machine_main (st_machine *machine)
 	CASE (BLOCK_COPY) {
 	    
 	    st_oop block;
-	    st_oop home;
-	    st_uint argcount = ip[1];
+	    st_uint flags = ip[1];
+	    st_uint stack_size = ip[2];
+	    st_uint copied_count = ip[3];
 	    st_uint initial_ip;
 	    
-	    ip += 2;
+	    ip += 4;
 	    
 	    initial_ip = ip - machine->bytecode + 3;
 	    
 	    STORE_REGISTERS ();
-	    block = block_context_new (machine, initial_ip, argcount);
+	    block = block_closure_new (machine, initial_ip, flags, stack_size, copied_count);
 	    LOAD_REGISTERS ();
 
 	    STACK_PUSH (block);
@@ -1114,31 +1488,104 @@ st_machine_main (st_machine *machine)
 	    NEXT ();
 	}
 	
+	CASE (PUSH_CLEAN_BLOCK) {
+
+	    STACK_PUSH (st_array_elements (ST_METHOD_LITERALS (machine->method))[ip[1]]);
+
+	    ip += 2;
+	    NEXT ();
+	}
+
+	CASE (PUSH_NEW_ARRAY) {
+
+	    st_oop array;
+
+	    STORE_REGISTERS ();
+	    array = st_object_new_arrayed (ST_ARRAY_CLASS, ip[1]);
+	    LOAD_REGISTERS ();
+
+	    STACK_PUSH (array);
+
+	    ip += 2;
+	    NEXT ();
+	}
+
+	CASE (PUSH_REMOTE_TEMP) {
+
+	    STACK_PUSH (ST_ARRAY (machine->temps[ip[2]])->elements[ip[1]]);
+
+	    ip += 3;
+	    NEXT ();
+	}
+
+	CASE (STORE_REMOTE_TEMP) {
+
+	    ST_ARRAY (machine->temps[ip[2]])->elements[ip[1]] = STACK_PEEK ();
+
+	    ip += 3;
+	    NEXT ();
+	}
+
+	CASE (STORE_POP_REMOTE_TEMP) {
+
+	    ST_ARRAY (machine->temps[ip[2]])->elements[ip[1]] = STACK_POP ();
+
+	    ip += 3;
+	    NEXT ();
+	}
+
 	CASE (RETURN_STACK_TOP) {
 	    
+	    st_oop home;
 	    st_oop sender;
 	    st_oop value;
-	    st_oop home;
 	    
 	    value = STACK_PEEK ();
-	    
-	    if (ST_OBJECT_CLASS (machine->context) == ST_BLOCK_CONTEXT_CLASS)
-		sender = ST_CONTEXT_PART_SENDER (ST_BLOCK_CONTEXT_HOME (machine->context));
-	    else {
+
+	    if (ST_LIKELY (ST_OBJECT_CLASS (machine->context) != ST_BLOCK_CONTEXT_CLASS)) {
+
 		sender = ST_CONTEXT_PART_SENDER (machine->context);
-		st_memory_recycle_context (machine->context);
+		if (ST_UNLIKELY (sender == ST_NIL)) {
+		    STACK_PUSH (machine->context);
+		    STACK_PUSH (value);
+		    ip += 1;
+		    SEND_SELECTOR (ST_SELECTOR_CANNOTRETURN, 1);
+		    NEXT ();
+		}
+
+		end_context (machine, machine->context);
+
+		st_machine_set_active_context (machine, sender);
+		LOAD_REGISTERS ();
+		STACK_PUSH (value);
+		NEXT ();
 	    }
 
-	    if (ST_UNLIKELY (sender == ST_NIL)) {
+	    /* a ^ in a block returns from its home context. The home
+	       context has a nil sender once it has returned itself */
+	    home = ST_BLOCK_CLOSURE_OUTER_CONTEXT (ST_BLOCK_CONTEXT_CLOSURE (machine->context));
+	    if (ST_UNLIKELY (ST_CONTEXT_PART_SENDER (home) == ST_NIL)) {
 		STACK_PUSH (machine->context);
 		STACK_PUSH (value);
+		ip += 1;
 		SEND_SELECTOR (ST_SELECTOR_CANNOTRETURN, 1);
 		NEXT ();
-	    }		
+	    }
+
+	    /* unwind blocks on the way to the home context are run by
+	       ContextPart>>return:, only looked for if there are any */
+	    if (ST_UNLIKELY (machine->unwind_count > 0) &&
+		st_context_find_unwind (machine->context, home) != ST_NIL) {
+		STACK_PUSH (home);
+		STACK_PUSH (value);
+		ip += 1;
+		SEND_SELECTOR (ST_SELECTOR_RETURN, 1);
+		NEXT ();
+	    }
 
-	    st_machine_set_active_context (machine, sender);
+	    STORE_REGISTERS ();
+	    st_machine_return_from (machine, home, value);
 	    LOAD_REGISTERS ();
-	    STACK_PUSH (value);
 
 	    NEXT ();
 	}
@@ -1147,11 +1594,19 @@ st_machine_main (st_machine *machine)
 	    
 	    st_oop caller;
 	    st_oop value;
-	    st_oop home;
 	    
 	    caller = ST_CONTEXT_PART_SENDER (machine->context);
 	    value = STACK_PEEK ();
 
+	    /* recycled here directly, see block_context_new() in st-primitives.c */
+	    if (ST_UNLIKELY (st_context_is_captured (machine->context))) {
+		ST_CONTEXT_PART_SENDER (machine->context) = ST_NIL;
+	    } else {
+		st_uint stack_size = st_context_stack_size (machine->context);
+		ST_CONTEXT_PART_SENDER (machine->context) = memory->free_block_contexts[stack_size];
+		memory->free_block_contexts[stack_size] = machine->context;
+	    }
+
 	    st_machine_set_active_context (machine, caller);
 	    LOAD_REGISTERS ();
 	    STACK_PUSH (value);
@@ -1176,6 +1631,39 @@ st_machine_clear_caches (st_machine *machine)
     memset (machine->method_cache, 0, ST_METHOD_CACHE_SIZE * 3 * sizeof (st_oop));
 }
 
+static bool
+inherited_by_indexable_class (st_oop class)
+{
+    st_oop classes[] = { ST_ARRAY_CLASS, ST_BYTE_ARRAY_CLASS, ST_STRING_CLASS, ST_SYMBOL_CLASS,
+			 ST_WORD_ARRAY_CLASS, ST_FLOAT_ARRAY_CLASS, ST_MAPPED_FILE_CLASS };
+
+    for (st_uint i = 0; i < sizeof (classes) / sizeof (classes[0]); i++)
+	for (st_oop parent = classes[i]; parent != ST_NIL; parent = ST_BEHAVIOR_SUPERCLASS (parent))
+	    if (parent == class)
+		return true;
+    return false;
+}
+
+/*
+ * st_machine_method_changed:
+ * @class: The class into which a method was compiled.
+ * @selector: The selector of the method.
+ *
+ * Drops the cached lookups, which may find the method replaced. A
+ * redefinition of #at:, #at:put: or #size which the kernel classes
+ * with inline versions of those sends inherit turns the inline
+ * versions off for good.
+ */
+void
+st_machine_method_changed (st_machine *machine, st_oop class, st_oop selector)
+{
+    st_machine_clear_caches (machine);
+
+    if ((selector == ST_SELECTOR_AT || selector == ST_SELECTOR_ATPUT || selector == ST_SELECTOR_SIZE)
+	&& inherited_by_indexable_class (class))
+	machine->accessors_redefined = true;
+}
+
 void
 st_machine_initialize (st_machine *machine)
 {
@@ -1191,6 +1679,9 @@ st_machine_initialize (st_machine *machine)
     machine->ip = 0;
     machine->stack = NULL;
 
+    machine->unwind_count = 0;
+    machine->ticks = st_process_ticks;
+
     st_machine_clear_caches (machine);
 
     machine->message_argcount = 0;
@@ -27,6 +27,7 @@
 #define __ST_CPU_H__
 
 #include <st-types.h>
+#include <st-utils.h>
 #include <setjmp.h>
 
 /* cache size must be a power of 2 */
@@ -34,7 +35,7 @@
 #define ST_METHOD_CACHE_MASK      (ST_METHOD_CACHE_SIZE - 1)
 #define ST_METHOD_CACHE_HASH(k,s) ((k) ^ (s))
 
-#define ST_NUM_GLOBALS 36
+#define ST_NUM_GLOBALS 41
 #define ST_NUM_SELECTORS 24
 
 typedef struct st_method_cache
@@ -71,6 +72,9 @@ struct st_machine {
     st_uint ip;
     st_uint sp;
 
+    /* contexts marked for unwinding which may not have returned yet */
+    st_uint unwind_count;
+
     jmp_buf main_loop;
 
     st_method_cache method_cache[ST_METHOD_CACHE_SIZE];
@@ -78,7 +82,17 @@ struct st_machine {
     st_oop globals[ST_NUM_GLOBALS];
     st_oop selectors[ST_NUM_SELECTORS];
 
-} __machine;
+    /* the last time slice tick seen by this machine */
+    int ticks;
+
+    /* whether #at:, #at:put: or #size have been redefined for a class
+       with inline versions of those sends */
+    bool accessors_redefined;
+};
+
+/* Each thread has its own machine, and with it its own heap and
+ * universe, so independent VMs can run on separate threads. */
+extern ST_THREAD_LOCAL st_machine __machine;
 
 #define ST_STACK_POP(machine)          (machine->stack[--machine->sp])
 #define ST_STACK_PUSH(machine, oop)    (machine->stack[machine->sp++] = oop)
@@ -88,8 +102,11 @@ struct st_machine {
 void   st_machine_main               (st_machine *machine);
 void   st_machine_initialize         (st_machine *machine);
 void   st_machine_set_active_context (st_machine *machine, st_oop context);
+void   st_machine_return_from        (st_machine *machine, st_oop home, st_oop value);
+void   st_machine_restart            (st_machine *machine, st_oop context);
 void   st_machine_execute_method     (st_machine *machine);
 st_oop st_machine_lookup_method      (st_machine *machine, st_oop class);
 void   st_machine_clear_caches       (st_machine *machine);
+void   st_machine_method_changed     (st_machine *machine, st_oop class, st_oop selector);
 
 #endif /* __ST_CPU_H__ */
@@ -0,0 +1,910 @@
+/*
+ * st-mailbox.c
+ *
+ * Copyright (c) 2008 Vincent Geddes
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+*/
+
+#include "st-mailbox.h"
+#include "st-universe.h"
+#include "st-compiler.h"
+#include "st-machine.h"
+#include "st-memory.h"
+#include "st-object.h"
+#include "st-behavior.h"
+#include "st-array.h"
+#include "st-symbol.h"
+#include "st-float.h"
+#include "st-large-integer.h"
+#include "st-character.h"
+#include "st-small-integer.h"
+#include "st-context.h"
+#include "st-method.h"
+#include "st-dictionary.h"
+#include "st-association.h"
+#include "st-utils.h"
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+/* deeper graphs are taken to be cyclic */
+#define MAX_DEPTH 512
+
+/* answered for an object which can't be built, a null pointer since
+ * 0 is the SmallInteger 0 */
+#define FAILED ((st_oop) ST_POINTER_TAG)
+
+typedef struct message message;
+
+struct message
+{
+    message  *next;
+
+    st_uchar *bytes;
+    st_uint   size;
+};
+
+struct st_mailbox
+{
+    /* pushed to by the senders */
+    message  *head;
+    /* popped from by the owner */
+    message  *tail;
+    message   stub;
+
+    int id;
+    int parent;
+
+    int wakeup[2];
+};
+
+static st_mailbox *mailboxes[ST_MAILBOX_MAX];
+static int         mailbox_count = 0;
+
+static ST_THREAD_LOCAL st_mailbox *current = NULL;
+
+static st_mailbox *
+mailbox_new (int parent)
+{
+    st_mailbox *mailbox;
+    int id;
+
+    id = __atomic_add_fetch (&mailbox_count, 1, __ATOMIC_ACQ_REL);
+    if (id > ST_MAILBOX_MAX)
+	return NULL;
+
+    mailbox = st_new0 (st_mailbox);
+    if (pipe (mailbox->wakeup) < 0) {
+	st_free (mailbox);
+	return NULL;
+    }
+    fcntl (mailbox->wakeup[0], F_SETFL, O_NONBLOCK);
+    fcntl (mailbox->wakeup[1], F_SETFL, O_NONBLOCK);
+
+    mailbox->head = &mailbox->stub;
+    mailbox->tail = &mailbox->stub;
+    mailbox->id = id;
+    mailbox->parent = parent;
+
+    __atomic_store_n (&mailboxes[id - 1], mailbox, __ATOMIC_RELEASE);
+
+    return mailbox;
+}
+
+static st_mailbox *
+mailbox_lookup (int id)
+{
+    if (id < 1 || id > ST_MAILBOX_MAX)
+	return NULL;
+
+    return __atomic_load_n (&mailboxes[id - 1], __ATOMIC_ACQUIRE);
+}
+
+/* the mailbox of a machine which wasn't spawned by another is only
+ * made once it is used */
+static st_mailbox *
+current_mailbox (void)
+{
+    if (current == NULL)
+	current = mailbox_new (0);
+
+    return current;
+}
+
+/* Any thread may push. A sender swaps itself in as the head and only
+ * then links the previous head to it, so for a moment the list may look
+ * shorter to the owner than it is.
+ */
+static void
+push (st_mailbox *mailbox, message *node)
+{
+    message *prev;
+
+    node->next = NULL;
+    prev = __atomic_exchange_n (&mailbox->head, node, __ATOMIC_ACQ_REL);
+    __atomic_store_n (&prev->next, node, __ATOMIC_RELEASE);
+}
+
+/* Only the owner pops. Answers NULL when the list is empty, or when
+ * a push is halfway done; its sender wakes the owner again after. */
+static message *
+pop (st_mailbox *mailbox)
+{
+    message *tail, *next, *head;
+
+    tail = mailbox->tail;
+    next = __atomic_load_n (&tail->next, __ATOMIC_ACQUIRE);
+
+    if (tail == &mailbox->stub) {
+	if (next == NULL)
+	    return NULL;
+	mailbox->tail = next;
+	tail = next;
+	next = __atomic_load_n (&tail->next, __ATOMIC_ACQUIRE);
+    }
+
+    if (next != NULL) {
+	mailbox->tail = next;
+	return tail;
+    }
+
+    head = __atomic_load_n (&mailbox->head, __ATOMIC_ACQUIRE);
+    if (tail != head)
+	return NULL;
+
+    /* tail is the last message, put the stub back behind it */
+    push (mailbox, &mailbox->stub);
+
+    next = __atomic_load_n (&tail->next, __ATOMIC_ACQUIRE);
+    if (next != NULL) {
+	mailbox->tail = next;
+	return tail;
+    }
+
+    return NULL;
+}
+
+/* Messages are flattened depth first. Each object is a tag followed by
+ * its contents; objects other than immediates, symbols, floats and
+ * large integers also carry the name of their class, which is looked
+ * up again in the receiver.
+ *
+ * Classes and the bindings of globals are sent by name. A clean block
+ * is sent with a copy of its home method, whose own clean blocks are
+ * sent without it.
+ */
+enum
+{
+    TAG_NIL,
+    TAG_TRUE,
+    TAG_FALSE,
+    TAG_SMI,
+    TAG_CHARACTER,
+    TAG_SYMBOL,
+    TAG_FLOAT,
+    TAG_LARGE_INTEGER,
+    TAG_OBJECT,
+    TAG_ARRAY,
+    TAG_BYTE_ARRAY,
+    TAG_WORD_ARRAY,
+    TAG_FLOAT_ARRAY,
+    TAG_CLASS,
+    TAG_GLOBAL,
+    TAG_METHOD,
+    TAG_BLOCK,
+    TAG_HOME_BLOCK,
+};
+
+typedef struct
+{
+    st_uchar *bytes;
+    st_uint   size;
+    st_uint   alloc;
+} buffer;
+
+static void
+put (buffer *buffer, const void *data, st_uint size)
+{
+    if (buffer->size + size > buffer->alloc) {
+	buffer->alloc = MAX (buffer->alloc * 2, buffer->size + size);
+	buffer->bytes = st_realloc (buffer->bytes, buffer->alloc);
+    }
+    memcpy (buffer->bytes + buffer->size, data, size);
+    buffer->size += size;
+}
+
+static void
+put_tag (buffer *buffer, st_uchar tag)
+{
+    put (buffer, &tag, 1);
+}
+
+static void
+put_size (buffer *buffer, st_uint size)
+{
+    put (buffer, &size, sizeof (st_uint));
+}
+
+static void
+put_string (buffer *buffer, const char *string, st_uint size)
+{
+    put_size (buffer, size);
+    put (buffer, string, size);
+}
+
+static void
+put_class_name (buffer *buffer, st_oop class)
+{
+    st_oop name = ST_CLASS_NAME (class);
+
+    put_string (buffer, (char *) st_byte_array_bytes (name),
+		st_smi_value (st_arrayed_object_size (name)));
+}
+
+static bool flatten (buffer *buffer, st_oop object, int depth);
+
+static void
+put_block_fields (buffer *buffer, st_oop block)
+{
+    int fields[3];
+
+    fields[0] = st_smi_value (ST_BLOCK_CLOSURE_INITIALIP (block));
+    fields[1] = st_smi_value (ST_BLOCK_CLOSURE_ARGCOUNT (block));
+    fields[2] = st_context_stack_size (block);
+    put (buffer, fields, sizeof (fields));
+}
+
+/* a clean block is one of the literals of its method */
+static bool
+is_clean_block (st_oop block)
+{
+    st_oop  literals = ST_METHOD_LITERALS (ST_BLOCK_CLOSURE_METHOD (block));
+    st_uint size;
+
+    if (literals == ST_NIL)
+	return false;
+
+    size = st_smi_value (st_arrayed_object_size (literals));
+    for (st_uint i = 0; i < size; i++) {
+	if (st_array_elements (literals)[i] == block)
+	    return true;
+    }
+
+    return false;
+}
+
+static bool
+is_global_binding (st_oop object)
+{
+    return st_object_class (object) == ST_ASSOCIATION_CLASS
+	&& st_dictionary_association_at (ST_GLOBALS, ST_ASSOCIATION_KEY (object)) == object;
+}
+
+static bool
+flatten_method (buffer *buffer, st_oop method, int depth)
+{
+    st_oop  literals, literal;
+    st_uint size;
+
+    /* a method which hasn't been compiled yet has no code to send */
+    if (st_method_get_flags (method) == ST_METHOD_LAZY)
+	return false;
+
+    literals = ST_METHOD_LITERALS (method);
+    size = literals == ST_NIL ? 0 : st_smi_value (st_arrayed_object_size (literals));
+
+    put_tag (buffer, TAG_METHOD);
+    put (buffer, &ST_METHOD_HEADER (method), sizeof (st_oop));
+    if (!flatten (buffer, ST_METHOD_SELECTOR (method), depth + 1)
+	|| !flatten (buffer, ST_METHOD_BYTECODE (method), depth + 1))
+	return false;
+
+    put_size (buffer, size);
+    for (st_uint i = 0; i < size; i++) {
+	literal = st_array_elements (literals)[i];
+	if (st_object_is_heap (literal)
+	    && st_object_class (literal) == ST_BLOCK_CLOSURE_CLASS
+	    && ST_BLOCK_CLOSURE_METHOD (literal) == method) {
+	    put_tag (buffer, TAG_HOME_BLOCK);
+	    put_block_fields (buffer, literal);
+	} else if (st_object_is_heap (literal) && is_global_binding (literal)) {
+	    put_tag (buffer, TAG_GLOBAL);
+	    flatten (buffer, ST_ASSOCIATION_KEY (literal), depth + 1);
+	} else if (!flatten (buffer, literal, depth + 1)) {
+	    return false;
+	}
+    }
+
+    return true;
+}
+
+static bool
+flatten (buffer *buffer, st_oop object, int depth)
+{
+    st_oop  class;
+    st_uint size;
+    int     value;
+
+    if (depth > MAX_DEPTH)
+	return false;
+
+    if (object == ST_NIL) {
+	put_tag (buffer, TAG_NIL);
+	return true;
+    } else if (object == ST_TRUE) {
+	put_tag (buffer, TAG_TRUE);
+	return true;
+    } else if (object == ST_FALSE) {
+	put_tag (buffer, TAG_FALSE);
+	return true;
+    } else if (st_object_is_smi (object)) {
+	value = st_smi_value (object);
+	put_tag (buffer, TAG_SMI);
+	put (buffer, &value, sizeof (int));
+	return true;
+    } else if (st_object_is_character (object)) {
+	value = st_character_value (object);
+	put_tag (buffer, TAG_CHARACTER);
+	put (buffer, &value, sizeof (int));
+	return true;
+    }
+
+    class = st_object_class (object);
+
+    if (class == ST_METACLASS_CLASS || st_object_class (class) == ST_METACLASS_CLASS) {
+	bool meta = class == ST_METACLASS_CLASS;
+
+	put_tag (buffer, TAG_CLASS);
+	put (buffer, &meta, sizeof (bool));
+	put_class_name (buffer, meta ? ST_METACLASS_INSTANCE_CLASS (object) : object);
+	return true;
+    }
+
+    if (class == ST_COMPILED_METHOD_CLASS)
+	return flatten_method (buffer, object, depth);
+
+    /* only a clean block can be evaluated away from its home context */
+    if (class == ST_BLOCK_CLOSURE_CLASS) {
+	if (!is_clean_block (object))
+	    return false;
+	put_tag (buffer, TAG_BLOCK);
+	put_block_fields (buffer, object);
+	return flatten_method (buffer, ST_BLOCK_CLOSURE_METHOD (object), depth);
+    }
+
+    if (class == ST_SYMBOL_CLASS) {
+	put_tag (buffer, TAG_SYMBOL);
+	put_string (buffer, (char *) st_byte_array_bytes (object),
+		    st_smi_value (st_arrayed_object_size (object)));
+	return true;
+    }
+
+    switch (st_object_format (object)) {
+
+    case ST_FORMAT_FLOAT:
+    {
+	double d = st_float_value (object);
+
+	put_tag (buffer, TAG_FLOAT);
+	put (buffer, &d, sizeof (double));
+	return true;
+    }
+
+    case ST_FORMAT_LARGE_INTEGER:
+    {
+	char *string = st_large_integer_to_string (object, 16);
+
+	if (string == NULL)
+	    return false;
+	put_tag (buffer, TAG_LARGE_INTEGER);
+	put_string (buffer, string, strlen (string) + 1);
+	st_free (string);
+	return true;
+    }
+
+    case ST_FORMAT_OBJECT:
+	size = st_smi_value (ST_BEHAVIOR_INSTANCE_SIZE (class));
+	put_tag (buffer, TAG_OBJECT);
+	put_class_name (buffer, class);
+	put_size (buffer, size);
+	for (st_uint i = 0; i < size; i++)
+	    if (!flatten (buffer, ST_OBJECT_FIELDS (object)[i], depth + 1))
+		return false;
+	return true;
+
+    case ST_FORMAT_ARRAY:
+	size = st_smi_value (st_arrayed_object_size (object));
+	put_tag (buffer, TAG_ARRAY);
+	put_class_name (buffer, class);
+	put_size (buffer, size);
+	for (st_uint i = 0; i < size; i++)
+	    if (!flatten (buffer, st_array_elements (object)[i], depth + 1))
+		return false;
+	return true;
+
+    case ST_FORMAT_BYTE_ARRAY:
+	size = st_smi_value (st_arrayed_object_size (object));
+	put_tag (buffer, TAG_BYTE_ARRAY);
+	put_class_name (buffer, class);
+	put_string (buffer, (char *) st_byte_array_bytes (object), size);
+	return true;
+
+    case ST_FORMAT_WORD_ARRAY:
+	size = st_smi_value (st_arrayed_object_size (object));
+	put_tag (buffer, TAG_WORD_ARRAY);
+	put_class_name (buffer, class);
+	put_size (buffer, size);
+	put (buffer, st_word_array_elements (object), size * sizeof (st_uint));
+	return true;
+
+    case ST_FORMAT_FLOAT_ARRAY:
+	size = st_smi_value (st_arrayed_object_size (object));
+	put_tag (buffer, TAG_FLOAT_ARRAY);
+	put_class_name (buffer, class);
+	put_size (buffer, size);
+	put (buffer, st_float_array_elements (object), size * sizeof (double));
+	return true;
+
+    default:
+	/* contexts, handles and mapped files stay where they are */
+	return false;
+    }
+}
+
+typedef struct
+{
+    st_uchar *p;
+} reader;
+
+static void
+get (reader *reader, void *data, st_uint size)
+{
+    memcpy (data, reader->p, size);
+    reader->p += size;
+}
+
+static st_uint
+get_size (reader *reader)
+{
+    st_uint size;
+
+    get (reader, &size, sizeof (st_uint));
+    return size;
+}
+
+/* answers a copy of a string in the message, which is NUL terminated */
+static char *
+get_string (reader *reader)
+{
+    st_uint size;
+    char   *string;
+
+    size = get_size (reader);
+    string = st_malloc (size + 1);
+    get (reader, string, size);
+    string[size] = '\0';
+
+    return string;
+}
+
+/* answers nil if the receiving machine has no class of that name, or
+ * it has another format */
+static st_oop
+get_class (reader *reader, st_format format)
+{
+    st_oop class;
+    char  *name;
+
+    name = get_string (reader);
+    class = st_global_get (name);
+    st_free (name);
+
+    if (class == ST_NIL || st_object_class (st_object_class (class)) != ST_METACLASS_CLASS
+	|| st_smi_value (ST_BEHAVIOR_FORMAT (class)) != format)
+	return ST_NIL;
+
+    return class;
+}
+
+static st_oop rebuild (reader *reader);
+
+/* the method of a home block is filled in once the method is built */
+static st_oop
+get_block (reader *reader)
+{
+    st_oop block;
+    int    fields[3];
+
+    get (reader, fields, sizeof (fields));
+
+    block = st_memory_allocate_closure (0, fields[2]);
+    ST_BLOCK_CLOSURE_OUTER_CONTEXT (block) = ST_NIL;
+    ST_BLOCK_CLOSURE_METHOD (block)        = ST_NIL;
+    ST_BLOCK_CLOSURE_RECEIVER (block)      = ST_NIL;
+    ST_BLOCK_CLOSURE_INITIALIP (block)     = st_smi_new (fields[0]);
+    ST_BLOCK_CLOSURE_ARGCOUNT (block)      = st_smi_new (fields[1]);
+
+    return block;
+}
+
+static st_oop
+get_method (reader *reader)
+{
+    st_oop  method, literals, element;
+    st_oop  header;
+    st_uint size;
+
+    get (reader, &header, sizeof (st_oop));
+
+    element = rebuild (reader);
+    if (element == FAILED)
+	return FAILED;
+    st_memory_push_root (element);
+
+    element = rebuild (reader);
+    if (element == FAILED) {
+	st_memory_pop_root ();
+	return FAILED;
+    }
+    st_memory_push_root (element);
+
+    size = get_size (reader);
+    st_memory_push_root (st_object_new_arrayed (ST_ARRAY_CLASS, size));
+    for (st_uint i = 0; i < size; i++) {
+	switch (*reader->p) {
+	case TAG_HOME_BLOCK:
+	    reader->p++;
+	    element = get_block (reader);
+	    break;
+	case TAG_GLOBAL:
+	    reader->p++;
+	    element = rebuild (reader);
+	    if (element != FAILED)
+		element = st_dictionary_association_at (ST_GLOBALS, element);
+	    if (element == ST_NIL)
+		element = FAILED;
+	    break;
+	default:
+	    element = rebuild (reader);
+	    break;
+	}
+	if (element == FAILED) {
+	    st_memory_pop_root ();
+	    st_memory_pop_root ();
+	    st_memory_pop_root ();
+	    return FAILED;
+	}
+	st_array_elements (st_memory_peek_root ())[i] = element;
+    }
+
+    method = st_object_new (ST_COMPILED_METHOD_CLASS);
+    ST_METHOD_HEADER (method)   = header;
+    ST_METHOD_LITERALS (method) = literals = st_memory_pop_root ();
+    ST_METHOD_BYTECODE (method) = st_memory_pop_root ();
+    ST_METHOD_SELECTOR (method) = st_memory_pop_root ();
+
+    for (st_uint i = 0; i < size; i++) {
+	element = st_array_elements (literals)[i];
+	if (st_object_is_heap (element) && st_object_class (element) == ST_BLOCK_CLOSURE_CLASS
+	    && ST_BLOCK_CLOSURE_METHOD (element) == ST_NIL)
+	    ST_BLOCK_CLOSURE_METHOD (element) = method;
+    }
+
+    return method;
+}
+
+/* Builds the next object in the message, answering FAILED if it can't be.
+ * Objects being filled in are kept as roots, since building their
+ * contents may collect garbage.
+ */
+static st_oop
+rebuild (reader *reader)
+{
+    st_oop  object, class, element;
+    st_uint size;
+    int     value;
+    double  d;
+    char   *string;
+
+    switch (*reader->p++) {
+
+    case TAG_NIL:
+	return ST_NIL;
+    case TAG_TRUE:
+	return ST_TRUE;
+    case TAG_FALSE:
+	return ST_FALSE;
+
+    case TAG_SMI:
+	get (reader, &value, sizeof (int));
+	return st_smi_new (value);
+
+    case TAG_CHARACTER:
+	get (reader, &value, sizeof (int));
+	return st_character_new (value);
+
+    case TAG_SYMBOL:
+	string = get_string (reader);
+	object = st_symbol_new (string);
+	st_free (string);
+	return object;
+
+    case TAG_FLOAT:
+	get (reader, &d, sizeof (double));
+	return st_float_new (d);
+
+    case TAG_LARGE_INTEGER:
+	string = get_string (reader);
+	object = st_large_integer_new_from_string (string, 16);
+	st_free (string);
+	return object;
+
+    case TAG_OBJECT:
+	class = get_class (reader, ST_FORMAT_OBJECT);
+	size = get_size (reader);
+	if (class == ST_NIL || st_smi_value (ST_BEHAVIOR_INSTANCE_SIZE (class)) != size)
+	    return FAILED;
+	st_memory_push_root (st_object_new (class));
+	for (st_uint i = 0; i < size; i++) {
+	    element = rebuild (reader);
+	    if (element == FAILED) {
+		st_memory_pop_root ();
+		return FAILED;
+	    }
+	    ST_OBJECT_FIELDS (st_memory_peek_root ())[i] = element;
+	}
+	return st_memory_pop_root ();
+
+    case TAG_ARRAY:
+	class = get_class (reader, ST_FORMAT_ARRAY);
+	size = get_size (reader);
+	if (class == ST_NIL)
+	    return FAILED;
+	st_memory_push_root (st_object_new_arrayed (class, size));
+	for (st_uint i = 0; i < size; i++) {
+	    element = rebuild (reader);
+	    if (element == FAILED) {
+		st_memory_pop_root ();
+		return FAILED;
+	    }
+	    st_array_elements (st_memory_peek_root ())[i] = element;
+	}
+	return st_memory_pop_root ();
+
+    case TAG_BYTE_ARRAY:
+	class = get_class (reader, ST_FORMAT_BYTE_ARRAY);
+	size = get_size (reader);
+	if (class == ST_NIL)
+	    return FAILED;
+	object = st_object_new_arrayed (class, size);
+	get (reader, st_byte_array_bytes (object), size);
+	return object;
+
+    case TAG_WORD_ARRAY:
+	class = get_class (reader, ST_FORMAT_WORD_ARRAY);
+	size = get_size (reader);
+	if (class == ST_NIL)
+	    return FAILED;
+	object = st_object_new_arrayed (class, size);
+	get (reader, st_word_array_elements (object), size * sizeof (st_uint));
+	return object;
+
+    case TAG_FLOAT_ARRAY:
+	class = get_class (reader, ST_FORMAT_FLOAT_ARRAY);
+	size = get_size (reader);
+	if (class == ST_NIL)
+	    return FAILED;
+	object = st_object_new_arrayed (class, size);
+	get (reader, st_float_array_elements (object), size * sizeof (double));
+	return object;
+
+    case TAG_CLASS:
+    {
+	bool meta;
+
+	get (reader, &meta, sizeof (bool));
+	string = get_string (reader);
+	class = st_global_get (string);
+	st_free (string);
+	if (class == ST_NIL || st_object_class (st_object_class (class)) != ST_METACLASS_CLASS)
+	    return FAILED;
+	return meta ? st_object_class (class) : class;
+    }
+
+    case TAG_METHOD:
+	return get_method (reader);
+
+    case TAG_BLOCK:
+	st_memory_push_root (get_block (reader));
+	reader->p++;
+	object = get_method (reader);
+	if (object == FAILED) {
+	    st_memory_pop_root ();
+	    return FAILED;
+	}
+	element = st_memory_pop_root ();
+	ST_BLOCK_CLOSURE_METHOD (element) = object;
+	return element;
+
+    default:
+	st_assert_not_reached ();
+	return FAILED;
+    }
+}
+
+int
+st_mailbox_current_id (void)
+{
+    st_mailbox *mailbox = current_mailbox ();
+
+    return mailbox ? mailbox->id : 0;
+}
+
+int
+st_mailbox_parent_id (void)
+{
+    st_mailbox *mailbox = current_mailbox ();
+
+    return mailbox ? mailbox->parent : 0;
+}
+
+/* the descriptor to wait on for messages, -1 if there is no mailbox */
+int
+st_mailbox_descriptor (void)
+{
+    st_mailbox *mailbox = current_mailbox ();
+
+    return mailbox ? mailbox->wakeup[0] : -1;
+}
+
+/* Posts a copy of object to the machine with the given id. Fails if
+ * there is no such machine or part of object can't be copied.
+ */
+bool
+st_mailbox_post (int id, st_oop object)
+{
+    st_mailbox *mailbox;
+    message    *node;
+    buffer      buffer = { NULL, 0, 0 };
+
+    mailbox = mailbox_lookup (id);
+    if (mailbox == NULL)
+	return false;
+
+    if (!flatten (&buffer, object, 0)) {
+	st_free (buffer.bytes);
+	return false;
+    }
+
+    node = st_new0 (message);
+    node->bytes = buffer.bytes;
+    node->size = buffer.size;
+
+    push (mailbox, node);
+
+    /* if the pipe is full the receiver has a wakeup pending already */
+    (void) write (mailbox->wakeup[1], "", 1);
+
+    return true;
+}
+
+/* Takes the next message posted to this machine, answering false if
+ * there is none. A message naming a class this machine doesn't have is
+ * received as nil.
+ */
+bool
+st_mailbox_receive (st_oop *object)
+{
+    st_mailbox *mailbox;
+    message    *node;
+    reader      reader;
+    char        bytes[64];
+
+    mailbox = current_mailbox ();
+    if (mailbox == NULL)
+	return false;
+
+    node = pop (mailbox);
+    if (node == NULL) {
+	/* clear the wakeup before looking once more, any message posted
+	 * after that wakes the receiver again */
+	while (read (mailbox->wakeup[0], bytes, sizeof (bytes)) > 0)
+	    ;
+	node = pop (mailbox);
+	if (node == NULL)
+	    return false;
+    }
+
+    reader.p = node->bytes;
+    *object = rebuild (&reader);
+    if (*object == FAILED)
+	*object = ST_NIL;
+
+    st_free (node->bytes);
+    st_free (node);
+
+    return true;
+}
+
+typedef struct
+{
+    st_mailbox *mailbox;
+    char       *source;
+} spawn_args;
+
+static void *
+run_spawned (void *data)
+{
+    spawn_args *args = data;
+    st_compiler_error error;
+
+    current = args->mailbox;
+
+    st_initialize ();
+
+    if (st_compile_string (ST_UNDEFINED_OBJECT_CLASS, args->source, &error)) {
+	st_machine_initialize (&__machine);
+	st_machine_main (&__machine);
+    } else {
+	fprintf (stderr, "panda:%i: %s\n", error.line, error.message);
+    }
+
+    st_free (args->source);
+    st_free (args);
+
+    return NULL;
+}
+
+/* Starts a machine on a new thread which evaluates source as the body
+ * of a block, and answers its id, or 0 if it couldn't be started.
+ */
+int
+st_mailbox_spawn (const char *source)
+{
+    spawn_args    *args;
+    st_mailbox    *mailbox;
+    pthread_t      thread;
+    pthread_attr_t attr;
+    int            result;
+
+    mailbox = mailbox_new (st_mailbox_current_id ());
+    if (mailbox == NULL)
+	return 0;
+
+    args = st_new0 (spawn_args);
+    args->mailbox = mailbox;
+    args->source = st_strconcat ("doIt ^ [", source, "] value", NULL);
+
+    pthread_attr_init (&attr);
+    pthread_attr_setdetachstate (&attr, PTHREAD_CREATE_DETACHED);
+    result = pthread_create (&thread, &attr, run_spawned, args);
+    pthread_attr_destroy (&attr);
+
+    if (result != 0) {
+	st_free (args->source);
+	st_free (args);
+	return 0;
+    }
+
+    return mailbox->id;
+}
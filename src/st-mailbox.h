@@ -0,0 +1,57 @@
+/*
+ * st-mailbox.h
+ *
+ * Copyright (c) 2008 Vincent Geddes
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+*/
+
+#ifndef __ST_MAILBOX_H__
+#define __ST_MAILBOX_H__
+
+#include <st-types.h>
+
+/*
+ * Every machine has a mailbox which the other machines in the process
+ * post messages to. Machines share no objects, so a message is a copy
+ * of an object graph flattened into a buffer by the sender and built
+ * again in the receiver's heap.
+ *
+ * The queue is a lock-free list which any thread may push to and only
+ * the owning machine pops from. After a push the sender writes to the
+ * mailbox's wakeup pipe, which the receiving machine waits on like any
+ * other file descriptor, so that only the waiting Process is blocked.
+ */
+
+#define ST_MAILBOX_MAX 256
+
+typedef struct st_mailbox st_mailbox;
+
+/* the id of the machine running on this thread, 0 if there is none */
+int     st_mailbox_current_id   (void);
+int     st_mailbox_parent_id    (void);
+
+int     st_mailbox_descriptor   (void);
+
+bool    st_mailbox_post         (int id, st_oop object);
+bool    st_mailbox_receive      (st_oop *object);
+
+int     st_mailbox_spawn        (const char *source);
+
+#endif /* __ST_MAILBOX_H__ */
@@ -152,6 +152,9 @@ st_memory_new (void)
     memory->total_pause_time.tv_sec = 0;
     memory->total_pause_time.tv_nsec = 0;
     memory->counter = 0;
+    memory->deferrals = 0;
+    memory->total_allocated = 0;
+    memory->collections = 0;
 
     memory->mark_stack = st_malloc (MARK_STACK_SIZE);
     memory->mark_stack_size = MARK_STACK_SIZE;
@@ -160,7 +163,8 @@ st_memory_new (void)
     memory->alloc_bits  = NULL;
     memory->offsets     = NULL;
 
-    memory->free_context = 0;
+    memset (memory->free_contexts, 0, sizeof (memory->free_contexts));
+    memset (memory->free_block_contexts, 0, sizeof (memory->free_block_contexts));
 
     memory->ht = st_identity_hashtable_new ();
 
@@ -187,6 +191,52 @@ st_memory_remove_root (st_oop object)
     ptr_array_remove_fast (memory->roots, (st_pointer) object);
 }
 
+/* C code filling in a new object which allocates on the way pushes the
+ * object as a root, and fetches it again after each allocation as a
+ * collection may have moved it. */
+void
+st_memory_push_root (st_oop object)
+{
+    ptr_array_append (memory->roots, (st_pointer) object);
+}
+
+st_oop
+st_memory_peek_root (void)
+{
+    return (st_oop) ptr_array_get_index (memory->roots, ptr_array_length (memory->roots) - 1);
+}
+
+st_oop
+st_memory_pop_root (void)
+{
+    return (st_oop) ptr_array_remove_index_fast (memory->roots, ptr_array_length (memory->roots) - 1);
+}
+
+/* The compiler keeps oops in C structures which the collector knows
+ * nothing about: the class, and the literals and selectors held by the
+ * syntax tree and the generator. Pushing them as roots wouldn't help,
+ * as a collection updates the root stack but not the copies in the
+ * tree. So collections are put off while a method is compiled, and the
+ * heap grows instead. The next allocation after st_memory_allow_gc()
+ * collects.
+ *
+ * Collections are only put off for one method at a time, whether it
+ * is filed in, compiled from a stub or compiled from a string. What a
+ * method allocates is bounded by the size of its source, so the heap
+ * can't grow without bound, however long the file being filed in. */
+void
+st_memory_defer_gc (void)
+{
+    memory->deferrals++;
+}
+
+void
+st_memory_allow_gc (void)
+{
+    st_assert (memory->deferrals > 0);
+    memory->deferrals--;
+}
+
 st_oop
 st_memory_allocate (st_uint size)
 {
@@ -194,7 +244,7 @@ st_memory_allocate (st_uint size)
 
     st_assert (size >= 2);
 
-    if (memory->counter > ST_COLLECTION_THRESHOLD)
+    if (memory->counter > ST_COLLECTION_THRESHOLD && memory->deferrals == 0)
 	return 0;
     if ((memory->p + size) >= memory->end)
 	grow_heap (size);
@@ -206,33 +256,89 @@ st_memory_allocate (st_uint size)
     return st_tag_pointer (chunk);
 }
 
+static inline st_oop *
+free_list (st_oop class)
+{
+    if (class == ST_METHOD_CONTEXT_CLASS)
+	return memory->free_contexts;
+    else
+	return memory->free_block_contexts;
+}
+
+/* Allocates a context with room for `stack_size' oops on its stack.
+ * Contexts are taken from the free list for that size if possible.
+ */
 st_oop
-st_memory_allocate_context (void)
+st_memory_allocate_context (st_oop class, st_uint stack_size)
 {
-    st_oop context;
+    st_oop  context;
+    st_oop *free;
+    st_uint size;
+
+    st_assert (stack_size < ST_N_ELEMENTS (memory->free_contexts));
 
-    if (ST_LIKELY (memory->free_context)) {
-	context = memory->free_context;
-	memory->free_context = ST_CONTEXT_PART_SENDER (memory->free_context);
-	    return context;
+    free = free_list (class);
+    if (ST_LIKELY (free[stack_size])) {
+	context = free[stack_size];
+	free[stack_size] = ST_CONTEXT_PART_SENDER (context);
+	return context;
     }
 
-    context = st_memory_allocate (ST_SIZE_OOPS (struct st_method_context) + 32);
+    if (class == ST_METHOD_CONTEXT_CLASS)
+	size = ST_SIZE_OOPS (struct st_method_context) + stack_size;
+    else
+	size = ST_SIZE_OOPS (struct st_block_context) + stack_size;
+
+    context = st_memory_allocate (size);
     if (context == 0) {
 	st_memory_perform_gc ();
-	context = st_memory_allocate (ST_SIZE_OOPS (struct st_method_context) + 32);
+	context = st_memory_allocate (size);
 	st_assert (context != 0);
     }
-    st_object_initialize_header (context, ST_METHOD_CONTEXT_CLASS);
+    st_object_initialize_header (context, class);
+    st_context_set_stack_size (context, stack_size);
 
     return context;
 }
 
+/* only contexts which were never captured may be recycled */
 void
 st_memory_recycle_context  (st_oop context)
 {
-    ST_CONTEXT_PART_SENDER (context) = memory->free_context;
-    memory->free_context = context;
+    st_oop *free;
+    st_uint stack_size;
+
+    st_assert (!st_context_is_captured (context));
+
+    free = free_list (ST_OBJECT_CLASS (context));
+    stack_size = st_context_stack_size (context);
+    ST_CONTEXT_PART_SENDER (context) = free[stack_size];
+    free[stack_size] = context;
+}
+
+/* Allocates a block closure with room for `copied_count' copied values,
+ * whose activations have `stack_size' stack slots. Its fields are
+ * not initialized.
+ */
+st_oop
+st_memory_allocate_closure (st_uint copied_count, st_uint stack_size)
+{
+    st_oop  closure;
+    st_uint size;
+
+    size = ST_SIZE_OOPS (struct st_block_closure) + copied_count;
+
+    closure = st_memory_allocate (size);
+    if (closure == 0) {
+	st_memory_perform_gc ();
+	closure = st_memory_allocate (size);
+	st_assert (closure != 0);
+    }
+    st_object_initialize_header (closure, ST_BLOCK_CLOSURE_CLASS);
+    st_object_set_instance_size (closure, size - ST_SIZE_OOPS (struct st_header));
+    st_context_set_stack_size (closure, stack_size);
+
+    return closure;
 }
 
 static inline bool
@@ -295,6 +401,8 @@ object_size (st_oop object)
 	return ST_SIZE_OOPS (struct st_large_integer);
     case ST_FORMAT_HANDLE:
 	return ST_SIZE_OOPS (struct st_handle);
+    case ST_FORMAT_MAPPED_BYTES:
+	return ST_SIZE_OOPS (struct st_mapped_bytes);
     case ST_FORMAT_ARRAY:
 	return ST_SIZE_OOPS (struct st_arrayed_object) + st_smi_value (st_arrayed_object_size (object));
     case ST_FORMAT_BYTE_ARRAY:
@@ -309,7 +417,7 @@ object_size (st_oop object)
 	abort ();
 	break;
     case ST_FORMAT_CONTEXT:
-	return ST_SIZE_OOPS (struct st_header) + st_object_instance_size (object) + 32;
+	return ST_SIZE_OOPS (struct st_header) + st_object_instance_size (object) + st_context_stack_size (object);
     }
     /* should not reach */
     abort ();
@@ -339,6 +447,7 @@ object_contents (st_oop object, st_oop **oops, st_uint *size)
     case ST_FORMAT_WORD_ARRAY:
     case ST_FORMAT_FLOAT_ARRAY:
     case ST_FORMAT_INTEGER_ARRAY:
+    case ST_FORMAT_MAPPED_BYTES:
 	*oops = NULL;
 	*size = 0;
 	break;
@@ -417,6 +526,9 @@ basic_finalize (st_oop object)
 {
     if (ST_UNLIKELY (st_object_format (object) == ST_FORMAT_LARGE_INTEGER))
 	mp_clear (st_large_integer_value (object));
+    else if (ST_UNLIKELY (st_object_format (object) == ST_FORMAT_MAPPED_BYTES)
+	     && st_mapped_bytes (object) != NULL)
+	munmap (st_mapped_bytes (object), st_smi_value (st_arrayed_object_size (object)));
 }
 
 
@@ -506,6 +618,11 @@ st_memory_mark (void)
     for (st_uint i = 0; i < memory->roots->length; i++)
 	stack[sp++] = (st_oop) ptr_array_get_index (memory->roots, i);
     stack[sp++] = __machine.context;
+    /* remap_machine() remaps these too, so they must survive marking even
+       when the receiver or method of the last send is otherwise garbage */
+    stack[sp++] = __machine.message_receiver;
+    stack[sp++] = __machine.message_selector;
+    stack[sp++] = __machine.new_method;
 
     while (sp > 0) {
 	object = stack[--sp];
@@ -536,21 +653,16 @@ st_memory_mark (void)
 static void
 remap_machine (struct st_machine *machine)
 {
-    st_oop context, home;
+    st_oop context;
 
     context = remap_oop (machine->context);
-    if (ST_OBJECT_CLASS (context) == ST_BLOCK_CONTEXT_CLASS) {
-	home = ST_BLOCK_CONTEXT_HOME (context);
-	machine->method   = ST_METHOD_CONTEXT_METHOD (home);
-	machine->receiver = ST_METHOD_CONTEXT_RECEIVER (home);
-	machine->temps    = ST_METHOD_CONTEXT_STACK (home);
-	machine->stack    = ST_BLOCK_CONTEXT_STACK (context);
-    } else {
-	machine->method   = ST_METHOD_CONTEXT_METHOD (context);
-	machine->receiver = ST_METHOD_CONTEXT_RECEIVER (context);
-	machine->temps    = ST_METHOD_CONTEXT_STACK (context);
-	machine->stack    = ST_METHOD_CONTEXT_STACK (context);
-    }
+    machine->method   = ST_METHOD_CONTEXT_METHOD (context);
+    machine->receiver = ST_METHOD_CONTEXT_RECEIVER (context);
+    if (ST_OBJECT_CLASS (context) == ST_BLOCK_CONTEXT_CLASS)
+	machine->temps = ST_BLOCK_CONTEXT_STACK (context);
+    else
+	machine->temps = ST_METHOD_CONTEXT_STACK (context);
+    machine->stack    = machine->temps;
 
     machine->context  = context;
     machine->bytecode = st_method_bytecode_bytes (machine->method);
@@ -598,9 +710,12 @@ garbage_collect (void)
     struct timespec tm;
     
     /* clear context pool */
-    memory->free_context = 0;
+    memset (memory->free_contexts, 0, sizeof (memory->free_contexts));
+    memset (memory->free_block_contexts, 0, sizeof (memory->free_block_contexts));
 
     memory->bytes_allocated += memory->counter;
+    memory->total_allocated += memory->counter;
+    memory->collections++;
 
     clear_metadata ();
 
@@ -644,6 +759,14 @@ garbage_collect (void)
 	    times[0], times[1], times[2]);
 }
 
+/* the number of bytes allocated since the heap was made, counting
+ * contexts only when they aren't taken from a free list */
+st_ulong
+st_memory_total_allocated (void)
+{
+    return memory->total_allocated + memory->counter;
+}
+
 st_oop
 st_memory_remap_reference (st_oop reference)
 {
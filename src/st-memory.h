@@ -54,14 +54,18 @@ typedef struct st_memory
 
     ptr_array  roots;
     st_uint    counter;
+    st_uint    deferrals;  /* collections are put off while non-zero */
 
-    /* free context pool */
-    st_oop     free_context;
+    /* free method and block contexts, one list for each stack size */
+    st_oop     free_contexts[256];
+    st_oop     free_block_contexts[256];
 
     /* statistics */
     struct timespec total_pause_time;     /* total accumulated pause time */
     st_ulong bytes_allocated;             /* current number of allocated bytes */
     st_ulong bytes_collected;             /* number of bytes collected in last compaction */
+    st_ulong total_allocated;             /* bytes allocated up to the last collection */
+    st_uint  collections;                 /* number of collections */
 
     st_identity_hashtable *ht;
 
@@ -71,13 +75,22 @@ st_memory *st_memory_new             (void);
 void       st_memory_destroy         (void);
 void       st_memory_add_root        (st_oop object);
 void       st_memory_remove_root     (st_oop object);
+void       st_memory_push_root       (st_oop object);
+st_oop     st_memory_peek_root       (void);
+st_oop     st_memory_pop_root        (void);
+void       st_memory_defer_gc        (void);
+void       st_memory_allow_gc        (void);
 st_oop     st_memory_allocate        (st_uint size);
 
-st_oop     st_memory_allocate_context (void);
+st_oop     st_memory_allocate_context (st_oop class, st_uint stack_size);
 void       st_memory_recycle_context  (st_oop context);
 
+st_oop     st_memory_allocate_closure (st_uint copied_count, st_uint stack_size);
+
 void       st_memory_perform_gc       (void);
 
+st_ulong   st_memory_total_allocated  (void);
+
 st_oop     st_memory_remap_reference  (st_oop reference);
 
 #endif /* __ST_MEMORY__ */
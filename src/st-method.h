@@ -48,6 +48,7 @@ typedef enum
     ST_METHOD_RETURN_INSTVAR,
     ST_METHOD_RETURN_LITERAL,
     ST_METHOD_PRIMITIVE,
+    ST_METHOD_LAZY,
 
 } st_method_flags;
 
@@ -84,15 +85,16 @@ typedef enum
  *   2 : The method simply returns an instance variable. Ditto.
  *   3 : The method simply returns a literal. Ditto.
  *   4 : The method performs a primitive operation.
+ *   5 : The method is an uncompiled stub. It is compiled when first looked up.
  *
  * Bitfield format
  * 
  * flag = 0:
- *   [ flag: 3 | arg_count: 5 | temp_count: 6 | unused: 7 | large_context: 1 | primitive: 8 | tag: 2 ]
+ *   [ flag: 3 | arg_count: 5 | temp_count: 6 | stack_size: 8 | primitive: 8 | tag: 2 ]
  *
  *   arg_count:      number of args
  *   temp_count:     number of temps
- *   stack_depth:    depth of stack
+ *   stack_size:     stack slots needed by an activation, args and temps included
  *   primitive:      index of a primitive method
  *   tag:            The usual smi tag
  *
@@ -115,6 +117,13 @@ typedef enum
  *       0:              4
  *       1:              5
  *       2:              6
+ *
+ * flag = 5:
+ *   header: [ flag: 3 | unused: 11 | source: 16 | tag: 2 ]
+ *
+ *   source:  Index of the source file in the compiler's table of lazily filed-in sources.
+ *            The bytecode slot holds the offset of the method's chunk in that file,
+ *            and the literals slot is nil.
  */
 
 #define _ST_METHOD_SET_BITFIELD(bitfield, field, value) 	  		\
@@ -129,26 +138,27 @@ enum
     _ST_METHOD_FLAG_BITS           = 3,
     _ST_METHOD_ARG_BITS            = 5,
     _ST_METHOD_TEMP_BITS           = 6,
-    _ST_METHOD_UNUSED_BITS         = 7,
-    _ST_METHOD_LARGE_BITS          = 1,
+    _ST_METHOD_STACK_BITS          = 8,
     _ST_METHOD_INSTVAR_BITS        = 16,  
     _ST_METHOD_LITERAL_BITS        = 4,
     _ST_METHOD_PRIMITIVE_BITS      = 8,
+    _ST_METHOD_SOURCE_BITS         = 16,
     
     _ST_METHOD_PRIMITIVE_SHIFT     =  ST_TAG_SIZE,
     _ST_METHOD_INSTVAR_SHIFT       =  ST_TAG_SIZE,
     _ST_METHOD_LITERAL_SHIFT       =  ST_TAG_SIZE,
-    _ST_METHOD_LARGE_SHIFT         = _ST_METHOD_PRIMITIVE_BITS + _ST_METHOD_PRIMITIVE_SHIFT,
-    _ST_METHOD_UNUSED_SHIFT        = _ST_METHOD_LARGE_BITS     + _ST_METHOD_LARGE_SHIFT,
-    _ST_METHOD_TEMP_SHIFT          = _ST_METHOD_UNUSED_BITS    + _ST_METHOD_UNUSED_SHIFT,
+    _ST_METHOD_SOURCE_SHIFT        =  ST_TAG_SIZE,
+    _ST_METHOD_STACK_SHIFT         = _ST_METHOD_PRIMITIVE_BITS + _ST_METHOD_PRIMITIVE_SHIFT,
+    _ST_METHOD_TEMP_SHIFT          = _ST_METHOD_STACK_BITS     + _ST_METHOD_STACK_SHIFT,
     _ST_METHOD_ARG_SHIFT           = _ST_METHOD_TEMP_BITS      + _ST_METHOD_TEMP_SHIFT,
     _ST_METHOD_FLAG_SHIFT          = _ST_METHOD_ARG_BITS       + _ST_METHOD_ARG_SHIFT,
     
     _ST_METHOD_PRIMITIVE_MASK      = ST_NTH_MASK (_ST_METHOD_PRIMITIVE_BITS),
-    _ST_METHOD_LARGE_MASK          = ST_NTH_MASK (_ST_METHOD_LARGE_BITS),
     _ST_METHOD_INSTVAR_MASK        = ST_NTH_MASK (_ST_METHOD_INSTVAR_BITS),
     _ST_METHOD_LITERAL_MASK        = ST_NTH_MASK (_ST_METHOD_LITERAL_BITS),
+    _ST_METHOD_SOURCE_MASK         = ST_NTH_MASK (_ST_METHOD_SOURCE_BITS),
     _ST_METHOD_TEMP_MASK           = ST_NTH_MASK (_ST_METHOD_TEMP_BITS),
+    _ST_METHOD_STACK_MASK          = ST_NTH_MASK (_ST_METHOD_STACK_BITS),
     _ST_METHOD_ARG_MASK            = ST_NTH_MASK (_ST_METHOD_ARG_BITS),
     _ST_METHOD_FLAG_MASK           = ST_NTH_MASK (_ST_METHOD_FLAG_BITS),
 };
@@ -167,9 +177,9 @@ st_method_get_arg_count (st_oop method)
 }
 
 static inline int
-st_method_get_large_context (st_oop method)
+st_method_get_stack_size (st_oop method)
 {
-    return _ST_METHOD_GET_BITFIELD (ST_METHOD_HEADER (method), LARGE);
+    return _ST_METHOD_GET_BITFIELD (ST_METHOD_HEADER (method), STACK);
 }
 
 static inline int
@@ -178,6 +188,12 @@ st_method_get_primitive_index (st_oop method)
     return _ST_METHOD_GET_BITFIELD (ST_METHOD_HEADER (method), PRIMITIVE);
 }
 
+static inline int
+st_method_get_source_index (st_oop method)
+{
+    return _ST_METHOD_GET_BITFIELD (ST_METHOD_HEADER (method), SOURCE);
+}
+
 static inline st_method_flags
 st_method_get_flags (st_oop method)
 {   
@@ -203,9 +219,9 @@ st_method_set_temp_count (st_oop method, int count)
 }
 
 static inline void
-st_method_set_large_context (st_oop method, bool is_large)
+st_method_set_stack_size (st_oop method, int size)
 {
-    _ST_METHOD_SET_BITFIELD (ST_METHOD_HEADER (method), LARGE, is_large);
+    _ST_METHOD_SET_BITFIELD (ST_METHOD_HEADER (method), STACK, size);
 }
 
 static inline void
@@ -220,6 +236,12 @@ st_method_set_instvar_index (st_oop method, int index)
     _ST_METHOD_SET_BITFIELD (ST_METHOD_HEADER (method), INSTVAR, index);
 }
 
+static inline void
+st_method_set_source_index (st_oop method, int index)
+{
+    _ST_METHOD_SET_BITFIELD (ST_METHOD_HEADER (method), SOURCE, index);
+}
+
 static inline void
 st_method_set_literal_type (st_oop method, st_method_literal_type literal_type)
 {
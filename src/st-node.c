@@ -370,9 +370,9 @@ st_print_method_node (st_node *node)
 }
 
 st_node *
-st_node_new (st_node_type type)
+st_node_new (st_arena *arena, st_node_type type)
 {
-    st_node *node = st_new0 (st_node);
+    st_node *node = st_arena_new0 (arena, st_node);
     node->type = type;
 
     if (node->type == ST_MESSAGE_NODE)
@@ -385,19 +385,6 @@ st_node_new (st_node_type type)
     return node;
 }
 
-st_node *
-st_node_list_append (st_node *list, st_node *node)
-{
-    st_node *l = list;
-    if (list == NULL)
-	return node;
-    while (l->next)
-	l = l->next;
-    l->next = node;
-    return list;
-}
-
-
 st_uint
 st_node_list_length (st_node *list)
 {
@@ -418,58 +405,5 @@ st_node_list_at (st_node *list, st_uint index)
     return l;
 }
 
-void
-st_node_destroy (st_node *node)
-{
-    if (node == NULL)
-	return;
-
-    switch (node->type) {
-    case ST_METHOD_NODE:
-	st_node_destroy (node->method.arguments);
-	st_node_destroy (node->method.temporaries);
-	st_node_destroy (node->method.statements);
-	break;
-
-    case ST_BLOCK_NODE:
-	st_node_destroy (node->block.arguments);
-	st_node_destroy (node->block.temporaries);
-	st_node_destroy (node->block.statements);
-	break;
-
-    case ST_ASSIGN_NODE:
-	st_node_destroy (node->assign.assignee);
-	st_node_destroy (node->assign.expression);
-	break;
-
-    case ST_RETURN_NODE:
-	st_node_destroy (node->retrn.expression);
-	break;
-
-    case ST_MESSAGE_NODE:
-	st_node_destroy (node->message.receiver);
-	st_node_destroy (node->message.arguments);
-	break;
-
-    case ST_CASCADE_NODE:
-	st_node_destroy (node->cascade.receiver);
-
-	st_list_foreach (node->cascade.messages, (st_list_foreach_func) st_node_destroy);
-	st_list_destroy (node->cascade.messages);
-	break;
-
-    case ST_VARIABLE_NODE:
-	
-	st_free (node->variable.name);
-	break;
-
-    default:
-	break;
-    }
-	
-    st_node_destroy (node->next);
-    st_free (node);
-}
-
 
 
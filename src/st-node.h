@@ -82,6 +82,8 @@ struct st_node
 
 	struct {
 	    char *name;
+	    /* the temporary the name refers to, resolved by the generator */
+	    st_pointer binding;
 
 	} variable;
 
@@ -105,12 +107,14 @@ struct st_node
 	    st_node *statements;
 	    st_node *temporaries;
 	    st_node *arguments;
+	    /* set by the generator unless the block is inlined */
+	    st_pointer scope;
 
 	} block;
 
 	struct {
 	    st_node *receiver;
-	    st_list *messages;
+	    st_node *messages;
 	    bool is_statement;
 	    
 	} cascade;
@@ -119,9 +123,11 @@ struct st_node
 
 };
 
-st_node *st_node_new          (st_node_type type);
-
-st_node *st_node_list_append  (st_node *list, st_node *node);
+/*
+ * Nodes are allocated from the arena of the lexer they were parsed from,
+ * and are released along with it by st_lexer_destroy().
+ */
+st_node *st_node_new          (st_arena *arena, st_node_type type);
 
 st_node *st_node_list_at      (st_node *list, st_uint index);
 
@@ -129,7 +135,5 @@ st_uint  st_node_list_length  (st_node *list);
 
 void     st_print_method_node (st_node *method);
 
-void     st_node_destroy      (st_node *node);
-
 #endif /* __ST_NODE_H__ */
 
@@ -36,6 +36,8 @@
 #include "st-handle.h"
 #include "st-unicode.h"
 
+#include <string.h>
+
 void
 st_object_initialize_header (st_oop object, st_oop class)
 {
@@ -93,6 +95,42 @@ st_object_hash (st_oop object)
     return object >> 2;
 }
 
+/*
+ * Equality and hashing for compiled literals, used to share one copy
+ * of equal Float literals between methods. Unlike st_object_equal(),
+ * the classes must match and Floats are compared bit for bit, so 0.0
+ * and -0.0 stay distinct. Hashes don't depend on object addresses, so
+ * they survive a compacting GC.
+ */
+bool
+st_object_literal_equal (st_oop object, st_oop other)
+{
+    double x, y;
+
+    if (object == other)
+	return true;
+
+    if (st_object_class (object) != ST_FLOAT_CLASS || st_object_class (other) != ST_FLOAT_CLASS)
+	return false;
+
+    x = st_float_value (object);
+    y = st_float_value (other);
+    return memcmp (&x, &y, sizeof (double)) == 0;
+}
+
+st_uint
+st_object_literal_hash (st_oop object)
+{
+    double   value;
+    uint64_t bits;
+
+    st_assert (st_object_class (object) == ST_FLOAT_CLASS);
+
+    value = st_float_value (object);
+    memcpy (&bits, &value, sizeof (double));
+    return (st_uint) (bits ^ (bits >> 32));
+}
+
 st_oop
 st_object_allocate (st_oop class)
 {
@@ -37,10 +37,14 @@
 
 /* Every heap-allocated object starts with this header word */
 /* format of mark oop
- * [ unused: 16 | instance-size: 8 | format: 6 | tag: 2 ]
+ * [ unused: 5 | unwind: 1 | captured: 1 | stack-size: 8 | hash: 1 | instance-size: 8 | format: 6 | tag: 2 ]
  *
  *
  * format:      object format
+ * stack-size:  number of stack slots following the fields of a context,
+ *              or of the contexts a block closure is activated in
+ * captured:    a context which may be referred to after it has returned
+ * unwind:      a context with an unwind block (see BlockClosure>>ensure:)
  * mark:        object contains a forwarding pointer
  * unused: 	not used yet (haven't implemented GC)
  * 
@@ -61,7 +65,10 @@ struct st_header
 
 enum
 {
-    _ST_OBJECT_UNUSED_BITS   = 15,
+    _ST_OBJECT_UNUSED_BITS   = 5,
+    _ST_OBJECT_UNWIND_BITS   = 1,
+    _ST_OBJECT_CAPTURED_BITS = 1,
+    _ST_OBJECT_STACK_BITS    = 8,
     _ST_OBJECT_HASH_BITS     = 1,
     _ST_OBJECT_SIZE_BITS     = 8,
     _ST_OBJECT_FORMAT_BITS   = 6,
@@ -69,11 +76,17 @@ enum
     _ST_OBJECT_FORMAT_SHIFT  =  ST_TAG_SIZE,
     _ST_OBJECT_SIZE_SHIFT    = _ST_OBJECT_FORMAT_BITS + _ST_OBJECT_FORMAT_SHIFT,
     _ST_OBJECT_HASH_SHIFT    = _ST_OBJECT_SIZE_BITS  + _ST_OBJECT_SIZE_SHIFT,
-    _ST_OBJECT_UNUSED_SHIFT  = _ST_OBJECT_HASH_BITS   + _ST_OBJECT_HASH_SHIFT,
+    _ST_OBJECT_STACK_SHIFT   = _ST_OBJECT_HASH_BITS   + _ST_OBJECT_HASH_SHIFT,
+    _ST_OBJECT_CAPTURED_SHIFT = _ST_OBJECT_STACK_BITS + _ST_OBJECT_STACK_SHIFT,
+    _ST_OBJECT_UNWIND_SHIFT  = _ST_OBJECT_CAPTURED_BITS + _ST_OBJECT_CAPTURED_SHIFT,
+    _ST_OBJECT_UNUSED_SHIFT  = _ST_OBJECT_UNWIND_BITS + _ST_OBJECT_UNWIND_SHIFT,
 
     _ST_OBJECT_FORMAT_MASK   = ST_NTH_MASK (_ST_OBJECT_FORMAT_BITS),
     _ST_OBJECT_SIZE_MASK     = ST_NTH_MASK (_ST_OBJECT_SIZE_BITS),
     _ST_OBJECT_HASH_MASK     = ST_NTH_MASK (_ST_OBJECT_HASH_BITS),
+    _ST_OBJECT_STACK_MASK    = ST_NTH_MASK (_ST_OBJECT_STACK_BITS),
+    _ST_OBJECT_CAPTURED_MASK = ST_NTH_MASK (_ST_OBJECT_CAPTURED_BITS),
+    _ST_OBJECT_UNWIND_MASK   = ST_NTH_MASK (_ST_OBJECT_UNWIND_BITS),
     _ST_OBJECT_UNUSED_MASK   = ST_NTH_MASK (_ST_OBJECT_UNUSED_BITS),
 };
 
@@ -90,6 +103,7 @@ typedef enum st_format
     ST_FORMAT_INTEGER_ARRAY,
     ST_FORMAT_WORD_ARRAY,
     ST_FORMAT_CONTEXT,
+    ST_FORMAT_MAPPED_BYTES,
     ST_NUM_FORMATS
 } st_format;
 
@@ -97,6 +111,8 @@ st_oop  st_object_allocate          (st_oop class);
 void    st_object_initialize_header (st_oop object, st_oop class);
 bool    st_object_equal             (st_oop object, st_oop other);
 st_uint st_object_hash              (st_oop object);
+bool    st_object_literal_equal     (st_oop object, st_oop other);
+st_uint st_object_literal_hash      (st_oop object);
 
 static inline void
 st_object_set_format (st_oop object, st_format format)
@@ -38,6 +38,7 @@
 #include "st-unicode.h"
 #include "st-behavior.h"
 
+#include <ptr_array.h>
 #include <tommath.h>
 #include <errno.h>
 #include <stdlib.h>
@@ -49,6 +50,9 @@ typedef struct
     st_lexer  *lexer;
     bool      in_block;
 
+    /* nodes are allocated from the lexer's arena */
+    st_arena  *arena;
+
     st_compiler_error *error;  
     jmp_buf   jmploc;
 } st_parser;
@@ -103,6 +107,7 @@ parse_block_arguments (st_parser *parser)
 {
     st_token *token;   
     st_node  *arguments = NULL, *node;
+    st_node **tail = &arguments;
 
     token = current (parser->lexer);
 
@@ -112,10 +117,11 @@ parse_block_arguments (st_parser *parser)
 	if (st_token_get_type (token) != ST_TOKEN_IDENTIFIER)
 	    parse_error (parser,"expected identifier", token);
 
-	node = st_node_new (ST_VARIABLE_NODE);
+	node = st_node_new (parser->arena, ST_VARIABLE_NODE);
 	node->line = st_token_get_line (token);
-	node->variable.name = st_strdup (st_token_get_text (token));
-	arguments = st_node_list_append (arguments, node);
+	node->variable.name = st_token_get_text (token);
+	*tail = node;
+	tail = &node->next;
 
 	token = next (parser);
     }
@@ -137,7 +143,7 @@ parse_block (st_parser *parser)
     st_node  *node;
     bool     nested;
 
-    node = st_node_new (ST_BLOCK_NODE);
+    node = st_node_new (parser->arena, ST_BLOCK_NODE);
     
     // parse block arguments
     token = next (parser);
@@ -186,7 +192,7 @@ parse_number (st_parser *parser)
     
     p = number = st_number_token_number (token);
 
-    node = st_node_new (ST_LITERAL_NODE);
+    node = st_node_new (parser->arena, ST_LITERAL_NODE);
     node->line = st_token_get_line (token);
 
     /* check if there is a decimal point */
@@ -248,7 +254,7 @@ parse_tuple (st_parser *parser)
 {
     st_token *token;
     st_node *node;
-    st_list *items = NULL;
+    ptr_array items = ptr_array_new (8);
 
     token = next (parser);
     while (true) {
@@ -259,14 +265,12 @@ parse_tuple (st_parser *parser)
 	case ST_TOKEN_SYMBOL_CONST:
 	case ST_TOKEN_CHARACTER_CONST:
 	    node = parse_primary (parser);
-	    items = st_list_prepend (items, (st_pointer) node->literal.value);
-	    st_node_destroy (node);
+	    ptr_array_append (items, (st_pointer) node->literal.value);
 	    break;
 	    
 	case ST_TOKEN_LPAREN:
 	    node = parse_tuple (parser);
-	    items = st_list_prepend (items, (st_pointer) node->literal.value);
-	    st_node_destroy (node);
+	    ptr_array_append (items, (st_pointer) node->literal.value);
 	    break;
 	
 	default:
@@ -283,19 +287,16 @@ parse_tuple (st_parser *parser)
     token = next (parser);
     st_oop tuple;
 
-    items = st_list_reverse (items);
-
-    tuple = st_object_new_arrayed (ST_ARRAY_CLASS, st_list_length (items));
+    tuple = st_object_new_arrayed (ST_ARRAY_CLASS, ptr_array_length (items));
 
-    int i = 1;
-    for (st_list *l = items; l; l = l->next)
-	st_array_at_put (tuple, i++, (st_oop) l->data);
+    for (st_uint i = 0; i < ptr_array_length (items); i++)
+	st_array_at_put (tuple, i + 1, (st_oop) ptr_array_get_index (items, i));
     
-    node = st_node_new (ST_LITERAL_NODE);
+    node = st_node_new (parser->arena, ST_LITERAL_NODE);
     node->literal.value = tuple;
     node->line = st_token_get_line (token);
 
-    st_list_destroy (items);
+    ptr_array_free (items);
 
     return node;
 }
@@ -314,9 +315,9 @@ parse_primary (st_parser *parser)
 	
     case ST_TOKEN_IDENTIFIER:
 	
-	node = st_node_new (ST_VARIABLE_NODE);
+	node = st_node_new (parser->arena, ST_VARIABLE_NODE);
 	node->line = st_token_get_line (token);
-	node->variable.name = st_strdup (st_token_get_text (token));
+	node->variable.name = st_token_get_text (token);
 
 	next (parser);
 	break;
@@ -328,7 +329,7 @@ parse_primary (st_parser *parser)
 	
     case ST_TOKEN_STRING_CONST: 
     
-	node = st_node_new (ST_LITERAL_NODE);
+	node = st_node_new (parser->arena, ST_LITERAL_NODE);
 	node->line = st_token_get_line (token);
 	node->literal.value = st_string_new (st_token_get_text (token));
 
@@ -337,7 +338,7 @@ parse_primary (st_parser *parser)
 
     case ST_TOKEN_SYMBOL_CONST:
 
-	node = st_node_new (ST_LITERAL_NODE);
+	node = st_node_new (parser->arena, ST_LITERAL_NODE);
 	node->line = st_token_get_line (token);
 	node->literal.value = st_symbol_new (st_token_get_text (token));
     
@@ -346,7 +347,7 @@ parse_primary (st_parser *parser)
 
     case ST_TOKEN_CHARACTER_CONST:
 
-	node = st_node_new (ST_LITERAL_NODE);
+	node = st_node_new (parser->arena, ST_LITERAL_NODE);
 	node->line = st_token_get_line (token);
 	node->literal.value = st_character_new (st_utf8_get_unichar (st_token_get_text (token)));
 
@@ -378,7 +379,7 @@ parse_unary_message (st_parser *parser, st_node *receiver)
     
     token = current (parser->lexer);
 
-    node = st_node_new (ST_MESSAGE_NODE);
+    node = st_node_new (parser->arena, ST_MESSAGE_NODE);
     node->line = st_token_get_line (token);
     node->message.precedence = ST_UNARY_PRECEDENCE;
     node->message.receiver = receiver;
@@ -425,7 +426,7 @@ parse_binary_message (st_parser *parser, st_node *receiver)
      
     argument = parse_binary_argument (parser, argument);
    
-    node = st_node_new (ST_MESSAGE_NODE);
+    node = st_node_new (parser->arena, ST_MESSAGE_NODE);
     
     node->message.precedence = ST_BINARY_PRECEDENCE;
     node->message.receiver   = receiver;
@@ -468,6 +469,7 @@ parse_keyword_message (st_parser *parser, st_node *receiver)
 {
     st_token *token;
     st_node  *node, *arguments = NULL, *arg;
+    st_node **tail = &arguments;
     char *temp, *string = st_strdup ("");
     
     token = current (parser->lexer);
@@ -480,12 +482,13 @@ parse_keyword_message (st_parser *parser, st_node *receiver)
 
 	token = next (parser);	
 	arg = parse_keyword_argument (parser, NULL);
-	arguments = st_node_list_append (arguments, arg);
+	*tail = arg;
+	tail = &arg->next;
 
 	token = current (parser->lexer);
     }
 
-    node = st_node_new (ST_MESSAGE_NODE);
+    node = st_node_new (parser->arena, ST_MESSAGE_NODE);
 
     node->message.precedence = ST_KEYWORD_PRECEDENCE;
     node->message.receiver = receiver;
@@ -543,7 +546,7 @@ parse_assign (st_parser *parser, st_node *assignee)
 
     expression = parse_expression (parser);
 	
-    node = st_node_new (ST_ASSIGN_NODE);
+    node = st_node_new (parser->arena, ST_ASSIGN_NODE);
     node->line = st_token_get_line (token);
     node->assign.assignee = assignee;
     node->assign.expression = expression;   
@@ -555,16 +558,17 @@ static st_node *
 parse_cascade (st_parser *parser, st_node *first_message)
 {
     st_token *token;
-    st_node *message, *node;
+    st_node *message, *node, **tail;
     bool super_send = first_message->message.super_send;
 
     token = current (parser->lexer);
 
-    node = st_node_new (ST_CASCADE_NODE);
+    node = st_node_new (parser->arena, ST_CASCADE_NODE);
     node->line = st_token_get_line (token);
 
     node->cascade.receiver = first_message->message.receiver;
-    node->cascade.messages = st_list_append (node->cascade.messages, first_message);
+    node->cascade.messages = first_message;
+    tail = &first_message->next;
 
     first_message->message.receiver = NULL;
 
@@ -579,7 +583,8 @@ parse_cascade (st_parser *parser, st_node *first_message)
 	    
 	message->message.super_send = super_send;	    
 
-	node->cascade.messages = st_list_append (node->cascade.messages, message);
+	*tail = message;
+	tail = &message->next;
 	token = current (parser->lexer);
     }
 
@@ -667,7 +672,7 @@ parse_return (st_parser *parser)
    
     token = next (parser);
     
-    node = st_node_new (ST_RETURN_NODE);
+    node = st_node_new (parser->arena, ST_RETURN_NODE);
     node->line = st_token_get_line (token);
     node->retrn.expression = parse_expression (parser);
     
@@ -692,6 +697,7 @@ parse_statements (st_parser *parser)
 {
     st_token *token;
     st_node  *expression = NULL, *statements = NULL;
+    st_node **tail = &statements;
 
     token = current (parser->lexer);
 
@@ -706,7 +712,8 @@ parse_statements (st_parser *parser)
 	}
 
 	expression = parse_statement (parser);
-	statements = st_node_list_append (statements, expression);
+	*tail = expression;
+	tail = &expression->next;
 
 	/* Consume statement delimiter ('.') if there is one.
 	 *
@@ -782,6 +789,7 @@ parse_temporaries (st_parser *parser)
 {
     st_token *token;
     st_node *temporaries = NULL, *temp;
+    st_node **tail = &temporaries;
 
     token = current (parser->lexer);
     
@@ -792,11 +800,12 @@ parse_temporaries (st_parser *parser)
     token = next (parser);
     while (st_token_get_type (token) == ST_TOKEN_IDENTIFIER) {
 
-	temp = st_node_new (ST_VARIABLE_NODE);
+	temp = st_node_new (parser->arena, ST_VARIABLE_NODE);
 	temp->line = st_token_get_line (token);
-	temp->variable.name = st_strdup (st_token_get_text (token));
+	temp->variable.name = st_token_get_text (token);
 	
-	temporaries = st_node_list_append (temporaries, temp);
+	*tail = temp;
+	tail = &temp->next;
    
 	token = next (parser);
     }
@@ -835,9 +844,9 @@ parse_message_pattern (st_parser *parser, st_node *method)
 	if (st_token_get_type (token) != ST_TOKEN_IDENTIFIER)
 	    parse_error (parser,"argument name expected after binary selector", token);
 
-	arguments = st_node_new (ST_VARIABLE_NODE);
+	arguments = st_node_new (parser->arena, ST_VARIABLE_NODE);
 	arguments->line = st_token_get_line (token);
-	arguments->variable.name = st_strdup (st_token_get_text (token));
+	arguments->variable.name = st_token_get_text (token);
 
 	method->method.precedence = ST_BINARY_PRECEDENCE;
 
@@ -846,7 +855,7 @@ parse_message_pattern (st_parser *parser, st_node *method)
     } else if (type == ST_TOKEN_KEYWORD_SELECTOR) {
     
 	char *temp, *string = st_strdup ("");
-      	st_node  *arg;
+      	st_node  *arg, **tail = &arguments;
 
 	while (st_token_get_type (token) == ST_TOKEN_KEYWORD_SELECTOR) {	
 	    
@@ -858,10 +867,11 @@ parse_message_pattern (st_parser *parser, st_node *method)
 	    if (st_token_get_type (token) != ST_TOKEN_IDENTIFIER)
 		parse_error (parser,"argument name expected after keyword", token);	
 	
-	    arg = st_node_new (ST_VARIABLE_NODE);
+	    arg = st_node_new (parser->arena, ST_VARIABLE_NODE);
 	    arg->line = st_token_get_line (token);
-	    arg->variable.name = st_strdup (st_token_get_text (token));
-	    arguments = st_node_list_append (arguments, arg);
+	    arg->variable.name = st_token_get_text (token);
+	    *tail = arg;
+	    tail = &arg->next;
 
 	    token = next (parser);
 	} 
@@ -884,7 +894,7 @@ parse_method (st_parser *parser)
 
     parser->in_block = false;
 
-    node = st_node_new (ST_METHOD_NODE);
+    node = st_node_new (parser->arena, ST_METHOD_NODE);
 
     node->method.primitive = -1;
    
@@ -911,6 +921,7 @@ st_parser_parse (st_lexer *lexer,
     parser = st_new0 (st_parser);
     
     parser->lexer = lexer;
+    parser->arena = st_lexer_get_arena (lexer);
     parser->error = error;
     parser->in_block = false;
 
@@ -925,3 +936,40 @@ st_parser_parse (st_lexer *lexer,
     return method;
 }
 
+
+/*
+ * st_parser_parse_selector:
+ *
+ * Parses only the message pattern of a method and answers its selector,
+ * or ST_NIL if the pattern is invalid. Used for installing lazy method stubs.
+ */
+st_oop
+st_parser_parse_selector (st_lexer *lexer,
+			  st_compiler_error *error)
+{
+    st_parser *parser;
+    st_node   *node;
+    st_oop     selector;
+
+    st_assert (lexer != NULL);
+
+    parser = st_new0 (st_parser);
+
+    parser->lexer = lexer;
+    parser->arena = st_lexer_get_arena (lexer);
+    parser->error = error;
+    parser->in_block = false;
+
+    node = st_node_new (parser->arena, ST_METHOD_NODE);
+
+    if (!setjmp (parser->jmploc)) {
+	parse_message_pattern (parser, node);
+	selector = node->method.selector;
+    } else {
+	selector = ST_NIL;
+    }
+
+    st_free (parser);
+
+    return selector;
+}
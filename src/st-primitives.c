@@ -38,6 +38,9 @@
 #include "st-unicode.h"
 #include "st-compiler.h"
 #include "st-handle.h"
+#include "st-process.h"
+#include "st-mailbox.h"
+#include "st-file.h"
 
 #include <math.h>
 #include <string.h>
@@ -47,6 +50,18 @@
 #include <fcntl.h>
 #include <unistd.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <time.h>
+
+#ifdef MSG_NOSIGNAL
+#define SEND_FLAGS MSG_NOSIGNAL
+#else
+#define SEND_FLAGS 0
+#endif
 
 
 #define ST_PRIMITIVE_FAIL(machine)			\
@@ -1337,6 +1352,10 @@ Object_error (st_machine *machine)
     printf ("Traceback:\n");
     puts (st_byte_array_bytes (traceback));
 
+    /* leave a string on top of the stack for main() to inspect,
+       whatever the context the error was raised in */
+    ST_STACK_PUSH (machine, message);
+
     /* set success to false to signal error */
     machine->success = false;
     longjmp (machine->main_loop, 0);
@@ -1391,8 +1410,13 @@ Object_copy (st_machine *machine)
     case ST_FORMAT_OBJECT:
     {
 	class = ST_OBJECT_CLASS (machine->message_receiver);
-	size = st_smi_value (ST_BEHAVIOR_INSTANCE_SIZE (class));
-	copy = st_object_new (class);
+	/* block closures vary in size with their copied values */
+	size = st_object_instance_size (machine->message_receiver);
+	if (class == ST_BLOCK_CLOSURE_CLASS)
+	    copy = st_memory_allocate_closure (st_block_closure_copied_count (machine->message_receiver),
+					       st_context_stack_size (machine->message_receiver));
+	else
+	    copy = st_object_new (class);
 	st_oops_copy (ST_OBJECT_FIELDS (copy),
 		      ST_OBJECT_FIELDS (machine->message_receiver),
 		      size);
@@ -1460,6 +1484,10 @@ Object_copy (st_machine *machine)
 	copy = st_object_new (ST_HANDLE_CLASS);
 	ST_HANDLE_VALUE (copy) = ST_HANDLE_VALUE (machine->message_receiver);
 	break;
+    case ST_FORMAT_MAPPED_BYTES:
+	/* the mapping is read only, and unmapped by its one object */
+	copy = machine->message_receiver;
+	break;
     case ST_FORMAT_CONTEXT:
     case ST_FORMAT_INTEGER_ARRAY:
     default:
@@ -1488,8 +1516,11 @@ lookup_method (st_oop class, st_oop selector)
 
     while (parent != ST_NIL) {
 	method = st_dictionary_at (ST_BEHAVIOR_METHOD_DICTIONARY (parent), selector);
-	if (method != ST_NIL)
+	if (method != ST_NIL) {
+	    if (st_method_get_flags (method) == ST_METHOD_LAZY)
+		method = st_compile_method_stub (parent, method);
 	    return method;
+	}
 	parent = ST_BEHAVIOR_SUPERCLASS (parent);
     }
 
@@ -1542,13 +1573,8 @@ Object_perform_withArguments (st_machine *machine)
 
     set_success (machine, st_object_format (array) == ST_FORMAT_ARRAY);
 
-    if (ST_OBJECT_CLASS (machine->context) == ST_BLOCK_CONTEXT_CLASS)
-	method = ST_METHOD_CONTEXT_METHOD (ST_BLOCK_CONTEXT_HOME (machine->context));
-    else
-	method = ST_METHOD_CONTEXT_METHOD (machine->context);
-
     array_size = st_smi_value (st_arrayed_object_size (array));
-    set_success (machine, (machine->sp + array_size - 1) < 32);
+    set_success (machine, (machine->sp + array_size - 1) <= st_context_stack_size (machine->context));
 
     if (machine->success) {
 	
@@ -1610,6 +1636,11 @@ Behavior_new (st_machine *machine)
     case ST_FORMAT_HANDLE:
 	instance = st_handle_allocate (class);
 	break;
+    case ST_FORMAT_MAPPED_BYTES:
+	/* made only by mapping a file */
+	set_success (machine, false);
+	ST_STACK_UNPOP (machine, 1);
+	return;
     default:
 	/* should not reach */
 	abort ();
@@ -1646,6 +1677,11 @@ Behavior_newSize (st_machine *machine)
 	/* not implemented */
 	abort ();
 	break;
+    case ST_FORMAT_MAPPED_BYTES:
+	/* made only by mapping a file */
+	set_success (machine, false);
+	ST_STACK_UNPOP (machine, 2);
+	return;
     default:
 	/* should not reach */
 	abort ();
@@ -1681,6 +1717,25 @@ Behavior_compile (st_machine *machine)
     ST_STACK_PUSH (machine, receiver);
 }
 
+/* called after a method is added or removed from Smalltalk */
+static void
+Behavior_methodChanged (st_machine *machine)
+{
+    st_oop receiver;
+    st_oop selector;
+
+    selector = ST_STACK_POP (machine);
+    receiver = ST_STACK_PEEK (machine);
+
+    if (!st_object_is_symbol (selector)) {
+	machine->success = false;
+	ST_STACK_UNPOP (machine, 1);
+	return;
+    }
+
+    st_machine_method_changed (machine, receiver, selector);
+}
+
 static void
 SequenceableCollection_size (st_machine *machine)
 {
@@ -2004,40 +2059,126 @@ FloatArray_at_put (st_machine *machine)
     ST_STACK_PUSH (machine, flt);
 }
 
+/* the elements of an arrayed object, and their size in bytes */
+static st_uchar *
+arrayed_elements (st_oop object, st_uint *width)
+{
+    switch (st_object_format (object)) {
+    case ST_FORMAT_ARRAY:
+	*width = sizeof (st_oop);
+	return (st_uchar *) st_array_elements (object);
+    case ST_FORMAT_BYTE_ARRAY:
+	*width = sizeof (st_uchar);
+	return st_byte_array_bytes (object);
+    case ST_FORMAT_WORD_ARRAY:
+	*width = sizeof (st_uint);
+	return (st_uchar *) st_word_array_elements (object);
+    case ST_FORMAT_FLOAT_ARRAY:
+	*width = sizeof (double);
+	return (st_uchar *) st_float_array_elements (object);
+    default:
+	return NULL;
+    }
+}
+
+/* copies between arrayed objects of the same format, failing for
+ * anything else so that the method copies element by element */
+static void
+ArrayedCollection_replaceFrom_to_with_startingAt (st_machine *machine)
+{
+    st_oop    receiver, replacement;
+    st_uchar *to, *from;
+    st_uint   width;
+    int       start, stop, repStart;
+
+    repStart = pop_integer32 (machine);
+    replacement = ST_STACK_POP (machine);
+    stop = pop_integer32 (machine);
+    start = pop_integer32 (machine);
+    receiver = ST_STACK_PEEK (machine);
+
+    if (!machine->success || !st_object_is_heap (replacement)
+	|| st_object_format (replacement) != st_object_format (receiver)
+	|| (to = arrayed_elements (receiver, &width)) == NULL
+	|| start < 1 || stop > st_smi_value (st_arrayed_object_size (receiver))
+	|| repStart < 1
+	|| repStart + (stop - start) > st_smi_value (st_arrayed_object_size (replacement))) {
+	set_success (machine, false);
+	ST_STACK_UNPOP (machine, 4);
+	return;
+    }
+
+    if (stop >= start) {
+	from = arrayed_elements (replacement, &width);
+	memmove (to + (start - 1) * width, from + (repStart - 1) * width,
+		 (stop - start + 1) * width);
+    }
+
+    /* leave receiver on stack */
+}
+
+/* Creates the activation of the receiving closure, with its copied
+ * values in place above the room for its arguments. The closure is
+ * read again afterwards, as a collection may have moved it.
+ */
+static st_oop
+block_context_new (st_machine *machine, st_uint argcount)
+{
+    st_oop  closure, context;
+    st_uint copied_count, stack_size;
+
+    /* the free list is checked here first, as for method contexts */
+    stack_size = st_context_stack_size (machine->message_receiver);
+    context = memory->free_block_contexts[stack_size];
+    if (ST_LIKELY (context))
+	memory->free_block_contexts[stack_size] = ST_CONTEXT_PART_SENDER (context);
+    else
+	context = st_memory_allocate_context (ST_BLOCK_CONTEXT_CLASS, stack_size);
+    closure = machine->message_receiver;
+    copied_count = st_block_closure_copied_count (closure);
+
+    ST_CONTEXT_PART_SENDER (context)    = machine->context;
+    ST_CONTEXT_PART_IP (context)        = ST_BLOCK_CLOSURE_INITIALIP (closure);
+    ST_CONTEXT_PART_SP (context)        = st_smi_new (argcount + copied_count);
+    ST_BLOCK_CONTEXT_METHOD (context)   = ST_BLOCK_CLOSURE_METHOD (closure);
+    ST_BLOCK_CONTEXT_RECEIVER (context) = ST_BLOCK_CLOSURE_RECEIVER (closure);
+    ST_BLOCK_CONTEXT_CLOSURE (context)  = closure;
+
+    for (st_uint i = 0; i < copied_count; i++)
+	ST_BLOCK_CONTEXT_STACK (context)[argcount + i] = ST_BLOCK_CLOSURE_COPIED (closure)[i];
+
+    return context;
+}
+
 static void
-BlockContext_value (st_machine *machine)
+BlockClosure_value (st_machine *machine)
 {
-    st_oop  block;
-    st_uint  argcount;
-    st_oop home;
+    st_oop  context;
+    st_uint argcount;
 
-    block = machine->message_receiver;
-    argcount = st_smi_value (ST_BLOCK_CONTEXT_ARGCOUNT (block));
+    argcount = st_smi_value (ST_BLOCK_CLOSURE_ARGCOUNT (machine->message_receiver));
     if (ST_UNLIKELY (argcount != machine->message_argcount)) {
 	machine->success = false;
 	return;
     }
 
-    st_oops_copy (ST_BLOCK_CONTEXT_STACK (block),
+    context = block_context_new (machine, argcount);
+
+    st_oops_copy (ST_BLOCK_CONTEXT_STACK (context),
 		  machine->stack + machine->sp - argcount,
 		  argcount);
     machine->sp -= machine->message_argcount + 1;
     
-    ST_CONTEXT_PART_IP (block) = ST_BLOCK_CONTEXT_INITIALIP (block);
-    ST_CONTEXT_PART_SP (block) = st_smi_new (argcount);
-    ST_CONTEXT_PART_SENDER (block) = machine->context;
-
-    st_machine_set_active_context (machine, block);
+    st_machine_set_active_context (machine, context);
 }
 
 static void
-BlockContext_valueWithArguments (st_machine *machine)
+BlockClosure_valueWithArguments (st_machine *machine)
 {
-    st_oop block;
+    st_oop context;
     st_oop values;
     int argcount;
 
-    block  = machine->message_receiver;
     values = ST_STACK_PEEK (machine);
 
     if (st_object_class (values) != ST_ARRAY_CLASS) {
@@ -2045,204 +2186,1334 @@ BlockContext_valueWithArguments (st_machine *machine)
 	return;
     }
 
-    argcount = st_smi_value (ST_BLOCK_CONTEXT_ARGCOUNT (block));
+    argcount = st_smi_value (ST_BLOCK_CLOSURE_ARGCOUNT (machine->message_receiver));
     if (argcount != st_smi_value (st_arrayed_object_size (values))) {
 	set_success (machine, false);
 	return;
     }
+
+    context = block_context_new (machine, argcount);
+    values  = ST_STACK_PEEK (machine);
     
-    st_oops_copy (ST_BLOCK_CONTEXT_STACK (block),
+    st_oops_copy (ST_BLOCK_CONTEXT_STACK (context),
 		  ST_ARRAY (values)->elements,
 		  argcount);
     
     machine->sp -= machine->message_argcount + 1;
 
-    ST_CONTEXT_PART_IP (block) = ST_BLOCK_CONTEXT_INITIALIP (block);
-    ST_CONTEXT_PART_SP (block) = st_smi_new (argcount);
-    ST_CONTEXT_PART_SENDER (block) = machine->context;
+    st_machine_set_active_context (machine, context);
+}
 
-    st_machine_set_active_context (machine, block);
+static inline st_oop *
+context_stack (st_oop context)
+{
+    if (ST_OBJECT_CLASS (context) == ST_BLOCK_CONTEXT_CLASS)
+	return ST_BLOCK_CONTEXT_STACK (context);
+    else
+	return ST_METHOD_CONTEXT_STACK (context);
 }
 
 static void
-System_exitWithResult (st_machine *machine)
+ContextPart_tempAt (st_machine *machine)
 {
-    /* set success to true to signal that everything was alright */
-    machine->success = true;
-    longjmp (machine->main_loop, 0);
+    int    index   = pop_integer (machine);
+    st_oop context = ST_STACK_POP (machine);
+
+    if (ST_UNLIKELY (!machine->success || index < 1 || index > st_context_stack_size (context))) {
+	set_success (machine, false);
+	ST_STACK_UNPOP (machine, 2);
+	return;
+    }
+
+    ST_STACK_PUSH (machine, context_stack (context)[index - 1]);
 }
 
 static void
-Character_value (st_machine *machine)
+ContextPart_tempAt_put (st_machine *machine)
 {
-    st_oop receiver = ST_STACK_POP (machine);
+    st_oop object  = ST_STACK_POP (machine);
+    int    index   = pop_integer (machine);
+    st_oop context = ST_STACK_POP (machine);
 
-    ST_STACK_PUSH (machine, st_smi_new (st_character_value (receiver)));
+    if (ST_UNLIKELY (!machine->success || index < 1 || index > st_context_stack_size (context))) {
+	set_success (machine, false);
+	ST_STACK_UNPOP (machine, 3);
+	return;
+    }
+
+    ST_STACK_PUSH (machine, context_stack (context)[index - 1] = object);
 }
 
 static void
-Character_characterFor (st_machine *machine)
+ContextPart_markForUnwind (st_machine *machine)
 {
-    st_oop receiver;
-    int value;
+    st_oop context = ST_STACK_PEEK (machine);
 
-    value = pop_integer (machine);
-    receiver = ST_STACK_POP (machine);
+    /* an unwind context may be returned from by a ^ in a block,
+       after which it must be left alone */
+    if (!st_context_is_unwind (context)) {
+	st_context_set_captured (context);
+	st_context_set_unwind (context, true);
+	machine->unwind_count++;
+    }
+}
 
-    if (machine->success)
-	ST_STACK_PUSH (machine, st_character_new (value));
-    else
-	ST_STACK_UNPOP (machine, 2);
+static void
+ContextPart_nextUnwindContextUpTo (st_machine *machine)
+{
+    st_oop limit   = ST_STACK_POP (machine);
+    st_oop context = ST_STACK_POP (machine);
+
+    ST_STACK_PUSH (machine, st_context_find_unwind (ST_CONTEXT_PART_SENDER (context), limit));
 }
 
 static void
-FileStream_open (st_machine *machine)
+ContextPart_return (st_machine *machine)
 {
-    st_oop filename;
-    st_oop handle;
-    char  *str;
-    int flags, mode;
-    int fd;
+    st_oop value   = ST_STACK_POP (machine);
+    st_oop context = ST_STACK_POP (machine);
 
-    mode     = pop_integer32 (machine);
-    filename = ST_STACK_POP (machine);
-    if (st_object_format (filename) != ST_FORMAT_BYTE_ARRAY) {
-	machine->success = false;
+    if (ST_UNLIKELY (ST_CONTEXT_PART_SENDER (context) == ST_NIL)) {
+	set_success (machine, false);
 	ST_STACK_UNPOP (machine, 2);
 	return;
     }
 
-    if (mode == 0)
-	flags = O_RDONLY;
-    else if (mode == 1)
-	flags = O_WRONLY;
-    else {
-	machine->success = false;
-	ST_STACK_UNPOP (machine, 2);
+    st_machine_return_from (machine, context, value);
+}
+
+/* Always fails. It only marks BlockClosure>>on:do: so that its
+ * activations can be told apart when an exception is signaled.
+ */
+static void
+BlockClosure_on_do (st_machine *machine)
+{
+    machine->success = false;
+}
+
+static inline bool
+is_active_handler (st_oop context)
+{
+    st_oop method;
+
+    if (ST_OBJECT_CLASS (context) != ST_METHOD_CONTEXT_CLASS)
+	return false;
+
+    method = ST_METHOD_CONTEXT_METHOD (context);
+    if (st_method_get_flags (method) != ST_METHOD_PRIMITIVE ||
+	st_primitives[st_method_get_primitive_index (method)].func != BlockClosure_on_do)
+	return false;
+
+    /* the handlerActive temp of on:do: */
+    return ST_METHOD_CONTEXT_STACK (context)[2] == ST_TRUE;
+}
+
+static void
+ContextPart_nextHandlerContext (st_machine *machine)
+{
+    st_oop context = ST_STACK_POP (machine);
+
+    context = ST_CONTEXT_PART_SENDER (context);
+    while (context != ST_NIL && !is_active_handler (context))
+	context = ST_CONTEXT_PART_SENDER (context);
+
+    /* it is held on to by the exception */
+    if (context != ST_NIL)
+	st_context_set_captured (context);
+
+    ST_STACK_PUSH (machine, context);
+}
+
+static void
+ContextPart_restart (st_machine *machine)
+{
+    st_oop context = ST_STACK_PEEK (machine);
+
+    if (ST_UNLIKELY (ST_OBJECT_CLASS (context) != ST_METHOD_CONTEXT_CLASS ||
+		     ST_CONTEXT_PART_SENDER (context) == ST_NIL)) {
+	set_success (machine, false);
 	return;
     }
 
-    str = st_byte_array_bytes (filename);
+    (void) ST_STACK_POP (machine);
+    st_machine_restart (machine, context);
+}
 
-    fd = open (str, O_WRONLY | O_CREAT, 0644);
-    if (fd < 0) {
-	fprintf (stderr, strerror (errno));
-	machine->success = false;
-	ST_STACK_UNPOP (machine, 2);
+/* creates an activation of the receiver with no sender, to start a process with */
+static void
+BlockClosure_newContext (st_machine *machine)
+{
+    st_oop context;
+
+    if (st_smi_value (ST_BLOCK_CLOSURE_ARGCOUNT (machine->message_receiver)) != 0) {
+	set_success (machine, false);
 	return;
     }
 
-    ftruncate (fd, 0);
+    context = block_context_new (machine, 0);
+    ST_CONTEXT_PART_SENDER (context) = ST_NIL;
 
-    /* pop receiver */
     (void) ST_STACK_POP (machine);
+    ST_STACK_PUSH (machine, context);
+}
 
-    handle = st_object_new (ST_HANDLE_CLASS);
-    ST_HANDLE_VALUE (handle) = fd;
+/* The process primitives below leave their result on the stack
+ * before a switch, it is found there when the process runs again.
+ */
+static void
+Process_resume (st_machine *machine)
+{
+    if (!st_process_resume (machine, ST_STACK_PEEK (machine)))
+	set_success (machine, false);
+}
 
-    ST_STACK_PUSH (machine, handle);
+static void
+Process_suspend (st_machine *machine)
+{
+    if (!st_process_suspend (machine, ST_STACK_PEEK (machine)))
+	set_success (machine, false);
 }
 
 static void
-FileStream_close (st_machine *machine)
+Process_terminate (st_machine *machine)
+{
+    st_process_terminate (machine, ST_STACK_PEEK (machine));
+}
+
+static void
+ProcessorScheduler_yield (st_machine *machine)
+{
+    st_process_yield (machine);
+}
+
+static void
+ProcessorScheduler_waitForIO (st_machine *machine)
 {
-    st_oop handle;
-    int    fd;
+    st_oop descriptor;
+    int events, fd = -1;
 
-    handle = ST_STACK_POP (machine);
-    fd = ST_HANDLE_VALUE (handle);
+    events = pop_integer (machine);
+    descriptor = ST_STACK_POP (machine);
 
-    if (close (fd) < 0) {
-	machine->success = false;
-	ST_STACK_UNPOP (machine, 1);
+    if (st_object_is_smi (descriptor))
+	fd = st_smi_value (descriptor);
+
+    if (!machine->success || fd < 0 || events < ST_PROCESS_WAIT_READ ||
+	events > (ST_PROCESS_WAIT_READ | ST_PROCESS_WAIT_WRITE)) {
+	set_success (machine, false);
+	ST_STACK_UNPOP (machine, 2);
 	return;
     }
 
-    /* leave receiver on stack */
+    st_process_wait_for_io (machine, fd, events);
+}
 
+static void
+Semaphore_signal (st_machine *machine)
+{
+    st_semaphore_signal (machine, ST_STACK_PEEK (machine));
 }
 
 static void
-FileStream_write (st_machine *machine)
+Semaphore_wait (st_machine *machine)
 {
-    st_oop handle;
-    st_oop array;
-    int fd;
-    char *buffer;
-    size_t total, size;
-    ssize_t count;
+    st_semaphore_wait (machine, ST_STACK_PEEK (machine));
+}
 
-    array = ST_STACK_POP (machine);
-    handle = ST_STACK_POP (machine);
-    if (st_object_format (array) != ST_FORMAT_BYTE_ARRAY) {
-	machine->success = false;
+static void
+VirtualMachine_current (st_machine *machine)
+{
+    (void) ST_STACK_POP (machine);
+    ST_STACK_PUSH (machine, st_smi_new (st_mailbox_current_id ()));
+}
+
+static void
+VirtualMachine_parent (st_machine *machine)
+{
+    (void) ST_STACK_POP (machine);
+    ST_STACK_PUSH (machine, st_smi_new (st_mailbox_parent_id ()));
+}
+
+static void
+VirtualMachine_spawn (st_machine *machine)
+{
+    st_oop source;
+    char  *string;
+    int    id;
+
+    source = ST_STACK_POP (machine);
+    if (st_object_is_smi (source) || st_object_format (source) != ST_FORMAT_BYTE_ARRAY) {
+	set_success (machine, false);
 	ST_STACK_UNPOP (machine, 1);
 	return;
     }
-    if (st_object_format (handle) != ST_FORMAT_HANDLE) {
-	machine->success = false;
-	ST_STACK_UNPOP (machine, 2);
+
+    string = st_strndup ((char *) st_byte_array_bytes (source),
+			 st_smi_value (st_arrayed_object_size (source)));
+    id = st_mailbox_spawn (string);
+    st_free (string);
+
+    if (id == 0) {
+	set_success (machine, false);
+	ST_STACK_UNPOP (machine, 1);
 	return;
     }
 
-    fd = ST_HANDLE_VALUE (handle);
-    buffer = st_byte_array_bytes (array);
-    size = st_smi_value (st_arrayed_object_size (array));
-    
-    total = 0;
-    while (total < size) {
-	count = write (fd, buffer + total, size - total);
-	if (count < 0) {
-	    machine->success = false;
-	    ST_STACK_UNPOP (machine, 2);
-	    return;
-	}
-	total += count;
+    (void) ST_STACK_POP (machine);
+    ST_STACK_PUSH (machine, st_smi_new (id));
+}
+
+static void
+VirtualMachine_post (st_machine *machine)
+{
+    st_oop object;
+    int    id;
+
+    id = pop_integer (machine);
+    object = ST_STACK_POP (machine);
+
+    if (!machine->success || !st_mailbox_post (id, object)) {
+	set_success (machine, false);
+	ST_STACK_UNPOP (machine, 2);
+	return;
     }
 
     /* leave receiver on stack */
 }
 
 static void
-FileStream_seek (st_machine *machine)
+Mailbox_descriptor (st_machine *machine)
 {
-    /* not implemented yet */
-    abort ();
+    int fd = st_mailbox_descriptor ();
+
+    if (fd < 0) {
+	set_success (machine, false);
+	return;
+    }
+
+    (void) ST_STACK_POP (machine);
+    ST_STACK_PUSH (machine, st_smi_new (fd));
 }
 
+/* fails if there is no message, leaving the method to answer its
+ * argument */
 static void
-FileStream_read (st_machine *machine)
+Mailbox_receive (st_machine *machine)
 {
-    /* not implemented yet */
-    abort (); 
+    st_oop object;
+
+    if (!st_mailbox_receive (&object)) {
+	set_success (machine, false);
+	return;
+    }
+
+    (void) ST_STACK_POP (machine);
+    (void) ST_STACK_POP (machine);
+    ST_STACK_PUSH (machine, object);
 }
 
-const struct st_primitive st_primitives[] = {
-    { "SmallInteger_add",      SmallInteger_add      },
-    { "SmallInteger_sub",      SmallInteger_sub      },
-    { "SmallInteger_lt",       SmallInteger_lt       },
-    { "SmallInteger_gt",       SmallInteger_gt       },
-    { "SmallInteger_le",       SmallInteger_le       },
-    { "SmallInteger_ge",       SmallInteger_ge       },
-    { "SmallInteger_eq",       SmallInteger_eq       },
-    { "SmallInteger_ne",       SmallInteger_ne       },
-    { "SmallInteger_mul",      SmallInteger_mul      },
-    { "SmallInteger_div",      SmallInteger_div      },
-    { "SmallInteger_intDiv",   SmallInteger_intDiv   },
-    { "SmallInteger_mod",      SmallInteger_mod      },
-    { "SmallInteger_bitOr",    SmallInteger_bitOr    },
-    { "SmallInteger_bitXor",   SmallInteger_bitXor   },
-    { "SmallInteger_bitAnd",   SmallInteger_bitAnd   },
-    { "SmallInteger_bitShift", SmallInteger_bitShift },
-    { "SmallInteger_asFloat",         SmallInteger_asFloat  },
-    { "SmallInteger_asLargeInteger",  SmallInteger_asLargeInteger  },
+static void
+System_exitWithResult (st_machine *machine)
+{
+    /* set success to true to signal that everything was alright */
+    machine->success = true;
+    longjmp (machine->main_loop, 0);
+}
 
-    { "LargeInteger_add",      LargeInteger_add      },
-    { "LargeInteger_sub",      LargeInteger_sub      },
-    { "LargeInteger_lt",       LargeInteger_lt       },
-    { "LargeInteger_gt",       LargeInteger_gt       },
-    { "LargeInteger_le",       LargeInteger_le       },
-    { "LargeInteger_ge",       LargeInteger_ge       },
+/* milliseconds since the first call, which keeps the clock a SmallInteger */
+static void
+System_millisecondClock (st_machine *machine)
+{
+    static struct timespec start = { 0, 0 };
+    struct timespec now;
+
+    clock_gettime (CLOCK_MONOTONIC, &now);
+    if (start.tv_sec == 0 && start.tv_nsec == 0)
+	start = now;
+
+    (void) ST_STACK_POP (machine);
+    ST_STACK_PUSH (machine, st_smi_new ((now.tv_sec - start.tv_sec) * 1000
+					+ (now.tv_nsec - start.tv_nsec) / 1000000));
+}
+
+static void
+System_processorCount (st_machine *machine)
+{
+    long count = sysconf (_SC_NPROCESSORS_ONLN);
+
+    (void) ST_STACK_POP (machine);
+    ST_STACK_PUSH (machine, st_smi_new (count < 1 ? 1 : count));
+}
+
+static void
+Character_value (st_machine *machine)
+{
+    st_oop receiver = ST_STACK_POP (machine);
+
+    ST_STACK_PUSH (machine, st_smi_new (st_character_value (receiver)));
+}
+
+static void
+Character_characterFor (st_machine *machine)
+{
+    st_oop receiver;
+    int value;
+
+    value = pop_integer (machine);
+    receiver = ST_STACK_POP (machine);
+
+    if (machine->success)
+	ST_STACK_PUSH (machine, st_character_new (value));
+    else
+	ST_STACK_UNPOP (machine, 2);
+}
+
+static void
+FileStream_open (st_machine *machine)
+{
+    st_oop   filename;
+    st_oop   handle;
+    st_file *file;
+    int      mode;
+
+    mode     = pop_integer32 (machine);
+    filename = ST_STACK_POP (machine);
+    if (!machine->success || st_object_is_smi (filename)
+	|| st_object_format (filename) != ST_FORMAT_BYTE_ARRAY) {
+	machine->success = false;
+	ST_STACK_UNPOP (machine, 2);
+	return;
+    }
+
+    file = st_file_open ((char *) st_byte_array_bytes (filename), mode);
+    if (file == NULL) {
+	machine->success = false;
+	ST_STACK_UNPOP (machine, 2);
+	return;
+    }
+
+    /* pop receiver */
+    (void) ST_STACK_POP (machine);
+
+    handle = st_object_new (ST_HANDLE_CLASS);
+    ST_HANDLE_VALUE (handle) = (uintptr_t) file;
+
+    ST_STACK_PUSH (machine, handle);
+}
+
+/* answers the reading and the writing ends of a new pipe */
+static void
+FileStream_pipe (st_machine *machine)
+{
+    st_oop ends, handle;
+    int    fds[2];
+
+    if (pipe (fds) < 0) {
+	set_success (machine, false);
+	return;
+    }
+
+    (void) ST_STACK_POP (machine);
+    ends = st_object_new_arrayed (ST_ARRAY_CLASS, 2);
+    ST_STACK_PUSH (machine, ends);
+
+    /* the array is kept on the stack while the handles are made */
+    for (int i = 0; i < 2; i++) {
+	fcntl (fds[i], F_SETFL, O_NONBLOCK);
+	fcntl (fds[i], F_SETFD, FD_CLOEXEC);
+	handle = st_object_new (ST_HANDLE_CLASS);
+	ST_HANDLE_VALUE (handle) = (uintptr_t) st_file_new (fds[i]);
+	st_array_at_put (ST_STACK_PEEK (machine), i + 1, handle);
+    }
+}
+
+/* the buffers held by a FileStream's handle, which is cleared when the
+ * stream is closed */
+static st_file *
+pop_file (st_machine *machine)
+{
+    st_oop handle = ST_STACK_POP (machine);
+
+    if (st_object_is_smi (handle) || st_object_format (handle) != ST_FORMAT_HANDLE
+	|| ST_HANDLE_VALUE (handle) == 0) {
+	set_success (machine, false);
+	return NULL;
+    }
+
+    return (st_file *) ST_HANDLE_VALUE (handle);
+}
+
+static st_oop
+new_bytes (st_oop class, const st_uchar *bytes, st_uint count)
+{
+    st_oop array;
+
+    array = st_object_new_arrayed (class, count);
+    memcpy (st_byte_array_bytes (array), bytes, count);
+
+    return array;
+}
+
+static void
+FileStream_close (st_machine *machine)
+{
+    st_oop   handle;
+    st_file *file;
+
+    handle = ST_STACK_PEEK (machine);
+    file = pop_file (machine);
+    if (file == NULL) {
+	ST_STACK_UNPOP (machine, 1);
+	return;
+    }
+
+    ST_HANDLE_VALUE (handle) = 0;
+    if (!st_file_close (file)) {
+	machine->success = false;
+	ST_STACK_UNPOP (machine, 1);
+	return;
+    }
+
+    /* leave receiver on stack */
+}
+
+static void
+FileStream_descriptor (st_machine *machine)
+{
+    st_file *file = pop_file (machine);
+
+    if (file == NULL) {
+	ST_STACK_UNPOP (machine, 1);
+	return;
+    }
+
+    (void) ST_STACK_POP (machine);
+    ST_STACK_PUSH (machine, st_smi_new (file->fd));
+}
+
+/* Reads once into the buffer, answering false at end of file and nil
+ * if the descriptor has nothing to read yet.
+ */
+static void
+FileStream_fill (st_machine *machine)
+{
+    st_file *file;
+    int      count;
+
+    file = pop_file (machine);
+    if (file == NULL) {
+	ST_STACK_UNPOP (machine, 1);
+	return;
+    }
+
+    count = st_file_fill (file);
+    if (count < 0 && errno != EAGAIN && errno != EWOULDBLOCK) {
+	set_success (machine, false);
+	ST_STACK_UNPOP (machine, 1);
+	return;
+    }
+
+    (void) ST_STACK_POP (machine);
+    ST_STACK_PUSH (machine, count > 0 ? ST_TRUE : count == 0 ? ST_FALSE : ST_NIL);
+}
+
+static void
+FileStream_available (st_machine *machine)
+{
+    st_file *file = pop_file (machine);
+
+    if (file == NULL) {
+	ST_STACK_UNPOP (machine, 1);
+	return;
+    }
+
+    (void) ST_STACK_POP (machine);
+    ST_STACK_PUSH (machine, st_smi_new (st_file_available (file)));
+}
+
+/* fails once the buffer is empty */
+static void
+FileStream_next (st_machine *machine)
+{
+    st_file *file = pop_file (machine);
+
+    if (file == NULL || file->start == file->end) {
+	set_success (machine, false);
+	ST_STACK_UNPOP (machine, 1);
+	return;
+    }
+
+    (void) ST_STACK_POP (machine);
+    ST_STACK_PUSH (machine, st_smi_new (file->in[file->start++]));
+}
+
+/* Answers the next `count' bytes, failing if fewer are in the buffer
+ * unless the caller has found the end of the file.
+ */
+static void
+FileStream_next_count (st_machine *machine)
+{
+    st_oop   at_end, bytes;
+    st_file *file;
+    int      count;
+
+    at_end = ST_STACK_POP (machine);
+    count = pop_integer32 (machine);
+    file = pop_file (machine);
+
+    if (file == NULL || !machine->success || count < 0
+	|| (count > st_file_available (file) && at_end != ST_TRUE)) {
+	set_success (machine, false);
+	ST_STACK_UNPOP (machine, 3);
+	return;
+    }
+
+    count = MIN (count, st_file_available (file));
+    bytes = new_bytes (ST_BYTE_ARRAY_CLASS, file->in + file->start, count);
+    file->start += count;
+
+    (void) ST_STACK_POP (machine);
+    ST_STACK_PUSH (machine, bytes);
+}
+
+/* Answers the bytes before the next `delimiter' as a String, skipping
+ * the delimiter. Fails if there is no delimiter in the buffer, unless
+ * the caller has found the end of the file.
+ */
+static void
+FileStream_upTo (st_machine *machine)
+{
+    st_oop    at_end, string;
+    st_file  *file;
+    st_uchar *found;
+    st_uint   count, skip;
+    int       delimiter;
+
+    at_end = ST_STACK_POP (machine);
+    delimiter = pop_integer32 (machine);
+    file = pop_file (machine);
+
+    if (file == NULL || !machine->success) {
+	set_success (machine, false);
+	ST_STACK_UNPOP (machine, 3);
+	return;
+    }
+
+    found = memchr (file->in + file->start, delimiter, st_file_available (file));
+    if (found != NULL) {
+	count = found - (file->in + file->start);
+	skip = 1;
+    } else if (at_end == ST_TRUE) {
+	count = st_file_available (file);
+	skip = 0;
+    } else {
+	set_success (machine, false);
+	ST_STACK_UNPOP (machine, 3);
+	return;
+    }
+
+    string = new_bytes (ST_STRING_CLASS, file->in + file->start, count);
+    file->start += count + skip;
+
+    (void) ST_STACK_POP (machine);
+    ST_STACK_PUSH (machine, string);
+}
+
+/* Writes a byte, a Character or the bytes of a String or ByteArray,
+ * answering false once the buffer is full and the caller should wait
+ * for the descriptor to take it.
+ */
+static void
+FileStream_write (st_machine *machine)
+{
+    st_oop   object;
+    st_file *file;
+    st_uchar byte;
+    bool     written;
+
+    object = ST_STACK_POP (machine);
+    file = pop_file (machine);
+    if (file == NULL) {
+	ST_STACK_UNPOP (machine, 2);
+	return;
+    }
+
+    if (st_object_is_smi (object) && st_smi_value (object) >= 0 && st_smi_value (object) <= 255) {
+	byte = st_smi_value (object);
+	written = st_file_write (file, &byte, 1);
+    } else if (st_object_is_character (object) && st_character_value (object) <= 255) {
+	byte = st_character_value (object);
+	written = st_file_write (file, &byte, 1);
+    } else if (st_object_is_heap (object) && st_object_format (object) == ST_FORMAT_BYTE_ARRAY) {
+	written = st_file_write (file, st_byte_array_bytes (object),
+				 st_smi_value (st_arrayed_object_size (object)));
+    } else {
+	written = false;
+    }
+
+    if (!written) {
+	set_success (machine, false);
+	ST_STACK_UNPOP (machine, 2);
+	return;
+    }
+
+    (void) ST_STACK_POP (machine);
+    ST_STACK_PUSH (machine, st_file_pending (file) < ST_FILE_BUFFER_SIZE ? ST_TRUE : ST_FALSE);
+}
+
+/* the bytes of a String or ByteArray from `start' to `stop', if they
+ * are within it */
+static st_uchar *
+byte_range (st_oop object, int start, int stop)
+{
+    if (st_object_is_smi (object) || st_object_format (object) != ST_FORMAT_BYTE_ARRAY
+	|| start < 1 || stop < start - 1 || stop > st_smi_value (st_arrayed_object_size (object)))
+	return NULL;
+
+    return st_byte_array_bytes (object) + start - 1;
+}
+
+/* Fills `pieces' from the first `count' elements of an Array of
+ * segments, each a String or ByteArray followed by the indices of its
+ * first and last bytes, leaving out the first `skip' bytes. Returns the
+ * number of pieces, or -1 if there are too many or one isn't valid.
+ */
+static int
+gather_pieces (st_oop segments, int count, st_uint skip, struct iovec *pieces)
+{
+    st_uchar *bytes;
+    st_uint   size;
+    int       n = 0, start, stop;
+
+    if (st_object_is_smi (segments) || st_object_format (segments) != ST_FORMAT_ARRAY
+	|| count < 0 || count % 3 != 0 || count > 3 * ST_FILE_MAX_PIECES
+	|| count > st_smi_value (st_arrayed_object_size (segments)))
+	return -1;
+
+    for (int i = 1; i <= count; i += 3) {
+	if (!st_object_is_smi (st_array_at (segments, i + 1)) || !st_object_is_smi (st_array_at (segments, i + 2)))
+	    return -1;
+	start = st_smi_value (st_array_at (segments, i + 1));
+	stop = st_smi_value (st_array_at (segments, i + 2));
+	bytes = byte_range (st_array_at (segments, i), start, stop);
+	if (bytes == NULL)
+	    return -1;
+
+	size = stop - start + 1;
+	if (skip >= size) {
+	    skip -= size;
+	    continue;
+	}
+	pieces[n].iov_base = bytes + skip;
+	pieces[n].iov_len = size - skip;
+	skip = 0;
+	n++;
+    }
+
+    return n;
+}
+
+/* Writes the buffer and the bytes of an Array of segments, see
+ * gather_pieces(), with one writev(2). Answers false once the buffer is
+ * full, like FileStream_write.
+ */
+static void
+FileStream_writev (st_machine *machine)
+{
+    struct iovec pieces[ST_FILE_MAX_PIECES];
+    st_oop   segments;
+    st_file *file;
+    int      count, n;
+
+    count = pop_integer32 (machine);
+    segments = ST_STACK_POP (machine);
+    file = pop_file (machine);
+
+    if (file == NULL || !machine->success
+	|| (n = gather_pieces (segments, count, 0, pieces)) < 0
+	|| !st_file_writev (file, pieces, n)) {
+	set_success (machine, false);
+	ST_STACK_UNPOP (machine, 3);
+	return;
+    }
+
+    (void) ST_STACK_POP (machine);
+    ST_STACK_PUSH (machine, st_file_pending (file) < ST_FILE_BUFFER_SIZE ? ST_TRUE : ST_FALSE);
+}
+
+/* answers false if some of the buffer is still to be written */
+static void
+FileStream_flush (st_machine *machine)
+{
+    st_file *file = pop_file (machine);
+
+    if (file == NULL || !st_file_flush (file)) {
+	set_success (machine, false);
+	ST_STACK_UNPOP (machine, 1);
+	return;
+    }
+
+    (void) ST_STACK_POP (machine);
+    ST_STACK_PUSH (machine, st_file_pending (file) == 0 ? ST_TRUE : ST_FALSE);
+}
+
+/* Maps the whole of a file read only. Fails for files which are too
+ * large to be indexed by SmallIntegers.
+ */
+static void
+MappedFile_open (st_machine *machine)
+{
+    st_oop      filename, file;
+    st_uchar   *bytes = NULL;
+    struct stat info;
+    int         fd;
+
+    filename = ST_STACK_POP (machine);
+    if (st_object_is_smi (filename) || st_object_format (filename) != ST_FORMAT_BYTE_ARRAY) {
+	set_success (machine, false);
+	ST_STACK_UNPOP (machine, 1);
+	return;
+    }
+
+    fd = open ((char *) st_byte_array_bytes (filename), O_RDONLY);
+    if (fd < 0 || fstat (fd, &info) < 0 || info.st_size > ST_SMALL_INTEGER_MAX) {
+	if (fd >= 0)
+	    close (fd);
+	set_success (machine, false);
+	ST_STACK_UNPOP (machine, 1);
+	return;
+    }
+
+    /* an empty file has nothing to map. Mappings cost next to nothing
+       in the heap, so when there is no room for another, a collection
+       is the only way to release those which are no longer used. */
+    if (info.st_size > 0) {
+	bytes = mmap (NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (bytes == MAP_FAILED) {
+	    st_memory_perform_gc ();
+	    bytes = mmap (NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	}
+	if (bytes == MAP_FAILED) {
+	    close (fd);
+	    set_success (machine, false);
+	    ST_STACK_UNPOP (machine, 1);
+	    return;
+	}
+    }
+    close (fd);
+
+    file = st_mapped_bytes_new (ST_MAPPED_FILE_CLASS, bytes, info.st_size);
+    (void) ST_STACK_POP (machine);
+    ST_STACK_PUSH (machine, file);
+}
+
+static void
+MappedFile_at (st_machine *machine)
+{
+    st_oop receiver;
+    int    index;
+
+    index = pop_integer32 (machine);
+    receiver = ST_STACK_POP (machine);
+
+    if (!machine->success || index < 1 || index > st_smi_value (st_arrayed_object_size (receiver))) {
+	set_success (machine, false);
+	ST_STACK_UNPOP (machine, 2);
+	return;
+    }
+
+    ST_STACK_PUSH (machine, st_smi_new (st_mapped_bytes (receiver)[index - 1]));
+}
+
+/* answers a copy of bytes `start' to `stop' as an instance of `class' */
+static void
+copy_mapped_bytes (st_machine *machine, st_oop class, int start, int stop, int count)
+{
+    st_oop receiver, copy;
+    int    size;
+
+    receiver = ST_STACK_PEEK (machine);
+    size = st_smi_value (st_arrayed_object_size (receiver));
+
+    if (!machine->success || start < 1 || stop > size || stop < start - 1) {
+	set_success (machine, false);
+	ST_STACK_UNPOP (machine, count);
+	return;
+    }
+
+    copy = st_object_new_arrayed (class, stop - start + 1);
+    receiver = ST_STACK_POP (machine);
+    memcpy (st_byte_array_bytes (copy), st_mapped_bytes (receiver) + start - 1, stop - start + 1);
+
+    ST_STACK_PUSH (machine, copy);
+}
+
+static void
+MappedFile_copyFrom_to (st_machine *machine)
+{
+    int start, stop;
+
+    stop = pop_integer32 (machine);
+    start = pop_integer32 (machine);
+
+    copy_mapped_bytes (machine, ST_BYTE_ARRAY_CLASS, start, stop, 2);
+}
+
+static void
+MappedFile_copyStringFrom_to (st_machine *machine)
+{
+    int start, stop;
+
+    stop = pop_integer32 (machine);
+    start = pop_integer32 (machine);
+
+    copy_mapped_bytes (machine, ST_STRING_CLASS, start, stop, 2);
+}
+
+static void
+MappedFile_asString (st_machine *machine)
+{
+    copy_mapped_bytes (machine, ST_STRING_CLASS, 1,
+		       st_smi_value (st_arrayed_object_size (ST_STACK_PEEK (machine))), 0);
+}
+
+/* answers 0 if the byte or Character isn't found */
+static void
+MappedFile_indexOf_startingAt (st_machine *machine)
+{
+    st_oop    receiver, object;
+    st_uchar *bytes, *found;
+    int       start, size, value;
+
+    start = pop_integer32 (machine);
+    object = ST_STACK_POP (machine);
+    receiver = ST_STACK_POP (machine);
+
+    if (st_object_is_smi (object))
+	value = st_smi_value (object);
+    else if (st_object_is_character (object))
+	value = st_character_value (object);
+    else
+	value = -1;
+
+    size = st_smi_value (st_arrayed_object_size (receiver));
+    if (!machine->success || value < 0 || value > 255 || start < 1) {
+	set_success (machine, false);
+	ST_STACK_UNPOP (machine, 3);
+	return;
+    }
+
+    found = NULL;
+    bytes = st_mapped_bytes (receiver);
+    if (start <= size)
+	found = memchr (bytes + start - 1, value, size - start + 1);
+
+    ST_STACK_PUSH (machine, st_smi_new (found ? found - bytes + 1 : 0));
+}
+
+/* the kinds of socket made by Socket_open */
+enum
+{
+    SOCKET_TCP,
+    SOCKET_UDP,
+    SOCKET_UNIX,
+};
+
+static void
+Socket_open (st_machine *machine)
+{
+    int kind, fd;
+
+    kind = pop_integer32 (machine);
+    if (!machine->success) {
+	ST_STACK_UNPOP (machine, 1);
+	return;
+    }
+
+    switch (kind) {
+    case SOCKET_TCP:
+	fd = socket (AF_INET, SOCK_STREAM, 0);
+	break;
+    case SOCKET_UDP:
+	fd = socket (AF_INET, SOCK_DGRAM, 0);
+	break;
+    case SOCKET_UNIX:
+	fd = socket (AF_UNIX, SOCK_STREAM, 0);
+	break;
+    default:
+	fd = -1;
+    }
+
+    if (fd < 0) {
+	set_success (machine, false);
+	ST_STACK_UNPOP (machine, 1);
+	return;
+    }
+
+    fcntl (fd, F_SETFL, O_NONBLOCK);
+    fcntl (fd, F_SETFD, FD_CLOEXEC);
+
+    (void) ST_STACK_POP (machine);
+    ST_STACK_PUSH (machine, st_smi_new (fd));
+}
+
+/* Makes the address of `host' and `port' for a socket of `fd''s family:
+ * a dotted IPv4 address, or nil for any, or for a Unix domain socket
+ * the path in `host'.
+ */
+static bool
+socket_address (int fd, st_oop host, int port, struct sockaddr_storage *address, socklen_t *length)
+{
+    struct sockaddr_in *inet = (struct sockaddr_in *) address;
+    struct sockaddr_un *local = (struct sockaddr_un *) address;
+    socklen_t size = sizeof (*address);
+    st_uint   count;
+
+    memset (address, 0, sizeof (*address));
+    if (getsockname (fd, (struct sockaddr *) address, &size) < 0)
+	return false;
+
+    if (host != ST_NIL && (st_object_is_smi (host) || st_object_format (host) != ST_FORMAT_BYTE_ARRAY))
+	return false;
+
+    switch (address->ss_family) {
+    case AF_INET:
+	memset (address, 0, sizeof (*address));
+	inet->sin_family = AF_INET;
+	inet->sin_port = htons (port);
+	inet->sin_addr.s_addr = htonl (INADDR_ANY);
+	if (host != ST_NIL && inet_pton (AF_INET, (char *) st_byte_array_bytes (host), &inet->sin_addr) != 1)
+	    return false;
+	*length = sizeof (*inet);
+	return port >= 0 && port <= 65535;
+
+    case AF_UNIX:
+	if (host == ST_NIL)
+	    return false;
+	count = st_smi_value (st_arrayed_object_size (host));
+	if (count >= sizeof (local->sun_path))
+	    return false;
+	memset (address, 0, sizeof (*address));
+	local->sun_family = AF_UNIX;
+	memcpy (local->sun_path, st_byte_array_bytes (host), count);
+	*length = sizeof (*local);
+	return true;
+
+    default:
+	return false;
+    }
+}
+
+static void
+Socket_bind (st_machine *machine)
+{
+    struct sockaddr_storage address;
+    socklen_t length;
+    st_oop    host;
+    int       fd, port, on = 1;
+
+    port = pop_integer32 (machine);
+    host = ST_STACK_POP (machine);
+    fd = pop_integer32 (machine);
+
+    if (!machine->success || !socket_address (fd, host, port, &address, &length)) {
+	set_success (machine, false);
+	ST_STACK_UNPOP (machine, 3);
+	return;
+    }
+
+    if (address.ss_family == AF_INET)
+	setsockopt (fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof (on));
+
+    if (bind (fd, (struct sockaddr *) &address, length) < 0) {
+	set_success (machine, false);
+	ST_STACK_UNPOP (machine, 3);
+	return;
+    }
+
+    /* leave receiver on stack */
+}
+
+static void
+Socket_listen (st_machine *machine)
+{
+    int fd, backlog;
+
+    backlog = pop_integer32 (machine);
+    fd = pop_integer32 (machine);
+
+    if (!machine->success || listen (fd, backlog) < 0) {
+	set_success (machine, false);
+	ST_STACK_UNPOP (machine, 2);
+	return;
+    }
+
+    /* leave receiver on stack */
+}
+
+/* answers the descriptor of a new connection, nil if none is waiting */
+static void
+Socket_accept (st_machine *machine)
+{
+    int fd, connection;
+
+    fd = pop_integer32 (machine);
+    if (!machine->success) {
+	ST_STACK_UNPOP (machine, 1);
+	return;
+    }
+
+    do {
+	connection = accept (fd, NULL, NULL);
+    } while (connection < 0 && errno == EINTR);
+
+    if (connection < 0 && errno != EAGAIN && errno != EWOULDBLOCK) {
+	set_success (machine, false);
+	ST_STACK_UNPOP (machine, 1);
+	return;
+    }
+
+    if (connection >= 0) {
+	fcntl (connection, F_SETFL, O_NONBLOCK);
+	fcntl (connection, F_SETFD, FD_CLOEXEC);
+    }
+
+    (void) ST_STACK_POP (machine);
+    ST_STACK_PUSH (machine, connection < 0 ? ST_NIL : st_smi_new (connection));
+}
+
+/* Answers true once connected, or nil while the connection is under
+ * way, the caller then waiting for the socket to become writable.
+ */
+static void
+Socket_connect (st_machine *machine)
+{
+    struct sockaddr_storage address;
+    socklen_t length;
+    st_oop    host;
+    int       fd, port, result;
+
+    port = pop_integer32 (machine);
+    host = ST_STACK_POP (machine);
+    fd = pop_integer32 (machine);
+
+    if (!machine->success || host == ST_NIL || !socket_address (fd, host, port, &address, &length)) {
+	set_success (machine, false);
+	ST_STACK_UNPOP (machine, 3);
+	return;
+    }
+
+    result = connect (fd, (struct sockaddr *) &address, length);
+    if (result < 0 && errno != EINPROGRESS && errno != EINTR) {
+	set_success (machine, false);
+	ST_STACK_UNPOP (machine, 3);
+	return;
+    }
+
+    (void) ST_STACK_POP (machine);
+    ST_STACK_PUSH (machine, result == 0 ? ST_TRUE : ST_NIL);
+}
+
+/* fails if a connection under way has failed */
+static void
+Socket_checkError (st_machine *machine)
+{
+    socklen_t length;
+    int       fd, error = 0;
+
+    fd = pop_integer32 (machine);
+    length = sizeof (error);
+
+    if (!machine->success || getsockopt (fd, SOL_SOCKET, SO_ERROR, &error, &length) < 0 || error != 0) {
+	set_success (machine, false);
+	ST_STACK_UNPOP (machine, 1);
+	return;
+    }
+
+    /* leave receiver on stack */
+}
+
+/* the local port of a TCP or UDP socket */
+static void
+Socket_port (st_machine *machine)
+{
+    struct sockaddr_in address;
+    socklen_t length;
+    int       fd;
+
+    fd = pop_integer32 (machine);
+    length = sizeof (address);
+
+    if (!machine->success || getsockname (fd, (struct sockaddr *) &address, &length) < 0
+	|| address.sin_family != AF_INET) {
+	set_success (machine, false);
+	ST_STACK_UNPOP (machine, 1);
+	return;
+    }
+
+    (void) ST_STACK_POP (machine);
+    ST_STACK_PUSH (machine, st_smi_new (ntohs (address.sin_port)));
+}
+
+/* Receives up to `count' bytes straight into a ByteArray or String at
+ * `start'. Answers the number received, 0 once the peer has closed the
+ * connection, or nil if nothing has arrived yet.
+ */
+static void
+Socket_recv (st_machine *machine)
+{
+    st_uchar *bytes;
+    ssize_t   received;
+    int       fd, start, count;
+
+    count = pop_integer32 (machine);
+    start = pop_integer32 (machine);
+    bytes = byte_range (ST_STACK_POP (machine), start, start + count - 1);
+    fd = pop_integer32 (machine);
+
+    if (!machine->success || bytes == NULL || count < 0) {
+	set_success (machine, false);
+	ST_STACK_UNPOP (machine, 4);
+	return;
+    }
+
+    do {
+	received = recv (fd, bytes, count, 0);
+    } while (received < 0 && errno == EINTR);
+
+    if (received < 0 && errno != EAGAIN && errno != EWOULDBLOCK) {
+	set_success (machine, false);
+	ST_STACK_UNPOP (machine, 4);
+	return;
+    }
+
+    (void) ST_STACK_POP (machine);
+    ST_STACK_PUSH (machine, received < 0 ? ST_NIL : st_smi_new (received));
+}
+
+/* Sends the bytes of a ByteArray or String from `start' to `stop'
+ * straight from the heap. Answers the number sent, which may be fewer,
+ * or nil if the socket takes none at the moment.
+ */
+static void
+Socket_send (st_machine *machine)
+{
+    st_uchar *bytes;
+    ssize_t   sent;
+    int       fd, start, stop;
+
+    stop = pop_integer32 (machine);
+    start = pop_integer32 (machine);
+    bytes = byte_range (ST_STACK_POP (machine), start, stop);
+    fd = pop_integer32 (machine);
+
+    if (!machine->success || bytes == NULL) {
+	set_success (machine, false);
+	ST_STACK_UNPOP (machine, 4);
+	return;
+    }
+
+    /* a peer which has gone answers an error instead of raising SIGPIPE */
+    do {
+	sent = send (fd, bytes, stop - start + 1, SEND_FLAGS);
+    } while (sent < 0 && errno == EINTR);
+
+    if (sent < 0 && errno != EAGAIN && errno != EWOULDBLOCK) {
+	set_success (machine, false);
+	ST_STACK_UNPOP (machine, 4);
+	return;
+    }
+
+    (void) ST_STACK_POP (machine);
+    ST_STACK_PUSH (machine, sent < 0 ? ST_NIL : st_smi_new (sent));
+}
+
+/* Sends the bytes of an Array of segments, see gather_pieces(), after
+ * the first `skip' of them, with one sendmsg(2). Answers the number
+ * sent, 0 if there are none left, or nil if the socket takes none at
+ * the moment.
+ */
+static void
+Socket_sendSegments (st_machine *machine)
+{
+    struct iovec  pieces[ST_FILE_MAX_PIECES];
+    struct msghdr message;
+    st_oop  segments;
+    ssize_t sent = 0;
+    int     fd, count, skip, n;
+
+    skip = pop_integer32 (machine);
+    count = pop_integer32 (machine);
+    segments = ST_STACK_POP (machine);
+    fd = pop_integer32 (machine);
+
+    if (!machine->success || skip < 0 || (n = gather_pieces (segments, count, skip, pieces)) < 0) {
+	set_success (machine, false);
+	ST_STACK_UNPOP (machine, 4);
+	return;
+    }
+
+    memset (&message, 0, sizeof (message));
+    message.msg_iov = pieces;
+    message.msg_iovlen = n;
+
+    if (n > 0) {
+	do {
+	    sent = sendmsg (fd, &message, SEND_FLAGS);
+	} while (sent < 0 && errno == EINTR);
+    }
+
+    if (sent < 0 && errno != EAGAIN && errno != EWOULDBLOCK) {
+	set_success (machine, false);
+	ST_STACK_UNPOP (machine, 4);
+	return;
+    }
+
+    (void) ST_STACK_POP (machine);
+    ST_STACK_PUSH (machine, sent < 0 ? ST_NIL : st_smi_new (sent));
+}
+
+static void
+Socket_close (st_machine *machine)
+{
+    int fd;
+
+    fd = pop_integer32 (machine);
+    if (!machine->success || close (fd) < 0) {
+	set_success (machine, false);
+	ST_STACK_UNPOP (machine, 1);
+	return;
+    }
+
+    /* leave receiver on stack */
+}
+
+const struct st_primitive st_primitives[] = {
+    { "SmallInteger_add",      SmallInteger_add      },
+    { "SmallInteger_sub",      SmallInteger_sub      },
+    { "SmallInteger_lt",       SmallInteger_lt       },
+    { "SmallInteger_gt",       SmallInteger_gt       },
+    { "SmallInteger_le",       SmallInteger_le       },
+    { "SmallInteger_ge",       SmallInteger_ge       },
+    { "SmallInteger_eq",       SmallInteger_eq       },
+    { "SmallInteger_ne",       SmallInteger_ne       },
+    { "SmallInteger_mul",      SmallInteger_mul      },
+    { "SmallInteger_div",      SmallInteger_div      },
+    { "SmallInteger_intDiv",   SmallInteger_intDiv   },
+    { "SmallInteger_mod",      SmallInteger_mod      },
+    { "SmallInteger_bitOr",    SmallInteger_bitOr    },
+    { "SmallInteger_bitXor",   SmallInteger_bitXor   },
+    { "SmallInteger_bitAnd",   SmallInteger_bitAnd   },
+    { "SmallInteger_bitShift", SmallInteger_bitShift },
+    { "SmallInteger_asFloat",         SmallInteger_asFloat  },
+    { "SmallInteger_asLargeInteger",  SmallInteger_asLargeInteger  },
+
+    { "LargeInteger_add",      LargeInteger_add      },
+    { "LargeInteger_sub",      LargeInteger_sub      },
+    { "LargeInteger_lt",       LargeInteger_lt       },
+    { "LargeInteger_gt",       LargeInteger_gt       },
+    { "LargeInteger_le",       LargeInteger_le       },
+    { "LargeInteger_ge",       LargeInteger_ge       },
     { "LargeInteger_eq",       LargeInteger_eq       },
     { "LargeInteger_ne",       LargeInteger_ne       },
     { "LargeInteger_mul",      LargeInteger_mul      },
@@ -2297,6 +3568,7 @@ const struct st_primitive st_primitives[] = {
     { "Behavior_new",                 Behavior_new                },
     { "Behavior_newSize",             Behavior_newSize            },
     { "Behavior_compile",             Behavior_compile            },
+    { "Behavior_methodChanged",       Behavior_methodChanged      },
 
 
     { "SequenceableCollection_size",   SequenceableCollection_size },           
@@ -2322,19 +3594,73 @@ const struct st_primitive st_primitives[] = {
     { "FloatArray_at",                 FloatArray_at               },
     { "FloatArray_at_put",             FloatArray_at_put           },
 
+    { "ArrayedCollection_replaceFrom_to_with_startingAt", ArrayedCollection_replaceFrom_to_with_startingAt },
+
     { "System_exitWithResult",          System_exitWithResult },
+    { "System_millisecondClock",        System_millisecondClock },
+    { "System_processorCount",          System_processorCount },
 
     { "Character_value",                 Character_value },
     { "Character_characterFor",          Character_characterFor },
 
-    { "BlockContext_value",              BlockContext_value               },
-    { "BlockContext_valueWithArguments", BlockContext_valueWithArguments  },
-
-    { "FileStream_open",        FileStream_open      },
-    { "FileStream_close",       FileStream_close     },
-    { "FileStream_read",        FileStream_read      },
-    { "FileStream_write",       FileStream_write     },
-    { "FileStream_seek",        FileStream_seek      },
+    { "BlockClosure_value",              BlockClosure_value               },
+    { "BlockClosure_valueWithArguments", BlockClosure_valueWithArguments  },
+    { "BlockClosure_on_do",              BlockClosure_on_do               },
+    { "BlockClosure_newContext",         BlockClosure_newContext          },
+
+    { "Process_resume",                Process_resume               },
+    { "Process_suspend",               Process_suspend              },
+    { "Process_terminate",             Process_terminate            },
+    { "ProcessorScheduler_yield",      ProcessorScheduler_yield     },
+    { "ProcessorScheduler_waitForIO",  ProcessorScheduler_waitForIO },
+    { "Semaphore_signal",              Semaphore_signal             },
+    { "Semaphore_wait",                Semaphore_wait               },
+
+    { "VirtualMachine_current",        VirtualMachine_current       },
+    { "VirtualMachine_parent",         VirtualMachine_parent        },
+    { "VirtualMachine_spawn",          VirtualMachine_spawn         },
+    { "VirtualMachine_post",           VirtualMachine_post          },
+    { "Mailbox_descriptor",            Mailbox_descriptor           },
+    { "Mailbox_receive",               Mailbox_receive              },
+
+    { "ContextPart_tempAt",                ContextPart_tempAt                },
+    { "ContextPart_tempAt_put",            ContextPart_tempAt_put            },
+    { "ContextPart_markForUnwind",         ContextPart_markForUnwind         },
+    { "ContextPart_nextUnwindContextUpTo", ContextPart_nextUnwindContextUpTo },
+    { "ContextPart_return",                ContextPart_return                },
+    { "ContextPart_nextHandlerContext",    ContextPart_nextHandlerContext    },
+    { "ContextPart_restart",               ContextPart_restart               },
+
+    { "FileStream_open",        FileStream_open       },
+    { "FileStream_pipe",        FileStream_pipe       },
+    { "FileStream_close",       FileStream_close      },
+    { "FileStream_descriptor",  FileStream_descriptor },
+    { "FileStream_fill",        FileStream_fill       },
+    { "FileStream_available",   FileStream_available  },
+    { "FileStream_next",        FileStream_next       },
+    { "FileStream_next_count",  FileStream_next_count },
+    { "FileStream_upTo",        FileStream_upTo       },
+    { "FileStream_write",       FileStream_write      },
+    { "FileStream_writev",      FileStream_writev     },
+    { "FileStream_flush",       FileStream_flush      },
+
+    { "MappedFile_open",               MappedFile_open               },
+    { "MappedFile_at",                 MappedFile_at                 },
+    { "MappedFile_copyFrom_to",        MappedFile_copyFrom_to        },
+    { "MappedFile_copyStringFrom_to",  MappedFile_copyStringFrom_to  },
+    { "MappedFile_asString",           MappedFile_asString           },
+    { "MappedFile_indexOf_startingAt", MappedFile_indexOf_startingAt },
+    { "Socket_open",                   Socket_open                   },
+    { "Socket_bind",                   Socket_bind                   },
+    { "Socket_listen",                 Socket_listen                 },
+    { "Socket_accept",                 Socket_accept                 },
+    { "Socket_connect",                Socket_connect                },
+    { "Socket_checkError",             Socket_checkError             },
+    { "Socket_port",                   Socket_port                   },
+    { "Socket_recv",                   Socket_recv                   },
+    { "Socket_send",                   Socket_send                   },
+    { "Socket_sendSegments",           Socket_sendSegments           },
+    { "Socket_close",                  Socket_close                  },
 
 };
 
@@ -0,0 +1,565 @@
+/*
+ * st-process.c
+ *
+ * Copyright (c) 2008 Vincent Geddes
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+*/
+
+#include <config.h>
+
+#include "st-process.h"
+#include "st-universe.h"
+#include "st-array.h"
+#include "st-behavior.h"
+#include "st-context.h"
+#include "st-small-integer.h"
+#include "st-utils.h"
+
+#ifdef HAVE_SYS_EPOLL_H
+#include <sys/epoll.h>
+#else
+#include <poll.h>
+#endif
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+volatile sig_atomic_t st_process_ticks = 0;
+
+static int timer_started = 0;
+
+static void
+timer_handler (int signum)
+{
+    st_process_ticks++;
+}
+
+/* the time slice timer is only started once there is a second
+ * process, programs with a single process never see SIGALRM */
+static void
+start_timer (void)
+{
+    struct sigaction  action;
+    struct itimerval  interval;
+
+    /* one timer serves every machine in the process */
+    if (__sync_lock_test_and_set (&timer_started, 1))
+	return;
+
+    memset (&action, 0, sizeof (action));
+    action.sa_handler = timer_handler;
+    action.sa_flags = SA_RESTART;
+    sigemptyset (&action.sa_mask);
+    sigaction (SIGALRM, &action, NULL);
+
+    interval.it_interval.tv_sec  = 0;
+    interval.it_interval.tv_usec = ST_PROCESS_TIME_SLICE_USEC;
+    interval.it_value = interval.it_interval;
+    setitimer (ITIMER_REAL, &interval, NULL);
+}
+
+static void
+list_add_last (st_oop list, st_oop process)
+{
+    ST_PROCESS_NEXT_LINK (process) = ST_NIL;
+    ST_PROCESS_MY_LIST (process) = list;
+
+    if (ST_LINKED_LIST_FIRST (list) == ST_NIL)
+	ST_LINKED_LIST_FIRST (list) = process;
+    else
+	ST_PROCESS_NEXT_LINK (ST_LINKED_LIST_LAST (list)) = process;
+    ST_LINKED_LIST_LAST (list) = process;
+}
+
+static void
+list_add_first (st_oop list, st_oop process)
+{
+    ST_PROCESS_NEXT_LINK (process) = ST_LINKED_LIST_FIRST (list);
+    ST_PROCESS_MY_LIST (process) = list;
+
+    if (ST_LINKED_LIST_FIRST (list) == ST_NIL)
+	ST_LINKED_LIST_LAST (list) = process;
+    ST_LINKED_LIST_FIRST (list) = process;
+}
+
+static st_oop
+list_remove_first (st_oop list)
+{
+    st_oop process;
+
+    process = ST_LINKED_LIST_FIRST (list);
+    ST_LINKED_LIST_FIRST (list) = ST_PROCESS_NEXT_LINK (process);
+    if (ST_LINKED_LIST_FIRST (list) == ST_NIL)
+	ST_LINKED_LIST_LAST (list) = ST_NIL;
+
+    ST_PROCESS_NEXT_LINK (process) = ST_NIL;
+    ST_PROCESS_MY_LIST (process) = ST_NIL;
+
+    return process;
+}
+
+static void
+list_remove (st_oop list, st_oop process)
+{
+    st_oop previous, link;
+
+    previous = ST_NIL;
+    link = ST_LINKED_LIST_FIRST (list);
+    while (link != process) {
+	previous = link;
+	link = ST_PROCESS_NEXT_LINK (link);
+    }
+
+    if (previous == ST_NIL)
+	ST_LINKED_LIST_FIRST (list) = ST_PROCESS_NEXT_LINK (process);
+    else
+	ST_PROCESS_NEXT_LINK (previous) = ST_PROCESS_NEXT_LINK (process);
+    if (ST_LINKED_LIST_LAST (list) == process)
+	ST_LINKED_LIST_LAST (list) = previous;
+
+    ST_PROCESS_NEXT_LINK (process) = ST_NIL;
+    ST_PROCESS_MY_LIST (process) = ST_NIL;
+}
+
+static inline st_uint
+priority_of (st_oop process)
+{
+    return st_smi_value (ST_PROCESS_PRIORITY (process));
+}
+
+static inline st_oop
+ready_list (st_uint priority)
+{
+    return st_array_at (ST_PROCESSOR_PROCESS_LISTS (ST_PROCESSOR), priority);
+}
+
+/* the highest priority with a ready process, or 0 if there is none */
+static st_uint
+highest_ready_priority (void)
+{
+    for (st_uint priority = ST_PROCESS_PRIORITIES; priority > 0; priority--) {
+	if (ST_LINKED_LIST_FIRST (ready_list (priority)) != ST_NIL)
+	    return priority;
+    }
+    return 0;
+}
+
+/*
+ * Processes waiting for I/O are queued on a list per file descriptor,
+ * kept in the scheduler's I/O waiters array at the descriptor + 1.
+ *
+ * With epoll a descriptor is only armed while a process waits for it
+ * (EPOLLONESHOT), so that a poll costs time in the number of ready
+ * descriptors rather than the number of waiting ones. Otherwise the
+ * whole array is handed to poll(2).
+ */
+
+static ST_THREAD_LOCAL st_uint io_waiting = 0;
+
+#ifdef HAVE_SYS_EPOLL_H
+static ST_THREAD_LOCAL int io_poll = -1;
+
+#define IO_EVENTS 64
+#endif
+
+/* the list of processes waiting for `fd', made on first use */
+static st_oop
+io_waiters_for (int fd)
+{
+    st_oop  waiters, grown, list;
+    st_uint size;
+
+    waiters = ST_PROCESSOR_IO_WAITERS (ST_PROCESSOR);
+    size = st_smi_value (st_arrayed_object_size (waiters));
+    if ((st_uint) fd >= size) {
+	grown = st_object_new_arrayed (ST_ARRAY_CLASS, MAX (size * 2, (st_uint) fd + 1));
+	waiters = ST_PROCESSOR_IO_WAITERS (ST_PROCESSOR);
+	for (st_uint i = 1; i <= size; i++)
+	    st_array_at_put (grown, i, st_array_at (waiters, i));
+	ST_PROCESSOR_IO_WAITERS (ST_PROCESSOR) = grown;
+    }
+
+    list = st_array_at (ST_PROCESSOR_IO_WAITERS (ST_PROCESSOR), fd + 1);
+    if (list == ST_NIL) {
+	list = st_object_new (st_global_get ("LinkedList"));
+	st_array_at_put (ST_PROCESSOR_IO_WAITERS (ST_PROCESSOR), fd + 1, list);
+    }
+
+    return list;
+}
+
+/* the events which the processes on `list' wait for */
+static int
+io_events_of (st_oop list)
+{
+    st_oop process;
+    int    events = 0;
+
+    for (process = ST_LINKED_LIST_FIRST (list); process != ST_NIL; process = ST_PROCESS_NEXT_LINK (process))
+	events |= st_smi_value (ST_PROCESS_IO_WAIT (process));
+
+    return events;
+}
+
+/* Arms `fd' for `events'. Returns false for descriptors which can't be
+ * waited for, such as regular files, which are always ready.
+ */
+static bool
+io_watch (int fd, int events)
+{
+#ifdef HAVE_SYS_EPOLL_H
+    struct epoll_event event;
+
+    if (io_poll < 0) {
+	io_poll = epoll_create1 (EPOLL_CLOEXEC);
+	if (io_poll < 0)
+	    return false;
+    }
+
+    memset (&event, 0, sizeof (event));
+    event.events = EPOLLONESHOT
+	| ((events & ST_PROCESS_WAIT_READ) ? EPOLLIN : 0) | ((events & ST_PROCESS_WAIT_WRITE) ? EPOLLOUT : 0);
+    event.data.fd = fd;
+
+    if (epoll_ctl (io_poll, EPOLL_CTL_MOD, fd, &event) == 0)
+	return true;
+    return errno == ENOENT && epoll_ctl (io_poll, EPOLL_CTL_ADD, fd, &event) == 0;
+#else
+    return true;
+#endif
+}
+
+/* Makes the processes waiting for `fd' which are satisfied by `ready'
+ * ready to run, and arms it again for the others.
+ */
+static void
+io_wake (int fd, int ready)
+{
+    st_oop waiters, list, process, next;
+    int    events, remaining;
+
+    waiters = ST_PROCESSOR_IO_WAITERS (ST_PROCESSOR);
+    if (fd < 0 || (st_uint) fd >= st_smi_value (st_arrayed_object_size (waiters)))
+	return;
+    list = st_array_at (waiters, fd + 1);
+    if (list == ST_NIL)
+	return;
+
+    remaining = 0;
+    for (process = ST_LINKED_LIST_FIRST (list); process != ST_NIL; process = next) {
+	next = ST_PROCESS_NEXT_LINK (process);
+	events = st_smi_value (ST_PROCESS_IO_WAIT (process));
+	if (events & ready) {
+	    list_remove (list, process);
+	    ST_PROCESS_IO_WAIT (process) = ST_NIL;
+	    io_waiting--;
+	    list_add_last (ready_list (priority_of (process)), process);
+	} else {
+	    remaining |= events;
+	}
+    }
+
+    if (remaining != 0)
+	io_watch (fd, remaining);
+}
+
+/* Makes the processes waiting for file descriptors which have become
+ * ready, ready to run. Waits up to `timeout' milliseconds for one.
+ */
+static void
+poll_io (int timeout)
+{
+#ifdef HAVE_SYS_EPOLL_H
+    struct epoll_event events[IO_EVENTS];
+    int count, ready;
+
+    count = epoll_wait (io_poll, events, IO_EVENTS, timeout);
+
+    for (int i = 0; i < count; i++) {
+	ready = 0;
+	if (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR))
+	    ready |= ST_PROCESS_WAIT_READ;
+	if (events[i].events & (EPOLLOUT | EPOLLHUP | EPOLLERR))
+	    ready |= ST_PROCESS_WAIT_WRITE;
+	io_wake (events[i].data.fd, ready);
+    }
+#else
+    struct pollfd *fds;
+    st_oop   waiters, list;
+    st_uint  size, count;
+    int      events, ready;
+
+    waiters = ST_PROCESSOR_IO_WAITERS (ST_PROCESSOR);
+    size = st_smi_value (st_arrayed_object_size (waiters));
+    fds = st_malloc (size * sizeof (struct pollfd));
+
+    count = 0;
+    for (st_uint i = 1; i <= size; i++) {
+	list = st_array_at (waiters, i);
+	if (list == ST_NIL || ST_LINKED_LIST_FIRST (list) == ST_NIL)
+	    continue;
+	events = io_events_of (list);
+	fds[count].fd = i - 1;
+	fds[count].events = ((events & ST_PROCESS_WAIT_READ) ? POLLIN : 0) | ((events & ST_PROCESS_WAIT_WRITE) ? POLLOUT : 0);
+	fds[count].revents = 0;
+	count++;
+    }
+
+    if (poll (fds, count, timeout) > 0) {
+	for (st_uint i = 0; i < count; i++) {
+	    ready = 0;
+	    if (fds[i].revents & (POLLIN | POLLHUP | POLLERR | POLLNVAL))
+		ready |= ST_PROCESS_WAIT_READ;
+	    if (fds[i].revents & (POLLOUT | POLLHUP | POLLERR | POLLNVAL))
+		ready |= ST_PROCESS_WAIT_WRITE;
+	    if (ready != 0)
+		io_wake (fds[i].fd, ready);
+	}
+    }
+
+    st_free (fds);
+#endif
+}
+
+/* takes a process which isn't active off the list it is queued on */
+static void
+unqueue (st_oop process)
+{
+    if (ST_PROCESS_IO_WAIT (process) != ST_NIL)
+	io_waiting--;
+
+    list_remove (ST_PROCESS_MY_LIST (process), process);
+    ST_PROCESS_IO_WAIT (process) = ST_NIL;
+}
+
+/* Removes the process to run next from the ready lists, waiting for
+ * I/O if no process is ready.
+ */
+static st_oop
+next_ready_process (void)
+{
+    st_uint priority;
+
+    for (;;) {
+	priority = highest_ready_priority ();
+	if (priority > 0)
+	    return list_remove_first (ready_list (priority));
+
+	if (io_waiting == 0) {
+	    fprintf (stderr, "panda: all processes are waiting\n");
+	    exit (1);
+	}
+	poll_io (-1);
+    }
+}
+
+/* switches to `process', leaving the active process suspended
+ * in its active context */
+static void
+transfer_to (st_machine *machine, st_oop process)
+{
+    st_oop context;
+
+    ST_PROCESS_SUSPENDED_CONTEXT (ST_PROCESSOR_ACTIVE_PROCESS (ST_PROCESSOR)) = machine->context;
+
+    context = ST_PROCESS_SUSPENDED_CONTEXT (process);
+    ST_PROCESS_SUSPENDED_CONTEXT (process) = ST_NIL;
+    ST_PROCESSOR_ACTIVE_PROCESS (ST_PROCESSOR) = process;
+
+    st_machine_set_active_context (machine, context);
+}
+
+/* Creates the scheduler, with the process running the startup code
+ * as its active process.
+ */
+st_oop
+st_processor_new (void)
+{
+    st_oop processor;
+    st_oop lists;
+    st_oop process;
+
+    lists = st_object_new_arrayed (ST_ARRAY_CLASS, ST_PROCESS_PRIORITIES);
+    for (st_uint i = 1; i <= ST_PROCESS_PRIORITIES; i++)
+	st_array_at_put (lists, i, st_object_new (st_global_get ("LinkedList")));
+
+    process = st_object_new (st_global_get ("Process"));
+    ST_PROCESS_PRIORITY (process) = st_smi_new (ST_PROCESS_USER_PRIORITY);
+
+    processor = st_object_new (st_global_get ("ProcessorScheduler"));
+    ST_PROCESSOR_PROCESS_LISTS (processor)  = lists;
+    ST_PROCESSOR_ACTIVE_PROCESS (processor) = process;
+    ST_PROCESSOR_IO_WAITERS (processor)     = st_object_new_arrayed (ST_ARRAY_CLASS, 64);
+
+    return processor;
+}
+
+/* Makes a suspended process ready, switching to it at once if it has
+ * a higher priority than the active process. Returns false if the
+ * process isn't suspended.
+ */
+bool
+st_process_resume (st_machine *machine, st_oop process)
+{
+    st_oop active;
+
+    if (ST_PROCESS_SUSPENDED_CONTEXT (process) == ST_NIL || ST_PROCESS_MY_LIST (process) != ST_NIL)
+	return false;
+
+    start_timer ();
+
+    active = ST_PROCESSOR_ACTIVE_PROCESS (ST_PROCESSOR);
+    if (priority_of (process) > priority_of (active)) {
+	list_add_first (ready_list (priority_of (active)), active);
+	transfer_to (machine, process);
+    } else {
+	list_add_last (ready_list (priority_of (process)), process);
+    }
+
+    return true;
+}
+
+/* Takes a process off the list it is queued on, or the active process
+ * off the machine. Returns false if the process is suspended already.
+ */
+bool
+st_process_suspend (st_machine *machine, st_oop process)
+{
+    if (process == ST_PROCESSOR_ACTIVE_PROCESS (ST_PROCESSOR)) {
+	transfer_to (machine, next_ready_process ());
+	return true;
+    }
+
+    if (ST_PROCESS_MY_LIST (process) == ST_NIL)
+	return false;
+
+    unqueue (process);
+    return true;
+}
+
+void
+st_process_terminate (st_machine *machine, st_oop process)
+{
+    if (process == ST_PROCESSOR_ACTIVE_PROCESS (ST_PROCESSOR)) {
+	transfer_to (machine, next_ready_process ());
+    } else if (ST_PROCESS_MY_LIST (process) != ST_NIL) {
+	unqueue (process);
+    }
+
+    ST_PROCESS_SUSPENDED_CONTEXT (process) = ST_NIL;
+}
+
+/* gives the other ready processes at the active priority a turn */
+void
+st_process_yield (st_machine *machine)
+{
+    st_oop active, list, next;
+
+    active = ST_PROCESSOR_ACTIVE_PROCESS (ST_PROCESSOR);
+    list = ready_list (priority_of (active));
+    if (ST_LINKED_LIST_FIRST (list) == ST_NIL)
+	return;
+
+    next = list_remove_first (list);
+    list_add_last (list, active);
+    transfer_to (machine, next);
+}
+
+void
+st_semaphore_signal (st_machine *machine, st_oop semaphore)
+{
+    if (ST_LINKED_LIST_FIRST (semaphore) == ST_NIL) {
+	ST_SEMAPHORE_EXCESS_SIGNALS (semaphore) =
+	    st_smi_new (st_smi_value (ST_SEMAPHORE_EXCESS_SIGNALS (semaphore)) + 1);
+	return;
+    }
+
+    st_process_resume (machine, list_remove_first (semaphore));
+}
+
+void
+st_semaphore_wait (st_machine *machine, st_oop semaphore)
+{
+    st_oop  active;
+    st_uint excess;
+
+    excess = st_smi_value (ST_SEMAPHORE_EXCESS_SIGNALS (semaphore));
+    if (excess > 0) {
+	ST_SEMAPHORE_EXCESS_SIGNALS (semaphore) = st_smi_new (excess - 1);
+	return;
+    }
+
+    active = ST_PROCESSOR_ACTIVE_PROCESS (ST_PROCESSOR);
+    list_add_last (semaphore, active);
+    transfer_to (machine, next_ready_process ());
+}
+
+/* Suspends the active process until `fd' is ready for `events'. It
+ * carries on at once for descriptors which are always ready, like
+ * those of regular files.
+ */
+void
+st_process_wait_for_io (st_machine *machine, int fd, int events)
+{
+    st_oop list, active;
+
+    list = io_waiters_for (fd);
+    if (!io_watch (fd, events | io_events_of (list)))
+	return;
+
+    /* it may be the next process itself, once the wait is over */
+    active = ST_PROCESSOR_ACTIVE_PROCESS (ST_PROCESSOR);
+    ST_PROCESS_IO_WAIT (active) = st_smi_new (events);
+    list_add_last (list, active);
+    io_waiting++;
+
+    transfer_to (machine, next_ready_process ());
+}
+
+/* Called at a back-edge or a send after the timer went off. Wakes the
+ * processes whose I/O is ready and ends the active process's time
+ * slice if another process at its priority (or above) is ready.
+ */
+void
+st_process_handle_interrupt (st_machine *machine)
+{
+    st_oop  active, next;
+    st_uint priority;
+
+    machine->ticks = st_process_ticks;
+
+    if (io_waiting > 0)
+	poll_io (0);
+
+    active = ST_PROCESSOR_ACTIVE_PROCESS (ST_PROCESSOR);
+    priority = highest_ready_priority ();
+    if (priority < priority_of (active))
+	return;
+
+    next = list_remove_first (ready_list (priority));
+    if (priority == priority_of (active))
+	list_add_last (ready_list (priority), active);
+    else
+	list_add_first (ready_list (priority_of (active)), active);
+
+    transfer_to (machine, next);
+}
@@ -0,0 +1,132 @@
+/*
+ * st-process.h
+ *
+ * Copyright (c) 2008 Vincent Geddes
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+*/
+
+#ifndef __ST_PROCESS_H__
+#define __ST_PROCESS_H__
+
+#include <st-types.h>
+#include <st-object.h>
+#include <st-machine.h>
+#include <signal.h>
+
+/*
+ * Processes are green threads scheduled by the machine. A process
+ * which isn't running keeps its active context in suspendedContext
+ * and a switch only swaps the machine's active context.
+ *
+ * Ready processes are queued on one list per priority in the
+ * scheduler. A waiting process is queued on a Semaphore, or on the
+ * list of I/O waiters for the file descriptor it waits for, with the
+ * events it waits for in `io_wait'.
+ */
+struct st_process
+{
+    struct st_header __parent__;
+
+    st_oop next_link;
+    st_oop suspended_context;
+    st_oop priority;
+    st_oop my_list;
+    st_oop io_wait;
+    st_oop name;
+};
+
+struct st_linked_list
+{
+    struct st_header __parent__;
+
+    st_oop first_link;
+    st_oop last_link;
+};
+
+struct st_semaphore
+{
+    struct st_linked_list __parent__;
+
+    st_oop excess_signals;
+};
+
+struct st_processor_scheduler
+{
+    struct st_header __parent__;
+
+    st_oop process_lists;
+    st_oop active_process;
+    st_oop io_waiters;
+};
+
+#define ST_PROCESS(oop)               ((struct st_process *) st_detag_pointer (oop))
+#define ST_LINKED_LIST(oop)           ((struct st_linked_list *) st_detag_pointer (oop))
+#define ST_SEMAPHORE(oop)             ((struct st_semaphore *) st_detag_pointer (oop))
+#define ST_PROCESSOR_SCHEDULER(oop)   ((struct st_processor_scheduler *) st_detag_pointer (oop))
+
+#define ST_PROCESS_NEXT_LINK(oop)         (ST_PROCESS (oop)->next_link)
+#define ST_PROCESS_SUSPENDED_CONTEXT(oop) (ST_PROCESS (oop)->suspended_context)
+#define ST_PROCESS_PRIORITY(oop)          (ST_PROCESS (oop)->priority)
+#define ST_PROCESS_MY_LIST(oop)           (ST_PROCESS (oop)->my_list)
+#define ST_PROCESS_IO_WAIT(oop)           (ST_PROCESS (oop)->io_wait)
+
+#define ST_LINKED_LIST_FIRST(oop)         (ST_LINKED_LIST (oop)->first_link)
+#define ST_LINKED_LIST_LAST(oop)          (ST_LINKED_LIST (oop)->last_link)
+
+#define ST_SEMAPHORE_EXCESS_SIGNALS(oop)  (ST_SEMAPHORE (oop)->excess_signals)
+
+#define ST_PROCESSOR_PROCESS_LISTS(oop)   (ST_PROCESSOR_SCHEDULER (oop)->process_lists)
+#define ST_PROCESSOR_ACTIVE_PROCESS(oop)  (ST_PROCESSOR_SCHEDULER (oop)->active_process)
+#define ST_PROCESSOR_IO_WAITERS(oop)      (ST_PROCESSOR_SCHEDULER (oop)->io_waiters)
+
+/* priorities run from 1 to ST_PROCESS_PRIORITIES, see ProcessorScheduler */
+#define ST_PROCESS_PRIORITIES        8
+#define ST_PROCESS_USER_PRIORITY     4
+
+/* time slice given to each of the running processes at a priority */
+#define ST_PROCESS_TIME_SLICE_USEC   10000
+
+enum
+{
+    ST_PROCESS_WAIT_READ  = 1,
+    ST_PROCESS_WAIT_WRITE = 2,
+};
+
+/* advanced by the time slice timer, which is shared by all machines;
+ * a machine checks for a process switch when it has missed a tick */
+extern volatile sig_atomic_t st_process_ticks;
+
+#define ST_PROCESS_INTERRUPTED(machine) ((machine)->ticks != st_process_ticks)
+
+st_oop st_processor_new           (void);
+
+bool   st_process_resume          (st_machine *machine, st_oop process);
+bool   st_process_suspend         (st_machine *machine, st_oop process);
+void   st_process_terminate       (st_machine *machine, st_oop process);
+void   st_process_yield           (st_machine *machine);
+
+void   st_semaphore_signal        (st_machine *machine, st_oop semaphore);
+void   st_semaphore_wait          (st_machine *machine, st_oop semaphore);
+
+void   st_process_wait_for_io     (st_machine *machine, int fd, int events);
+
+void   st_process_handle_interrupt (st_machine *machine);
+
+#endif /* __ST_PROCESS_H__ */
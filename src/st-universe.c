@@ -41,14 +41,16 @@
 #include "st-memory.h"
 #include "st-context.h"
 #include "st-machine.h"
+#include "st-process.h"
 
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
 
 static bool verbose_mode = false;
+static bool lazy_mode = false;
 
-st_memory *memory = NULL;
+ST_THREAD_LOCAL st_memory *memory = NULL;
 
 st_oop
 st_global_get (const char *name)
@@ -67,7 +69,8 @@ enum
     INSTANCE_SIZE_ASSOCIATION = 2,
     INSTANCE_SIZE_SYSTEM = 2,
     INSTANCE_SIZE_METHOD_CONTEXT = 5,
-    INSTANCE_SIZE_BLOCK_CONTEXT = 6
+    INSTANCE_SIZE_BLOCK_CONTEXT = 6,
+    INSTANCE_SIZE_BLOCK_CLOSURE = 5
 };
 
 static st_oop
@@ -280,15 +283,16 @@ parse_class (st_lexer *lexer, st_token *token)
 static void
 parse_classes (const char *filename)
 {
-    char *contents;
+    const char *text;
+    st_uint size;
     st_lexer *lexer;
     st_token *token;
 
-    if (!st_file_get_contents (filename, &contents)) {
+    if (!st_file_map (filename, &text, &size)) {
 	exit (1);
     }
 
-    lexer = st_lexer_new (contents);
+    lexer = st_lexer_new_for_input (st_input_new_static (text, size));
     st_assert (lexer != NULL);
     token = st_lexer_next_token (lexer);
 
@@ -301,8 +305,8 @@ parse_classes (const char *filename)
 	token = st_lexer_next_token (lexer);
     }
 
-    st_free (contents);
     st_lexer_destroy (lexer);
+    st_file_unmap (text, size);
 }
 
 static void
@@ -312,11 +316,19 @@ file_in_classes (void)
 
     parse_classes ("../st/class-defs.st");
 
+    /* the scheduler and the queue of messages from other machines are
+     * referred to by the kernel sources */
+    ST_PROCESSOR = st_processor_new ();
+    add_global ("Processor", ST_PROCESSOR);
+    add_global ("Inbox", st_object_new (st_global_get ("Mailbox")));
+    add_global ("Workers", st_object_new (st_global_get ("WorkerPool")));
+
     static const char * files[] = 
 	{
 	    "Stream.st",
 	    "PositionableStream.st",
 	    "WriteStream.st",
+	    "GatherStream.st",
 	    "Collection.st",
 	    "SequenceableCollection.st",
 	    "ArrayedCollection.st",
@@ -351,13 +363,18 @@ file_in_classes (void)
 	    "False.st",
 	    "Behavior.st",
 	    "ContextPart.st",
-	    "BlockContext.st",
+	    "BlockClosure.st",
+	    "Exception.st",
+	    "Process.st",
+	    "VirtualMachine.st",
 	    "Message.st",
 	    "OrderedCollection.st",
 	    "List.st",
 	    "System.st",
 	    "CompiledMethod.st",
 	    "FileStream.st",
+	    "MappedFile.st",
+	    "Socket.st",
 	    "pidigits.st"
 	};
 
@@ -415,8 +432,9 @@ init_specials (void)
     ST_SELECTOR_DOESNOTUNDERSTAND   = st_symbol_new ("doesNotUnderstand:");
     ST_SELECTOR_MUSTBEBOOLEAN       = st_symbol_new ("mustBeBoolean");
     ST_SELECTOR_STARTUPSYSTEM       = st_symbol_new ("startupSystem");
-    ST_SELECTOR_CANNOTRETURN        = st_symbol_new ("cannotReturn");
+    ST_SELECTOR_CANNOTRETURN        = st_symbol_new ("cannotReturn:");
     ST_SELECTOR_OUTOFMEMORY         = st_symbol_new ("outOfMemory");
+    ST_SELECTOR_RETURN              = st_symbol_new ("return:");
 }
 
 void
@@ -453,8 +471,10 @@ bootstrap_universe (void)
     ST_COMPILED_METHOD_CLASS  = class_new (ST_FORMAT_OBJECT, 0);
     ST_METHOD_CONTEXT_CLASS   = class_new (ST_FORMAT_CONTEXT, INSTANCE_SIZE_METHOD_CONTEXT);
     ST_BLOCK_CONTEXT_CLASS    = class_new (ST_FORMAT_CONTEXT, INSTANCE_SIZE_BLOCK_CONTEXT);
+    ST_BLOCK_CLOSURE_CLASS    = class_new (ST_FORMAT_OBJECT, INSTANCE_SIZE_BLOCK_CLOSURE);
     ST_SYSTEM_CLASS           = class_new (ST_FORMAT_OBJECT, INSTANCE_SIZE_SYSTEM);
     ST_HANDLE_CLASS           = class_new (ST_FORMAT_HANDLE, 0);
+    ST_MAPPED_FILE_CLASS      = class_new (ST_FORMAT_MAPPED_BYTES, 0);
     ST_MESSAGE_CLASS          = class_new (ST_FORMAT_OBJECT, 2);
 
     ST_OBJECT_CLASS (ST_NIL)  = ST_UNDEFINED_OBJECT_CLASS;
@@ -463,6 +483,7 @@ bootstrap_universe (void)
     ST_TRUE         = st_object_new (ST_TRUE_CLASS);
     ST_FALSE        = st_object_new (ST_FALSE_CLASS);
     ST_SYMBOLS      = st_set_new_with_capacity (256);
+    ST_LITERALS     = st_set_new_with_capacity (256);
     ST_GLOBALS      = st_dictionary_new_with_capacity (256);
     ST_SMALLTALK    = st_object_new (ST_SYSTEM_CLASS);
     ST_OBJECT_FIELDS (ST_SMALLTALK)[0] = ST_GLOBALS;
@@ -493,7 +514,9 @@ bootstrap_universe (void)
     add_global ("CompiledMethod", ST_COMPILED_METHOD_CLASS);
     add_global ("MethodContext", ST_METHOD_CONTEXT_CLASS);
     add_global ("BlockContext", ST_BLOCK_CONTEXT_CLASS);
+    add_global ("BlockClosure", ST_BLOCK_CLOSURE_CLASS);
     add_global ("Handle", ST_HANDLE_CLASS);
+    add_global ("MappedFile", ST_MAPPED_FILE_CLASS);
     add_global ("Message", ST_MESSAGE_CLASS);
     add_global ("System", ST_SYSTEM_CLASS);
     add_global ("Smalltalk", ST_SMALLTALK);
@@ -505,6 +528,7 @@ bootstrap_universe (void)
     st_memory_add_root (ST_TRUE);
     st_memory_add_root (ST_FALSE);
     st_memory_add_root (ST_SMALLTALK);
+    st_memory_add_root (ST_LITERALS);
 }
 
 void
@@ -526,3 +550,15 @@ st_get_verbose_mode (void)
 }
 
 
+
+void
+st_set_lazy_mode (bool lazy)
+{
+    lazy_mode = lazy;
+}
+
+bool
+st_get_lazy_mode (void)
+{
+    return lazy_mode;
+}
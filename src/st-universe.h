@@ -66,6 +66,11 @@
 #define ST_SELECTOR_STARTUPSYSTEM     __machine.globals[33]
 #define ST_SELECTOR_CANNOTRETURN      __machine.globals[34]
 #define ST_SELECTOR_OUTOFMEMORY       __machine.globals[35]
+#define ST_LITERALS                   __machine.globals[36]
+#define ST_BLOCK_CLOSURE_CLASS        __machine.globals[37]
+#define ST_SELECTOR_RETURN            __machine.globals[38]
+#define ST_PROCESSOR                  __machine.globals[39]
+#define ST_MAPPED_FILE_CLASS          __machine.globals[40]
 
 #define ST_SELECTOR_PLUS       __machine.selectors[0]
 #define ST_SELECTOR_MINUS      __machine.selectors[1]
@@ -92,7 +97,7 @@
 #define ST_SELECTOR_NEW        __machine.selectors[22]
 #define ST_SELECTOR_NEW_ARG    __machine.selectors[23]
 
-extern st_memory *memory;
+extern ST_THREAD_LOCAL st_memory *memory;
 
 void   st_initialize (void);
 
@@ -102,5 +107,9 @@ void   st_set_verbose_mode  (bool verbose);
 
 bool   st_get_verbose_mode  (void) ST_GNUC_PURE;
 
+void   st_set_lazy_mode     (bool lazy);
+
+bool   st_get_lazy_mode     (void) ST_GNUC_PURE;
+
 
 #endif /* __ST_UNIVERSE_H__ */
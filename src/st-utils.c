@@ -25,6 +25,7 @@
 #include "st-utils.h"
 
 #include <sys/stat.h>
+#include <sys/mman.h>
 #include <string.h>
 #include <stdio.h>
 #include <errno.h>
@@ -134,6 +135,155 @@ st_file_get_contents (const char *filename,
     return true;
 }
 
+/*
+ * Maps a file read-only into memory. The text is not NUL-terminated,
+ * callers must respect the returned size. An empty file yields a
+ * zero-sized static string.
+ */
+bool
+st_file_map (const char  *filename,
+	     const char **text,
+	     st_uint     *size)
+{
+    struct stat info;
+    void   *addr;
+    int     fd;
+
+    st_assert (filename != NULL);
+
+    *text = NULL;
+    *size = 0;
+
+    fd = open (filename, O_RDONLY);
+    if (fd < 0) {
+	fprintf (stderr, "%s: error: `%s': %s\n", program_invocation_short_name, filename, strerror (errno));
+	return false;
+    }
+
+    if (fstat (fd, &info) != 0) {
+	fprintf (stderr, "%s: error: `%s': %s\n", program_invocation_short_name, filename, strerror (errno));
+	close (fd);
+	return false;
+    }
+
+    if (!S_ISREG (info.st_mode)) {
+	fprintf (stderr, "%s: error: `%s': Not a regular file\n", program_invocation_short_name, filename);
+	close (fd);
+	return false;
+    }
+
+    if (info.st_size == 0) {
+	close (fd);
+	*text = "";
+	return true;
+    }
+
+    addr = mmap (NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close (fd);
+    if (addr == MAP_FAILED) {
+	fprintf (stderr, "%s: error: `%s': %s\n", program_invocation_short_name, filename, strerror (errno));
+	return false;
+    }
+
+    *text = addr;
+    *size = info.st_size;
+
+    return true;
+}
+
+void
+st_file_unmap (const char *text, st_uint size)
+{
+    if (size > 0)
+	munmap ((void *) text, size);
+}
+
+#define ARENA_BLOCK_SIZE 4096
+
+typedef struct arena_block
+{
+    struct arena_block *next;
+
+} arena_block;
+
+struct st_arena
+{
+    arena_block *blocks;
+
+    /* free space in the current block */
+    char *p;
+    char *end;
+};
+
+st_arena *
+st_arena_new (void)
+{
+    return st_new0 (st_arena);
+}
+
+/*
+ * Returns zero-filled memory which stays valid until the arena
+ * is destroyed. Requests larger than a block get a block of their own.
+ */
+st_pointer
+st_arena_alloc (st_arena *arena, size_t size)
+{
+    arena_block *block;
+    size_t       block_size;
+    st_pointer   ptr;
+
+    size = (size + sizeof (st_pointer) - 1) & ~(sizeof (st_pointer) - 1);
+
+    if (ST_UNLIKELY (arena->p == NULL || (size_t) (arena->end - arena->p) < size)) {
+	block_size = MAX (ARENA_BLOCK_SIZE, size + sizeof (arena_block));
+	block = st_malloc (block_size);
+	block->next = arena->blocks;
+	arena->blocks = block;
+	arena->p   = (char *) block + sizeof (arena_block);
+	arena->end = (char *) block + block_size;
+    }
+
+    ptr = arena->p;
+    arena->p += size;
+    memset (ptr, 0, size);
+
+    return ptr;
+}
+
+char *
+st_arena_strndup (st_arena *arena, const char *string, size_t n)
+{
+    char *copy;
+
+    copy = st_arena_alloc (arena, n + 1);
+    memcpy (copy, string, n);
+    copy[n] = 0;
+
+    return copy;
+}
+
+char *
+st_arena_strdup (st_arena *arena, const char *string)
+{
+    return st_arena_strndup (arena, string, strlen (string));
+}
+
+void
+st_arena_destroy (st_arena *arena)
+{
+    arena_block *block, *next;
+
+    if (arena == NULL)
+	return;
+
+    for (block = arena->blocks; block; block = next) {
+	next = block->next;
+	st_free (block);
+    }
+
+    st_free (arena);
+}
+
 /* Derived from eglib (part of Mono)
  * Copyright (C) 2006 Novell, Inc.
  */
@@ -52,11 +52,13 @@
 #define ST_GNUC_PURE   __attribute__ ((pure))
 #define ST_GNUC_MALLOC __attribute__ ((malloc))
 #define ST_GNUC_PRINTF(format_index, argument_index)  __attribute__ ((format (printf, format_index, argument_index)))
+#define ST_THREAD_LOCAL __thread __attribute__ ((tls_model ("initial-exec")))
 #else
 #define ST_GNUC_CONST
 #define ST_GNUC_PURE
 #define ST_GNUC_MALLOC
 #define ST_GNUC_PRINTF(format_index, argument_index)
+#define ST_THREAD_LOCAL
 #endif
 
 /* A compile-time assertion */
@@ -108,6 +110,13 @@ void        st_free    (st_pointer mem);
 bool    st_file_get_contents (const char *filename,
 			      char      **buffer);
 
+bool    st_file_map          (const char *filename,
+			      const char **text,
+			      st_uint     *size);
+
+void    st_file_unmap        (const char *text,
+			      st_uint     size);
+
 char  *st_strdup         (const char *string);
 char  *st_strdup_printf  (const char *format, ...) ST_GNUC_PRINTF (1, 2);
 char  *st_strdup_vprintf (const char *format, va_list args);
@@ -145,6 +154,17 @@ void      st_list_destroy (st_list *list);
 
 st_uint   st_string_hash (const char *string);
 
+/* A bump allocator whose memory is released all at once */
+typedef struct st_arena st_arena;
+
+st_arena   *st_arena_new     (void);
+st_pointer  st_arena_alloc   (st_arena *arena, size_t size) ST_GNUC_MALLOC;
+char       *st_arena_strdup  (st_arena *arena, const char *string);
+char       *st_arena_strndup (st_arena *arena, const char *string, size_t n);
+void        st_arena_destroy (st_arena *arena);
+
+#define st_arena_new0(arena, struct_type) ((struct_type *) st_arena_alloc ((arena), sizeof (struct_type)))
+
 #if  defined(__GNUC__) && defined(__OPTIMIZE__)
 #define ST_LIKELY(condition)     __builtin_expect (!!(condition), 1)
 #define ST_UNLIKELY(condition)   __builtin_expect (!!(condition), 0)
@@ -51,7 +51,7 @@ main (int argc, char *argv[])
 
     printf ("\nGenerated Method:\n\n"); 
     st_print_method (method);
-    st_node_destroy (node);    
+    st_lexer_destroy (lexer);
 
     return 0;
 }
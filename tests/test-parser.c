@@ -38,7 +38,7 @@ main (int argc, char *argv[])
     printf ("-------------------\n");	    
 
     st_print_method_node (node);
-    st_node_destroy (node);
+    st_lexer_destroy (lexer);
 
     return 0;
 }
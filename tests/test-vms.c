@@ -0,0 +1,75 @@
+
+#include <st-compiler.h>
+#include <st-universe.h>
+#include <st-machine.h>
+#include <st-array.h>
+#include <st-object.h>
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define N_MACHINES 4
+
+/* Each thread bootstraps and runs its own VM. The doIt allocates, so
+ * each machine collects its own heap, and forks a second process, so
+ * the machines also share the time slice timer. */
+static const char source[] =
+    "doIt ^ [| sum done |"
+    "  sum := 0. done := Semaphore new."
+    "  [1 to: 1000000 do: [:i | sum := sum + ((Array new: 1) at: 1 put: i \\\\ %d; first)]. done signal] fork."
+    "  done wait. sum] value";
+
+static void *
+run_machine (void *data)
+{
+    st_compiler_error error;
+    long   modulus = (long) data;
+    long   expected = 0;
+    char   string[256];
+    char  *result;
+    st_oop value;
+
+    for (long i = 1; i <= 1000000; i++)
+	expected += i % modulus;
+
+    st_initialize ();
+
+    snprintf (string, sizeof (string), source, (int) modulus);
+    if (!st_compile_string (ST_UNDEFINED_OBJECT_CLASS, string, &error)) {
+	fprintf (stderr, "test-vms:%i: %s\n", error.line, error.message);
+	abort ();
+    }
+
+    st_machine_initialize (&__machine);
+    st_machine_main (&__machine);
+
+    value = ST_STACK_PEEK ((&__machine));
+    if (st_object_format (value) != ST_FORMAT_BYTE_ARRAY)
+	abort ();
+
+    result = (char *) st_byte_array_bytes (value);
+    printf ("machine %ld: %s (expected %ld)\n", modulus, result, expected);
+
+    return (void *) (long) (atol (result) == expected);
+}
+
+int
+main (int argc, char *argv[])
+{
+    pthread_t threads[N_MACHINES];
+    void *passed;
+    bool  failed = false;
+
+    for (long i = 0; i < N_MACHINES; i++)
+	pthread_create (&threads[i], NULL, run_machine, (void *) (i + 2));
+
+    for (int i = 0; i < N_MACHINES; i++) {
+	pthread_join (threads[i], &passed);
+	if (!passed)
+	    failed = true;
+    }
+
+    return failed ? 1 : 0;
+}